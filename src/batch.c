@@ -0,0 +1,361 @@
+// Batch image processing with the editor's pixel kernels.
+//
+// Built against the headless raylib like the benchmarks (see
+// `./make build-batch`) but never opens a window. Every image in the input
+// directory goes through the edits in the order they are given on the
+// command line, the same kernels the image controls run, and is written to
+// the output directory, in another format with --format.
+//
+// Each file is one job that reads, decodes, edits, encodes and writes it.
+// Erosion splits its rows among whichever workers are idle meanwhile, and
+// since job_wait() only helps with its own group, a thread waiting for rows
+// never starts another file: only as many images are in memory as there are
+// threads.
+#define HATORI_NO_MAIN
+#include "hatori3.c"
+
+#include <ctype.h>
+
+#define BATCH_FILTER ".png;.jpg;.jpeg;.bmp;.tga;.qoi"
+#define BATCH_THRESHOLD 30 // the fill button's
+#define BATCH_JPG_QUALITY 90
+
+typedef struct Batch_File {
+	const char* input;
+	const char* type; // extension of `input`
+	char output[512];
+	const char* output_type; // lower case extension of `output`
+	U64 read_bytes;
+	U64 written_bytes;
+	U64 pixels;
+	double ms;
+	bool collides; // another file has the same output
+	bool failed;
+} Batch_File;
+
+typedef struct Batch_Output {
+	FILE* file;
+	U64 bytes;
+	bool failed;
+} Batch_Output;
+
+List(Hatori_ImageEdit) edits;
+const char* format; // extension to write, NULL keeps the input's
+
+void batch_write(void* context, void* data, int size)
+{
+	Batch_Output* out = context;
+	if (fwrite(data, 1, size, out->file) != (size_t)size) {
+		out->failed = true;
+	}
+	out->bytes += size;
+}
+
+// Encodes as `type` (".png", ...), straight into the file where the encoder
+// allows.
+bool write_image(Image img, const char* path, const char* type, U64* bytes)
+{
+	Batch_Output out = { fopen(path, "wb") };
+	if (out.file == NULL) {
+		return false;
+	}
+	int w = img.width;
+	int h = img.height;
+	bool ok = false;
+	if (strcmp(type, ".qoi") == 0) {
+		Hatori_Blob blob = encode_image_blob(img);
+		if (blob.data != NULL) {
+			batch_write(&out, (void*)blob.data, blob.size);
+			RL_FREE((void*)blob.data);
+			ok = true;
+		}
+	} else if (strcmp(type, ".png") == 0) {
+		ok = stbi_write_png_to_func(batch_write, &out, w, h, 4, img.data, w * 4);
+	} else if (strcmp(type, ".bmp") == 0) {
+		ok = stbi_write_bmp_to_func(batch_write, &out, w, h, 4, img.data);
+	} else if (strcmp(type, ".tga") == 0) {
+		ok = stbi_write_tga_to_func(batch_write, &out, w, h, 4, img.data);
+	} else if (strcmp(type, ".jpg") == 0) {
+		// No alpha in JPEG, what was removed turns white.
+		ImageAlphaClear(&img, WHITE, 0);
+		ok = stbi_write_jpg_to_func(
+				batch_write, &out, w, h, 4, img.data, BATCH_JPG_QUALITY);
+	}
+	ok = fclose(out.file) == 0 && ok && !out.failed;
+	*bytes = out.bytes;
+	return ok;
+}
+
+void process_file(void* arg)
+{
+	Batch_File* f = arg;
+	U64 start = profile_now();
+	int size = 0;
+	U8* data = LoadFileData(f->input, &size);
+	if (data == NULL) {
+		fprintf(stderr, "%s: can't read\n", f->input);
+		f->failed = true;
+		return;
+	}
+	f->read_bytes = size;
+	Image img = LoadImageFromMemory(f->type, data, size);
+	UnloadFileData(data);
+	if (img.data == NULL) {
+		fprintf(stderr, "%s: can't decode\n", f->input);
+		f->failed = true;
+		return;
+	}
+	ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	f->pixels = (U64)img.width * img.height;
+	Arena* scratch = scratch_arena();
+	Arena_Mark mark = arena_mark(scratch);
+	for (size_t i = 0; i < edits.count; ++i) {
+		Hatori_ImageEdit edit = edits.items[i];
+		if (edit.type == EDIT_FLOOD) {
+			// Negative seeds count from the right and bottom.
+			edit.pos.x += edit.pos.x < 0 ? img.width : 0;
+			edit.pos.y += edit.pos.y < 0 ? img.height : 0;
+			if (edit.pos.x < 0 || edit.pos.x >= img.width || edit.pos.y < 0
+					|| edit.pos.y >= img.height) {
+				continue;
+			}
+		}
+		apply_image_edit(&img, edit);
+	}
+	if (!write_image(img, f->output, f->output_type, &f->written_bytes)) {
+		fprintf(stderr, "%s: can't write %s\n", f->input, f->output);
+		f->failed = true;
+	}
+	UnloadImage(img);
+	release_scratch(scratch, mark);
+	U64 end = profile_now();
+	f->ms = (end - start) / 1e6;
+	profile_record(&profiler, "process_file()", start, end);
+}
+
+bool parse_seed(const char* arg)
+{
+	if (strcmp(arg, "corners") == 0) {
+		const Vector2 corners[] = { { 0, 0 }, { -1, 0 }, { 0, -1 }, { -1, -1 } };
+		for (int i = 0; i < 4; ++i) {
+			list_append(&edits,
+					((Hatori_ImageEdit) { EDIT_FLOOD, corners[i], BATCH_THRESHOLD }));
+		}
+		return true;
+	}
+	int x, y;
+	int threshold = BATCH_THRESHOLD;
+	if (sscanf(arg, "%d,%d,%d", &x, &y, &threshold) < 2) {
+		return false;
+	}
+	list_append(&edits,
+			((Hatori_ImageEdit) { EDIT_FLOOD, { x, y }, threshold }));
+	return true;
+}
+
+// Lower case with a dot, ".jpeg" as ".jpg", NULL when it can't be written.
+const char* output_type(const char* ext, char* buffer, size_t size)
+{
+	size_t n = 0;
+	for (ext += *ext == '.'; ext[n] != '\0' && n + 2 < size; ++n) {
+		buffer[n + 1] = tolower((unsigned char)ext[n]);
+	}
+	buffer[0] = '.';
+	buffer[n + 1] = '\0';
+	if (strcmp(buffer, ".jpeg") == 0) {
+		strcpy(buffer, ".jpg");
+	}
+	const char* known[] = { ".png", ".qoi", ".bmp", ".tga", ".jpg" };
+	for (size_t i = 0; i < sizeof(known) / sizeof(*known); ++i) {
+		if (strcmp(buffer, known[i]) == 0) {
+			return known[i];
+		}
+	}
+	return NULL;
+}
+
+int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+int compare_outputs(const void* a, const void* b)
+{
+	return strcmp(
+			(*(Batch_File* const*)a)->output, (*(Batch_File* const*)b)->output);
+}
+
+// Marks the files that would write the same output as another one, returns
+// how many there are. Reorders `sorted`.
+int find_collisions(Batch_File** sorted, unsigned int count)
+{
+	qsort(sorted, count, sizeof(*sorted), compare_outputs);
+	int n = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		sorted[i]->collides
+				= (i > 0 && strcmp(sorted[i - 1]->output, sorted[i]->output) == 0)
+				|| (i + 1 < count
+						&& strcmp(sorted[i + 1]->output, sorted[i]->output) == 0);
+		n += sorted[i]->collides;
+	}
+	return n;
+}
+
+bool same_directory(const char* a, const char* b)
+{
+	struct stat sa, sb;
+	return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev
+			&& sa.st_ino == sb.st_ino;
+}
+
+int main(int argc, char** argv)
+{
+	const char* input_dir = NULL;
+	const char* output_dir = NULL;
+	const char* trace_path = NULL;
+	int workers = jobs_default_workers();
+	char format_buffer[16];
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; ++i) {
+		if (strcmp(argv[i], "--remove") == 0 && i + 1 < argc) {
+			usage = !parse_seed(argv[++i]);
+		} else if (strcmp(argv[i], "--erode") == 0) {
+			int n = i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])
+					? atoi(argv[++i])
+					: 1;
+			for (int k = 0; k < n; ++k) {
+				list_append(&edits, ((Hatori_ImageEdit) { .type = EDIT_ERODE }));
+			}
+		} else if (strcmp(argv[i], "--hflip") == 0) {
+			list_append(&edits, ((Hatori_ImageEdit) { .type = EDIT_HFLIP }));
+		} else if (strcmp(argv[i], "--vflip") == 0) {
+			list_append(&edits, ((Hatori_ImageEdit) { .type = EDIT_VFLIP }));
+		} else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+			format = output_type(argv[++i], format_buffer, sizeof(format_buffer));
+			usage = format == NULL;
+		} else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			workers = atoi(argv[++i]) - 1;
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (argv[i][0] != '-' && input_dir == NULL) {
+			input_dir = argv[i];
+		} else if (argv[i][0] != '-' && output_dir == NULL) {
+			output_dir = argv[i];
+		} else {
+			usage = true;
+		}
+	}
+	if (usage || input_dir == NULL || output_dir == NULL) {
+		fprintf(stderr,
+				"usage: %s [--remove x,y[,threshold] | --remove corners] "
+				"[--erode [N]] [--hflip] [--vflip] "
+				"[--format png|qoi|bmp|tga|jpg] [--jobs N] [--trace out.json] "
+				"<input dir> <output dir>\n",
+				argv[0]);
+		return 1;
+	}
+	SetTraceLogLevel(LOG_WARNING);
+	if (!DirectoryExists(input_dir)) {
+		fprintf(stderr, "%s: no directory %s\n", argv[0], input_dir);
+		return 1;
+	}
+	if (!DirectoryExists(output_dir) && MakeDirectory(output_dir) != 0) {
+		fprintf(stderr, "%s: can't create %s\n", argv[0], output_dir);
+		return 1;
+	}
+	if (same_directory(input_dir, output_dir)) {
+		fprintf(stderr, "%s: won't overwrite the input images\n", argv[0]);
+		return 1;
+	}
+
+	FilePathList paths = LoadDirectoryFilesEx(input_dir, BATCH_FILTER, false);
+	Batch_File* files = calloc(paths.count > 0 ? paths.count : 1, sizeof(*files));
+	assert(files != NULL && "Buy more RAM!!");
+	for (unsigned int i = 0; i < paths.count; ++i) {
+		Batch_File* f = &files[i];
+		char type[16];
+		f->input = paths.paths[i];
+		f->type = GetFileExtension(f->input);
+		const char* out = format != NULL
+				? format
+				: output_type(f->type, type, sizeof(type));
+		f->output_type = out != NULL ? out : ".png";
+		snprintf(f->output, sizeof(f->output), "%s/%s%s", output_dir,
+				GetFileNameWithoutExt(f->input), f->output_type);
+	}
+	// a.png and a.jpg would both write a.png, keep their extension instead:
+	// a.png.png and a.jpg.png.
+	Batch_File** sorted
+			= calloc(paths.count > 0 ? paths.count : 1, sizeof(*sorted));
+	assert(sorted != NULL && "Buy more RAM!!");
+	for (unsigned int i = 0; i < paths.count; ++i) {
+		sorted[i] = &files[i];
+	}
+	if (find_collisions(sorted, paths.count) > 0) {
+		for (unsigned int i = 0; i < paths.count; ++i) {
+			Batch_File* f = &files[i];
+			if (f->collides) {
+				snprintf(f->output, sizeof(f->output), "%s/%s%s", output_dir,
+						GetFileName(f->input), f->output_type);
+			}
+		}
+		if (find_collisions(sorted, paths.count) > 0) {
+			for (unsigned int i = 0; i < paths.count; ++i) {
+				if (sorted[i]->collides) {
+					fprintf(stderr, "%s: %s is also written from another file\n",
+							sorted[i]->input, sorted[i]->output);
+				}
+			}
+			free(sorted);
+			free(files);
+			UnloadDirectoryFiles(paths);
+			return 1;
+		}
+	}
+	free(sorted);
+
+	jobs_init(&jobs, workers);
+	int threads = jobs.workers + 1;
+	double start = GetTime();
+	Job_Group group = { 0 };
+	for (unsigned int i = 0; i < paths.count; ++i) {
+		jobs_spawn(&jobs, &group, process_file, &files[i]);
+	}
+	job_wait(&jobs, &group);
+	double seconds = GetTime() - start;
+	jobs_shutdown(&jobs);
+
+	int done = 0;
+	U64 pixels = 0, read_bytes = 0, written_bytes = 0;
+	List(double) times = { 0 };
+	for (unsigned int i = 0; i < paths.count; ++i) {
+		done += !files[i].failed;
+		pixels += files[i].pixels;
+		read_bytes += files[i].read_bytes;
+		written_bytes += files[i].written_bytes;
+		if (!files[i].failed) {
+			list_append(&times, files[i].ms);
+		}
+	}
+	seconds = seconds > 0 ? seconds : 1e-9;
+	printf("%d of %u images in %.2f s with %d threads: %.1f images/s, "
+				 "%.1f MP/s, %.1f MB read, %.1f MB written\n",
+			done, paths.count, seconds, threads, done / seconds,
+			pixels / 1e6 / seconds, read_bytes / 1048576.0,
+			written_bytes / 1048576.0);
+	if (times.count > 0) {
+		qsort(times.items, times.count, sizeof(*times.items), compare_doubles);
+		printf("per image: median %.1f ms, max %.1f ms\n",
+				times.items[times.count / 2], times.items[times.count - 1]);
+	}
+	list_free(&times);
+	if (trace_path != NULL) {
+		dump_profile(trace_path);
+	}
+	free(files);
+	UnloadDirectoryFiles(paths);
+	list_free(&edits);
+	return done == (int)paths.count ? 0 : 1;
+}
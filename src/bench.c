@@ -0,0 +1,442 @@
+// Micro-benchmarks for the pixel kernels and the scene operations.
+//
+// Built against the headless raylib (see `./make build-bench`), so it runs
+// the app's own code on an offscreen framebuffer. Every benchmark is run
+// until it has MIN_RUNS samples and then until its time budget is used up,
+// and reports min, median and p99 per parameter: image sizes for the
+// kernels, item counts for the scene operations. `--json` and `--csv` write
+// the same numbers for comparing versions.
+#define HATORI_NO_MAIN
+#include "hatori3.c"
+
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 720
+#define MIN_RUNS 3
+#define MAX_RUNS 1000
+#define STROKE_SEGMENTS 16
+#define CELL_SIZE 32
+
+typedef struct Bench_Result {
+	char name[48];
+	char param[16];
+	int runs;
+	double min;
+	double median;
+	double p99;
+	double mean;
+} Bench_Result;
+
+typedef struct Bench {
+	Bench_Result result;
+	List(double) times;
+	double start;
+	double total;
+} Bench;
+
+typedef struct Bench_Size {
+	const char* label;
+	int width;
+	int height;
+} Bench_Size;
+
+static const Bench_Size image_sizes[] = {
+	{ "1MP", 1000, 1000 },
+	{ "12MP", 4000, 3000 },
+	{ "50MP", 8000, 6250 },
+};
+
+static const int item_counts[] = { 1000, 10000, 100000, 1000000 };
+
+List(Bench_Result) results;
+const char* filter;
+double budget_ms = 1000;
+int fixed_runs;
+bool quick;
+
+bool bench_wanted(const char* name)
+{
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+Bench bench_start(const char* name, const char* param)
+{
+	Bench b = { 0 };
+	snprintf(b.result.name, sizeof(b.result.name), "%s", name);
+	snprintf(b.result.param, sizeof(b.result.param), "%s", param);
+	return b;
+}
+
+int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+void bench_begin(Bench* b) { b->start = GetTime(); }
+
+void bench_end(Bench* b)
+{
+	double ms = (GetTime() - b->start) * 1000;
+	list_append(&b->times, ms);
+	b->total += ms;
+}
+
+void bench_finish(Bench* b)
+{
+	Bench_Result* r = &b->result;
+	r->runs = b->times.count;
+	if (r->runs > 0) {
+		qsort(b->times.items, r->runs, sizeof(double), compare_doubles);
+		int p99 = (int)ceil(r->runs * 0.99) - 1;
+		r->min = b->times.items[0];
+		r->median = b->times.items[r->runs / 2];
+		r->p99 = b->times.items[p99 < 0 ? 0 : p99];
+		r->mean = b->total / r->runs;
+	}
+	free(b->times.items);
+	list_append(&results, *r);
+	printf("%-28s %8s %6d %10.3f %10.3f %10.3f\n", r->name, r->param, r->runs,
+			r->min, r->median, r->p99);
+	fflush(stdout);
+}
+
+// Keeps going until there are enough samples, then reports the benchmark.
+bool bench_next(Bench* b)
+{
+	int runs = b->times.count;
+	bool more = fixed_runs > 0
+			? runs < fixed_runs
+			: runs < MIN_RUNS || (runs < MAX_RUNS && b->total < budget_ms);
+	if (!more) {
+		bench_finish(b);
+	}
+	return more;
+}
+
+// Off-white paper with a little noise and a transparent dot every 64 px, so
+// a flood fill spreads over most of it and erosion has edges to eat into.
+Image bench_image(int width, int height)
+{
+	Image img = GenImageColor(width, height, WHITE);
+	Color* pixels = img.data;
+	U32 seed = 1;
+	for (size_t i = 0; i < (size_t)width * height; ++i) {
+		seed = seed * 1664525 + 1013904223;
+		U8 v = 235 + (seed >> 24) % 20;
+		pixels[i] = (Color) { v, v, v, 255 };
+	}
+	for (int y = 32; y < height; y += 64) {
+		for (int x = 32; x < width; x += 64) {
+			ImageDrawCircle(&img, x, y, 6, BLANK);
+		}
+	}
+	return img;
+}
+
+// Lays `count` items out on a square grid that fills the height of the
+// screen, the way an overview of a big board looks.
+int bench_grid(int count, int per_cell)
+{
+	int cols = (int)ceil(sqrt((double)count / per_cell));
+	scale = (float)BENCH_HEIGHT / (cols * CELL_SIZE);
+	offset_x = 0;
+	offset_y = 0;
+	return cols;
+}
+
+void bench_clear_scene(void)
+{
+	list_clear(&lines);
+	clear_strokes();
+	for (size_t i = 0; i < entities.count; ++i) {
+		if (!entities.items[i].deleted) {
+			delete_entity(i);
+		}
+	}
+	list_clear(&entities);
+	selected_entity = -1;
+	scale = 1;
+	offset_x = 0;
+	offset_y = 0;
+}
+
+void bench_pixels(const Bench_Size* size)
+{
+	Image source = bench_image(size->width, size->height);
+	Image work = ImageCopy(source);
+	size_t bytes = (size_t)size->width * size->height * 4;
+
+	if (bench_wanted("flood_remove")) {
+		Bench b = bench_start("flood_remove", size->label);
+		while (bench_next(&b)) {
+			memcpy(work.data, source.data, bytes);
+			bench_begin(&b);
+			flood_remove(&work, (Vector2) { 0, 0 }, 30);
+			bench_end(&b);
+		}
+	}
+	if (bench_wanted("erode_image")) {
+		Bench b = bench_start("erode_image", size->label);
+		while (bench_next(&b)) {
+			memcpy(work.data, source.data, bytes);
+			bench_begin(&b);
+			erode_image(&work);
+			bench_end(&b);
+		}
+	}
+	if (bench_wanted("flip_image_horizontal")) {
+		Bench b = bench_start("flip_image_horizontal", size->label);
+		while (bench_next(&b)) {
+			bench_begin(&b);
+			flip_image_horizontal(&work);
+			bench_end(&b);
+		}
+	}
+	if (bench_wanted("ImageFlipVertical")) {
+		Bench b = bench_start("ImageFlipVertical", size->label);
+		while (bench_next(&b)) {
+			bench_begin(&b);
+			ImageFlipVertical(&work);
+			bench_end(&b);
+		}
+	}
+	if (bench_wanted("flip_rows")) {
+		Bench b = bench_start("flip_rows", size->label);
+		while (bench_next(&b)) {
+			bench_begin(&b);
+			flip_rows(work.data, source.data, size->width * 4, size->height);
+			bench_end(&b);
+		}
+	}
+	UnloadImage(work);
+
+	// The whole edit as the image controls do it: undo tiles, the edit and
+	// marking the pixels for upload.
+	if (bench_wanted("hflip_on_click_image")) {
+		selected_entity = add_image_entity(ImageCopy(source), (Vector2) { 0, 0 },
+				(Vector2) { size->width, size->height });
+		hflip_on_click_image();
+		end_undo_step();
+		clear_undo();
+		Bench b = bench_start("hflip_on_click_image", size->label);
+		while (bench_next(&b)) {
+			bench_begin(&b);
+			hflip_on_click_image();
+			bench_end(&b);
+			end_undo_step();
+			clear_undo();
+		}
+		bench_clear_scene();
+	}
+	UnloadImage(source);
+}
+
+// Pen strokes of STROKE_SEGMENTS zig-zagging segments, one per grid cell.
+void bench_lines(int count)
+{
+	int cols = bench_grid(count, STROKE_SEGMENTS);
+	for (int i = 0; i < count; ++i) {
+		int cell = i / STROKE_SEGMENTS;
+		int k = i % STROKE_SEGMENTS;
+		float x = cell % cols * CELL_SIZE + 4;
+		float y = cell / cols * CELL_SIZE + 4;
+		float step = (CELL_SIZE - 8.0f) / STROKE_SEGMENTS;
+		list_append(&lines,
+				((Hatori_Line) { x + k * step, y + (k % 2) * 16,
+						x + (k + 1) * step, y + ((k + 1) % 2) * 16, 3, false }));
+	}
+	lines_changed(0);
+}
+
+// Small images sharing their pixels, like pasting the same one many times.
+void bench_entities(int count)
+{
+	int cols = bench_grid(count, 1);
+	Image img = GenImageChecked(16, 16, 4, 4, RED, DARKBLUE);
+	int first = add_image_entity(
+			img, (Vector2) { 4, 4 }, (Vector2) { CELL_SIZE - 8, CELL_SIZE - 8 });
+	for (int i = 1; i < count; ++i) {
+		Hatori_BoardEntity be = board_entity(entities.items[first]);
+		be.pos = (Vector2) { i % cols * CELL_SIZE + 4, i / cols * CELL_SIZE + 4 };
+		be.z = i;
+		copy_image_entity(first, be);
+	}
+}
+
+// Draws with the frame's GL work finished inside the timing.
+void bench_draw(Bench* b, void (*draw)(void))
+{
+	BeginDrawing();
+	ClearBackground(HATORI_BG);
+	if (b != NULL) {
+		bench_begin(b);
+	}
+	BeginMode2D(board_camera());
+	draw();
+	EndMode2D();
+	rlDrawRenderBatchActive();
+	glFinish();
+	if (b != NULL) {
+		bench_end(b);
+	}
+	EndDrawing();
+	upload_textures();
+	arena_reset(&frame_arena);
+}
+
+void bench_scene(int count)
+{
+	char param[16];
+	snprintf(param, sizeof(param), "%d", count);
+	// Nothing is under the mouse, so every item gets tested.
+	Vector2 away = { BENCH_HEIGHT + 100, BENCH_HEIGHT / 2.0f };
+
+	if (bench_wanted("draw_lines") || bench_wanted("eraser_hit_test")) {
+		bench_lines(count);
+		for (int i = 0; i < 3; ++i) {
+			bench_draw(NULL, draw_lines);
+		}
+		if (bench_wanted("draw_lines")) {
+			Bench b = bench_start("draw_lines", param);
+			while (bench_next(&b)) {
+				bench_draw(&b, draw_lines);
+			}
+		}
+		if (bench_wanted("eraser_hit_test")) {
+			mode = ERASURE_MODE;
+			headless_mouse_move(away.x, away.y);
+			headless_mouse_button(MOUSE_BUTTON_LEFT, true);
+			Bench b = bench_start("eraser_hit_test", param);
+			while (bench_next(&b)) {
+				BeginDrawing();
+				bench_begin(&b);
+				handle_input_erasure();
+				bench_end(&b);
+				EndDrawing();
+				arena_reset(&frame_arena);
+			}
+			headless_mouse_button(MOUSE_BUTTON_LEFT, false);
+			mode = SELECTION_MODE;
+		}
+		bench_clear_scene();
+	}
+
+	if (bench_wanted("draw_entities") || bench_wanted("pick_entities")) {
+		bench_entities(count);
+		for (int i = 0; i < 3; ++i) {
+			bench_draw(NULL, draw_entities);
+		}
+		if (bench_wanted("draw_entities")) {
+			Bench b = bench_start("draw_entities", param);
+			while (bench_next(&b)) {
+				bench_draw(&b, draw_entities);
+			}
+		}
+		if (bench_wanted("pick_entities")) {
+			mode = SELECTION_MODE;
+			headless_mouse_move(away.x, away.y);
+			Bench b = bench_start("pick_entities", param);
+			while (bench_next(&b)) {
+				bench_begin(&b);
+				handle_mouse_input_entities();
+				bench_end(&b);
+			}
+		}
+		bench_clear_scene();
+	}
+}
+
+void write_csv(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		TraceLog(LOG_ERROR, "Can't write %s", path);
+		return;
+	}
+	fprintf(file, "name,param,runs,min_ms,median_ms,p99_ms,mean_ms\n");
+	for (size_t i = 0; i < results.count; ++i) {
+		Bench_Result r = results.items[i];
+		fprintf(file, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f\n", r.name, r.param, r.runs,
+				r.min, r.median, r.p99, r.mean);
+	}
+	fclose(file);
+}
+
+void write_json(const char* path, const char* label)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		TraceLog(LOG_ERROR, "Can't write %s", path);
+		return;
+	}
+	fprintf(file, "{\n  \"label\": \"%s\",\n  \"results\": [\n", label);
+	for (size_t i = 0; i < results.count; ++i) {
+		Bench_Result r = results.items[i];
+		fprintf(file,
+				"    {\"name\": \"%s\", \"param\": \"%s\", \"runs\": %d, "
+				"\"min_ms\": %.4f, \"median_ms\": %.4f, \"p99_ms\": %.4f, "
+				"\"mean_ms\": %.4f}%s\n",
+				r.name, r.param, r.runs, r.min, r.median, r.p99, r.mean,
+				i + 1 < results.count ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+	const char* json_path = NULL;
+	const char* csv_path = NULL;
+	const char* label = "";
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			json_path = argv[++i];
+		} else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+			csv_path = argv[++i];
+		} else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+			label = argv[++i];
+		} else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			filter = argv[++i];
+		} else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+			budget_ms = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+			fixed_runs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--quick") == 0) {
+			quick = true;
+		} else {
+			fprintf(stderr,
+					"usage: %s [--json out.json] [--csv out.csv] [--label name] "
+					"[--filter name] [--budget ms] [--runs N] [--quick]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+
+	SetTraceLogLevel(LOG_WARNING);
+	init_hatori(BENCH_WIDTH, BENCH_HEIGHT);
+	if (!IsWindowReady()) {
+		return 1;
+	}
+
+	printf("%-28s %8s %6s %10s %10s %10s\n", "benchmark", "param", "runs",
+			"min ms", "median ms", "p99 ms");
+	int sizes = quick ? 1 : sizeof(image_sizes) / sizeof(*image_sizes);
+	for (int i = 0; i < sizes; ++i) {
+		bench_pixels(&image_sizes[i]);
+	}
+	int counts = quick ? 2 : sizeof(item_counts) / sizeof(*item_counts);
+	for (int i = 0; i < counts; ++i) {
+		bench_scene(item_counts[i]);
+	}
+
+	if (csv_path != NULL) {
+		write_csv(csv_path);
+	}
+	if (json_path != NULL) {
+		write_json(json_path, label);
+	}
+	free(results.items);
+	CloseWindow();
+	return 0;
+}
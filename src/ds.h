@@ -1,39 +1,267 @@
 #ifndef DS
 #define DS
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+typedef uint64_t U64;
+typedef uint32_t U32;
+typedef uint16_t U16;
+typedef uint8_t U8;
+
 #define LIST_INIT_CAP 256
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_KEEP_MAX (4 * 1024 * 1024)
+#define ARENA_ALIGN 16
+
+// Bump allocator. Allocations are carved out of a chain of blocks and only
+// given back all at once, by arena_reset() or arena_free(), or down to an
+// arena_mark() with arena_rewind().
+typedef struct Arena_Block {
+	struct Arena_Block* next;
+	size_t size; // bytes in data
+	size_t used;
+	U8 data[];
+} Arena_Block;
+
+typedef struct Arena {
+	Arena_Block* first;
+	Arena_Block* current; // blocks after it are empty
+	size_t block_size; // 0 means ARENA_BLOCK_SIZE
+} Arena;
+
+typedef struct Arena_Mark {
+	Arena_Block* block;
+	size_t used;
+} Arena_Mark;
+
+static inline Arena_Block* arena_block(size_t size)
+{
+	Arena_Block* b = malloc(sizeof(*b) + size);
+	assert(b != NULL && "Buy more RAM!!");
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+static inline void* arena_alloc(Arena* a, size_t size)
+{
+	for (Arena_Block* b = a->current; b != NULL; b = b->next) {
+		size_t pad = -(uintptr_t)(b->data + b->used) & (ARENA_ALIGN - 1);
+		if (b->used + pad + size <= b->size) {
+			a->current = b;
+			b->used += pad;
+			void* p = b->data + b->used;
+			b->used += size;
+			return p;
+		}
+	}
+	size_t block_size = a->block_size > 0 ? a->block_size : ARENA_BLOCK_SIZE;
+	Arena_Block* b = arena_block(
+			size + ARENA_ALIGN > block_size ? size + ARENA_ALIGN : block_size);
+	if (a->current == NULL) {
+		a->first = b;
+	} else {
+		b->next = a->current->next;
+		a->current->next = b;
+	}
+	a->current = b;
+	return arena_alloc(a, size);
+}
+
+// Grows the allocation `p` of `old_size` bytes, in place when it is the last
+// one in the arena.
+static inline void* arena_grow(Arena* a, void* p, size_t old_size, size_t size)
+{
+	Arena_Block* b = a->current;
+	if (p != NULL && b != NULL && (U8*)p + old_size == b->data + b->used
+			&& (size_t)((U8*)p - b->data) + size <= b->size) {
+		b->used = (U8*)p - b->data + size;
+		return p;
+	}
+	void* q = arena_alloc(a, size);
+	if (p != NULL) {
+		memcpy(q, p, old_size < size ? old_size : size);
+	}
+	return q;
+}
+
+static inline Arena_Mark arena_mark(Arena* a)
+{
+	return (Arena_Mark) { a->current, a->current ? a->current->used : 0 };
+}
+
+// Frees everything allocated since `mark`. The blocks stay for reuse.
+static inline void arena_rewind(Arena* a, Arena_Mark mark)
+{
+	Arena_Block* b = mark.block != NULL ? mark.block : a->first;
+	if (b == NULL) {
+		return;
+	}
+	b->used = mark.used;
+	for (Arena_Block* next = b->next; next != NULL; next = next->next) {
+		next->used = 0;
+	}
+	a->current = b;
+}
+
+// Frees everything. When the arena needed more than one block, or one larger
+// than ARENA_KEEP_MAX, it is replaced by a single block that size, up to
+// ARENA_KEEP_MAX, so a steady load stops allocating and a spike is given back.
+static inline void arena_reset(Arena* a)
+{
+	if (a->first == NULL) {
+		return;
+	}
+	if (a->first->next != NULL || a->first->size > ARENA_KEEP_MAX) {
+		size_t total = 0;
+		for (Arena_Block *b = a->first, *next; b != NULL; b = next) {
+			next = b->next;
+			total += b->size;
+			free(b);
+		}
+		a->first = arena_block(total < ARENA_KEEP_MAX ? total : ARENA_KEEP_MAX);
+	}
+	a->first->used = 0;
+	a->current = a->first;
+}
+
+static inline void arena_free(Arena* a)
+{
+	for (Arena_Block *b = a->first, *next; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+	a->first = NULL;
+	a->current = NULL;
+}
+
+// Bytes the arena holds, used or not.
+static inline size_t arena_bytes(Arena* a)
+{
+	size_t bytes = 0;
+	for (Arena_Block* b = a->first; b != NULL; b = b->next) {
+		bytes += sizeof(*b) + b->size;
+	}
+	return bytes;
+}
 
+// Fixed size objects carved out of an arena. Freed ones are kept in a list
+// linked through their first bytes and handed out again first.
+typedef struct Pool {
+	Arena arena;
+	size_t size; // of an object, set before the first pool_alloc()
+	void* free;
+	size_t count; // objects handed out
+} Pool;
+
+// Returns a zeroed object.
+static inline void* pool_alloc(Pool* p)
+{
+	void* o = p->free;
+	if (o != NULL) {
+		memcpy(&p->free, o, sizeof(void*));
+	} else {
+		o = arena_alloc(
+				&p->arena, p->size > sizeof(void*) ? p->size : sizeof(void*));
+	}
+	memset(o, 0, p->size);
+	p->count++;
+	return o;
+}
+
+static inline void pool_free(Pool* p, void* o)
+{
+	if (o != NULL) {
+		memcpy(o, &p->free, sizeof(void*));
+		p->free = o;
+		p->count--;
+	}
+}
+
+// A list whose items live in `arena` when it is set, then they are never
+// freed on their own and growing abandons the old items unless they were
+// the last allocation.
 #define List(Type)                                                             \
 	struct {                                                                     \
 		size_t count;                                                              \
 		size_t capacity;                                                           \
 		Type* items;                                                               \
+		Arena* arena;                                                              \
+	}
+
+static inline void* list_grow(
+		Arena* arena, void* items, size_t old_bytes, size_t bytes)
+{
+	if (arena != NULL) {
+		return arena_grow(arena, items, old_bytes, bytes);
 	}
+	void* tmp = realloc(items, bytes);
+	assert(tmp != NULL && "Buy more RAM!!");
+	return tmp;
+}
 
 #define list_init(list, cap)                                                   \
 	do {                                                                         \
-		(list)->items                                                              \
-				= calloc(sizeof(*(list)->items) * cap, sizeof(*(list)->items));        \
+		(list)->items = calloc((cap), sizeof(*(list)->items));                     \
 		assert((list)->items != NULL && "Buy more RAM!!");                         \
 		(list)->count = 0;                                                         \
 		(list)->capacity = (cap);                                                  \
+		(list)->arena = NULL;                                                      \
+	} while (0)
+
+#define list_init_arena(list, a, cap)                                          \
+	do {                                                                         \
+		(list)->arena = (a);                                                       \
+		(list)->items                                                              \
+				= arena_alloc((list)->arena, (cap) * sizeof(*(list)->items));          \
+		(list)->count = 0;                                                         \
+		(list)->capacity = (cap);                                                  \
 	} while (0)
 
 #define list_append(list, item)                                                \
 	do {                                                                         \
 		if ((list)->count >= (list)->capacity) {                                   \
-			(list)->capacity                                                         \
+			size_t cap_                                                              \
 					= ((list)->capacity) == 0 ? LIST_INIT_CAP : (list)->capacity * 2;    \
-			void* tmp = realloc(                                                     \
-					(list)->items, (list)->capacity * sizeof(*((list)->items)));         \
-			assert(tmp != NULL && "Buy more RAM!!");                                 \
-			(list)->items = tmp;                                                     \
+			(list)->items = list_grow((list)->arena, (list)->items,                  \
+					(list)->capacity * sizeof(*((list)->items)),                         \
+					cap_ * sizeof(*((list)->items)));                                    \
+			(list)->capacity = cap_;                                                 \
 		}                                                                          \
 		(list)->items[(list)->count++] = (item);                                   \
 	} while (0)
 
+#define list_append_many(list, new_items, new_count)                           \
+	do {                                                                         \
+		if ((list)->count + (new_count) > (list)->capacity) {                      \
+			size_t cap_ = (list)->capacity == 0 ? LIST_INIT_CAP : (list)->capacity;  \
+			while ((list)->count + (new_count) > cap_) {                             \
+				cap_ *= 2;                                                             \
+			}                                                                        \
+			(list)->items = list_grow((list)->arena, (list)->items,                  \
+					(list)->capacity * sizeof(*((list)->items)),                         \
+					cap_ * sizeof(*((list)->items)));                                    \
+			(list)->capacity = cap_;                                                 \
+		}                                                                          \
+		memcpy((list)->items + (list)->count, (new_items),                         \
+				(new_count) * sizeof(*((list)->items)));                               \
+		(list)->count += (new_count);                                              \
+	} while (0)
+
+#define list_reserve(list, cap)                                                \
+	do {                                                                         \
+		if ((cap) > (list)->capacity) {                                            \
+			(list)->items = list_grow((list)->arena, (list)->items,                  \
+					(list)->capacity * sizeof(*((list)->items)),                         \
+					(cap) * sizeof(*((list)->items)));                                   \
+			(list)->capacity = (cap);                                                \
+		}                                                                          \
+	} while (0)
+
 #define list_pop(list)                                                         \
 	do {                                                                         \
 		if ((list)->count - 1 > 0) {                                               \
@@ -46,4 +274,307 @@
 		(list)->count = 0;                                                         \
 	} while (0)
 
+// Gives the unused capacity of a heap list back.
+#define list_shrink(list)                                                      \
+	do {                                                                         \
+		if ((list)->arena == NULL && (list)->count < (list)->capacity) {           \
+			(list)->items = (list)->count == 0                                       \
+					? (free((list)->items), NULL)                                        \
+					: list_grow(NULL, (list)->items, 0,                                  \
+							(list)->count * sizeof(*((list)->items)));                       \
+			(list)->capacity = (list)->count;                                        \
+		}                                                                          \
+	} while (0)
+
+#define list_free(list)                                                        \
+	do {                                                                         \
+		if ((list)->arena == NULL) {                                               \
+			free((list)->items);                                                     \
+		}                                                                          \
+		(list)->items = NULL;                                                      \
+		(list)->count = 0;                                                         \
+		(list)->capacity = 0;                                                      \
+	} while (0)
+
+#define MAP_INIT_CAP 16
+
+// FNV-1a with a final mix, so that keys differing only in their high bits
+// still spread over the low ones a map masks with.
+static inline U64 hash_bytes(const void* data, size_t size)
+{
+	const U8* b = data;
+	U64 h = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; ++i) {
+		h = (h ^ b[i]) * 0x100000001b3ull;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return h;
+}
+
+// Hash map with open addressing and linear probing. Keys are compared and
+// hashed by their bytes, so struct keys must not have padding. `capacity` is
+// a power of two and at most 3/4 of it is used. Iterate with
+//   for (size_t i = 0; i < m.capacity; ++i) if (m.used[i]) ...
+// `key` and `slot` are scratch for the macros.
+#define Map(Key, Value)                                                        \
+	struct {                                                                     \
+		size_t count;                                                              \
+		size_t capacity;                                                           \
+		Key* keys;                                                                 \
+		Value* values;                                                             \
+		U8* used;                                                                  \
+		Key key;                                                                   \
+		size_t slot;                                                               \
+	}
+
+// Slot holding `key`, or the free one where it would go.
+static inline size_t map_probe(const void* keys, const U8* used,
+		size_t capacity, size_t key_size, const void* key)
+{
+	size_t mask = capacity - 1;
+	size_t i = hash_bytes(key, key_size) & mask;
+	while (used[i]
+			&& memcmp((const U8*)keys + i * key_size, key, key_size) != 0) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static inline size_t map_find(const void* keys, const U8* used,
+		size_t capacity, size_t key_size, const void* key)
+{
+	if (capacity == 0) {
+		return SIZE_MAX;
+	}
+	size_t i = map_probe(keys, used, capacity, key_size, key);
+	return used[i] ? i : SIZE_MAX;
+}
+
+static inline void map_rehash(const void* keys, const void* values,
+		const U8* used, size_t capacity, void* new_keys, void* new_values,
+		U8* new_used, size_t new_capacity, size_t key_size, size_t value_size)
+{
+	for (size_t i = 0; i < capacity; ++i) {
+		if (!used[i]) {
+			continue;
+		}
+		const U8* key = (const U8*)keys + i * key_size;
+		size_t j = map_probe(new_keys, new_used, new_capacity, key_size, key);
+		new_used[j] = 1;
+		memcpy((U8*)new_keys + j * key_size, key, key_size);
+		memcpy((U8*)new_values + j * value_size,
+				(const U8*)values + i * value_size, value_size);
+	}
+}
+
+// Empties `slot` and moves the entries after it that probed past it back,
+// so lookups never need tombstones.
+static inline void map_remove_slot(void* keys, void* values, U8* used,
+		size_t capacity, size_t key_size, size_t value_size, size_t slot)
+{
+	size_t mask = capacity - 1;
+	used[slot] = 0;
+	for (size_t j = (slot + 1) & mask; used[j]; j = (j + 1) & mask) {
+		U8* key = (U8*)keys + j * key_size;
+		size_t home = hash_bytes(key, key_size) & mask;
+		if (((j - home) & mask) >= ((j - slot) & mask)) {
+			memcpy((U8*)keys + slot * key_size, key, key_size);
+			memcpy((U8*)values + slot * value_size,
+					(U8*)values + j * value_size, value_size);
+			used[slot] = 1;
+			used[j] = 0;
+			slot = j;
+		}
+	}
+}
+
+// Slot of `k`, SIZE_MAX when it isn't in the map.
+#define map_index(map, k)                                                      \
+	((map)->key = (k),                                                           \
+			map_find((map)->keys, (map)->used, (map)->capacity,                      \
+					sizeof((map)->key), &(map)->key))
+
+#define map_has(map, k) (map_index(map, k) != SIZE_MAX)
+
+#define map_get(map, k, fallback)                                              \
+	(((map)->slot = map_index(map, k)) != SIZE_MAX                               \
+					? (map)->values[(map)->slot]                                         \
+					: (fallback))
+
+#define map_put(map, k, v)                                                     \
+	do {                                                                         \
+		if (((map)->count + 1) * 4 > (map)->capacity * 3) {                        \
+			size_t cap_ = (map)->capacity == 0 ? MAP_INIT_CAP : (map)->capacity * 2; \
+			void* keys_ = malloc(cap_ * sizeof(*(map)->keys));                       \
+			void* values_ = malloc(cap_ * sizeof(*(map)->values));                   \
+			U8* used_ = calloc(cap_, 1);                                             \
+			assert(keys_ != NULL && values_ != NULL && used_ != NULL                 \
+					&& "Buy more RAM!!");                                                \
+			map_rehash((map)->keys, (map)->values, (map)->used, (map)->capacity,     \
+					keys_, values_, used_, cap_, sizeof(*(map)->keys),                   \
+					sizeof(*(map)->values));                                             \
+			free((map)->keys);                                                       \
+			free((map)->values);                                                     \
+			free((map)->used);                                                       \
+			(map)->keys = keys_;                                                     \
+			(map)->values = values_;                                                 \
+			(map)->used = used_;                                                     \
+			(map)->capacity = cap_;                                                  \
+		}                                                                          \
+		(map)->key = (k);                                                          \
+		(map)->slot = map_probe((map)->keys, (map)->used, (map)->capacity,         \
+				sizeof((map)->key), &(map)->key);                                      \
+		if (!(map)->used[(map)->slot]) {                                           \
+			(map)->used[(map)->slot] = 1;                                            \
+			(map)->keys[(map)->slot] = (map)->key;                                   \
+			(map)->count++;                                                          \
+		}                                                                          \
+		(map)->values[(map)->slot] = (v);                                          \
+	} while (0)
+
+#define map_remove(map, k)                                                     \
+	do {                                                                         \
+		if (((map)->slot = map_index(map, k)) != SIZE_MAX) {                       \
+			map_remove_slot((map)->keys, (map)->values, (map)->used,                 \
+					(map)->capacity, sizeof(*(map)->keys), sizeof(*(map)->values),       \
+					(map)->slot);                                                        \
+			(map)->count--;                                                          \
+		}                                                                          \
+	} while (0)
+
+#define map_clear(map)                                                         \
+	do {                                                                         \
+		if ((map)->used != NULL) {                                                 \
+			memset((map)->used, 0, (map)->capacity);                                 \
+		}                                                                          \
+		(map)->count = 0;                                                          \
+	} while (0)
+
+#define map_free(map)                                                          \
+	do {                                                                         \
+		free((map)->keys);                                                         \
+		free((map)->values);                                                       \
+		free((map)->used);                                                         \
+		(map)->keys = NULL;                                                        \
+		(map)->values = NULL;                                                      \
+		(map)->used = NULL;                                                        \
+		(map)->count = 0;                                                          \
+		(map)->capacity = 0;                                                       \
+	} while (0)
+
+#define map_bytes(map)                                                         \
+	((map)->capacity * (sizeof(*(map)->keys) + sizeof(*(map)->values) + 1))
+
+// The last `cap` items pushed, older ones are overwritten. Item `i` of
+// ring_count() counts from the oldest.
+#define Ring(Type, cap)                                                        \
+	struct {                                                                     \
+		U64 pushed;                                                                \
+		Type items[cap];                                                           \
+	}
+
+#define ring_capacity(ring) (sizeof((ring)->items) / sizeof((ring)->items[0]))
+
+#define ring_count(ring)                                                       \
+	((ring)->pushed < ring_capacity(ring) ? (ring)->pushed : ring_capacity(ring))
+
+#define ring_at(ring, i)                                                       \
+	((ring)->items[((ring)->pushed - ring_count(ring) + (i))                     \
+			% ring_capacity(ring)])
+
+#define ring_last(ring)                                                        \
+	((ring)->items[((ring)->pushed - 1) % ring_capacity(ring)])
+
+#define ring_push(ring, item)                                                  \
+	do {                                                                         \
+		(ring)->items[(ring)->pushed % ring_capacity(ring)] = (item);              \
+		(ring)->pushed++;                                                          \
+	} while (0)
+
+#define ring_clear(ring)                                                       \
+	do {                                                                         \
+		(ring)->pushed = 0;                                                        \
+	} while (0)
+
+// Set of U32 ids with their members packed in `dense`. `sparse` maps an id to
+// its place in `dense`, which is only trusted when `dense` points back. Data
+// kept in arrays parallel to `dense` has to follow the swap that
+// sparse_set_remove() does.
+typedef struct Sparse_Set {
+	List(U32) dense;
+	List(U32) sparse;
+} Sparse_Set;
+
+// Index of `id` in `dense`, SIZE_MAX when it isn't in the set.
+static inline size_t sparse_set_index(const Sparse_Set* s, U32 id)
+{
+	if (id >= s->sparse.count) {
+		return SIZE_MAX;
+	}
+	U32 i = s->sparse.items[id];
+	return i < s->dense.count && s->dense.items[i] == id ? i : SIZE_MAX;
+}
+
+static inline bool sparse_set_has(const Sparse_Set* s, U32 id)
+{
+	return sparse_set_index(s, id) != SIZE_MAX;
+}
+
+// Adds `id` and returns its index in `dense`.
+static inline size_t sparse_set_add(Sparse_Set* s, U32 id)
+{
+	size_t i = sparse_set_index(s, id);
+	if (i != SIZE_MAX) {
+		return i;
+	}
+	if (id >= s->sparse.count) {
+		list_reserve(&s->sparse, (size_t)id + 1);
+		s->sparse.count = (size_t)id + 1;
+	}
+	s->sparse.items[id] = s->dense.count;
+	list_append(&s->dense, id);
+	return s->dense.count - 1;
+}
+
+// Removes `id` by moving the last member into its place. Returns that
+// place, or SIZE_MAX when `id` wasn't in the set.
+static inline size_t sparse_set_remove(Sparse_Set* s, U32 id)
+{
+	size_t i = sparse_set_index(s, id);
+	if (i == SIZE_MAX) {
+		return i;
+	}
+	U32 last = s->dense.items[--s->dense.count];
+	s->dense.items[i] = last;
+	s->sparse.items[last] = i;
+	return i;
+}
+
+#define sparse_set_clear(s) list_clear(&(s)->dense)
+
+#define sparse_set_free(s)                                                     \
+	do {                                                                         \
+		list_free(&(s)->dense);                                                    \
+		list_free(&(s)->sparse);                                                   \
+	} while (0)
+
+// Bits packed into U64 words, `U64 bits[BITSET_WORDS(n)]` holds n of them.
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
+
+static inline bool bitset_get(const U64* words, size_t i)
+{
+	return words[i / 64] >> (i % 64) & 1;
+}
+
+static inline void bitset_set(U64* words, size_t i, bool on)
+{
+	if (on) {
+		words[i / 64] |= 1ull << (i % 64);
+	} else {
+		words[i / 64] &= ~(1ull << (i % 64));
+	}
+}
+
 #endif // !DS
@@ -1,27 +1,115 @@
+#define _POSIX_C_SOURCE 200809L
 #include <GLES3/gl3.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "ds.h"
+#include "external/raylib/src/external/qoi.h"
 #include "external/raylib/src/external/stb_image_write.h"
+#include "external/raylib/src/external/stb_rect_pack.h"
 #include "external/raylib/src/raylib.h"
 #include "external/raylib/src/rlgl.h"
+#include "idle.h"
+#include "jobs.h"
+#include "journal.h"
+#include "profiler.h"
+#include "replay.h"
+#if defined(PLATFORM_WEB)
 #include <emscripten/emscripten.h>
-
-typedef uint64_t U64;
-typedef uint32_t U32;
-typedef uint16_t U16;
-typedef uint8_t U8;
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 static const Color HATORI_BG = { 20, 18, 24, 255 };
 static const Color HATORI_PRIMARY = { 35, 35, 41, 255 };
 static const Color HATORI_ACCENT = { 49, 48, 59, 255 };
 static const Color HATORI_SECONDARY = { 64, 62, 106, 255 };
 
+// The main loop sleeps until the next input event unless something changed
+// on its own, which is then drawn for this many frames so that both buffers
+// of the swap chain catch up, see request_redraw().
+#define REDRAW_FRAMES 2
+
+// Housekeeping runs in what is left of the frame after drawing, for at most
+// IDLE_BUDGET_MS, or one task and then IDLE_QUIET_BUDGET_MS once there has
+// been no input for IDLE_QUIET_MS, see idle.h.
+#ifndef IDLE_BUDGET_MS
+#define IDLE_BUDGET_MS 4
+#endif
+#define IDLE_QUIET_BUDGET_MS 50
+#define IDLE_QUIET_MS 500
+
+// Times a call into the profiler under the call's own text, see profiler.h.
+#define PROFILE_CALL(call)                                                     \
+	do {                                                                         \
+		U64 profile_start_ = profile_now();                                        \
+		call;                                                                      \
+		profile_record(&profiler, #call, profile_start_, profile_now());           \
+	} while (0)
+
+#define PROFILE_OVERLAY_WIDTH 360
+#define MEMORY_OVERLAY_WIDTH 420
+#define MEMORY_REFRESH_FRAMES 30
+
+// Strokes are smoothed in the fragment shader from each pixel's distance to
+// the segment, instead of multisampling the whole window.
+#if defined(PLATFORM_WEB)
+#define GLSL_HEADER "#version 300 es\nprecision highp float;\n"
+#else
+#define GLSL_HEADER "#version 330\n"
+#endif
+
+static const char* STROKE_VS = GLSL_HEADER
+		"in vec3 vertexPosition;\n"
+		"in vec2 vertexTexCoord;\n"
+		"in vec3 vertexNormal;\n"
+		"in vec4 vertexColor;\n"
+		"uniform mat4 mvp;\n"
+		"out vec2 fragTexCoord;\n"
+		"out vec2 fragStroke;\n"
+		"out vec4 fragColor;\n"
+		"void main() {\n"
+		"	fragTexCoord = vertexTexCoord;\n"
+		"	fragStroke = vertexNormal.xy / vertexNormal.z;\n"
+		"	fragColor = vertexColor;\n"
+		"	gl_Position = mvp * vec4(vertexPosition, 1.0);\n"
+		"}\n";
+
+// `fragTexCoord` is the position in pixels along and across the segment,
+// `fragStroke` its length and radius in pixels.
+static const char* STROKE_FS = GLSL_HEADER
+		"in vec2 fragTexCoord;\n"
+		"in vec2 fragStroke;\n"
+		"in vec4 fragColor;\n"
+		"out vec4 finalColor;\n"
+		"void main() {\n"
+		"	float along = max(max(-fragTexCoord.x, fragTexCoord.x - fragStroke.x), 0.0);\n"
+		"	float d = length(vec2(along, fragTexCoord.y));\n"
+		"	float coverage = clamp(fragStroke.y + 0.5 - d, 0.0, 1.0);\n"
+		"	finalColor = vec4(fragColor.rgb, fragColor.a * coverage);\n"
+		"}\n";
+
 extern const char* GetFileName(const char* filePath);
 
+#if defined(PLATFORM_HEADLESS)
+// Synthetic input for src/rcore_headless.c, seen by the frame after the next
+// EndDrawing().
+extern void headless_mouse_move(float x, float y);
+extern void headless_mouse_button(int button, bool down);
+extern void headless_mouse_wheel(float move);
+extern void headless_key(int key, bool down);
+extern void headless_key_repeat(int key);
+extern void headless_char(int codepoint);
+extern void headless_resize(int width, int height);
+extern void headless_drop_files(const char** paths, int count);
+#endif
+
 extern unsigned char* stbi_write_png_to_mem(const unsigned char* pixels,
 		int stride_bytes, int x, int y, int n, int* out_len);
 
@@ -51,21 +139,231 @@ typedef struct Hatori_Line {
 	bool deleted;
 } Hatori_Line;
 
+// Pen input arrives as separate segments, runs of live segments that join
+// end to start are drawn as one stroke. When zoomed out a stroke is drawn
+// from a simplified copy whose error stays under STROKE_LOD_ERROR screen
+// pixels, level k allowing 4^(k-1) * STROKE_LOD_TOLERANCE board units.
+#define STROKE_LODS 5
+#define STROKE_LOD_TOLERANCE 0.5f
+#define STROKE_LOD_ERROR 0.5f
+
+typedef struct Hatori_Stroke {
+	U64 first; // first segment in `lines`
+	U64 count;
+	U64 thickness;
+	Rectangle bounds; // in board coordinates
+	Vector2* points; // the polyline of each level after level 0, in order
+	U32 lod_points[STROKE_LODS];
+} Hatori_Stroke;
+
+typedef List(Hatori_Stroke) Hatori_Strokes;
+
+// QOI encoded pixels, either inside the mapped board file or owned.
+// qoi_decode() refuses images of QOI_MAX_PIXELS or more.
+#define QOI_MAX_PIXELS 400000000u
+typedef struct Hatori_Blob {
+	const U8* data;
+	U32 size;
+} Hatori_Blob;
+
+// Every buffer is drawn from a pyramid of levels, each half the size of the
+// one before down to PIXELS_PROXY_SIZE, so zoomed out images sample a level
+// close to their size on screen instead of the full resolution texture.
+// Levels are uploaded as textures of at most PIXELS_TILE_SIZE pixels a side,
+// less if the driver can't do that much.
+#define PIXELS_PROXY_SIZE 64
+#define PIXELS_MAX_LEVELS 16
+#ifndef PIXELS_TILE_SIZE
+#define PIXELS_TILE_SIZE 1024
+#endif
+
+typedef struct Hatori_Tile {
+	Texture2D texture; // uploaded on first draw, see evict_textures()
+	Rectangle area; // part of the level in `texture`
+	U64 last_drawn; // frame the texture was last used
+	Rectangle upload; // part of `area` that is older than the level
+	int loaded_rows; // rows of `area` in `texture` so far, see upload_textures()
+} Hatori_Tile;
+
+// Large tiles are uploaded UPLOAD_CHUNK_BYTES at a time, for at most
+// UPLOAD_BUDGET_MS each frame, so importing a huge image doesn't stall.
+#ifndef UPLOAD_BUDGET_MS
+#define UPLOAD_BUDGET_MS 3
+#endif
+#define UPLOAD_CHUNK_BYTES (256 * 1024)
+
+typedef struct Hatori_Upload {
+	struct Hatori_Pixels* pixels;
+	int level;
+	Hatori_Tile* tile;
+} Hatori_Upload;
+
+// Buffers no larger than ATLAS_MAX_IMAGE a side skip the pyramid and share
+// ATLAS_SIZE pages with each other, as do the control icons, so a board full
+// of small images is drawn without switching textures for each one. A page
+// is packed again once less than half of what went into it is still there.
+#define ATLAS_SIZE 2048
+#define ATLAS_MAX_IMAGE 256
+
+typedef struct Hatori_Atlas {
+	Texture2D texture;
+	stbrp_context packer;
+	stbrp_node nodes[ATLAS_SIZE];
+	int slots; // buffers placed on the page
+	int area; // pixels they cover, gutters included
+	int packed; // pixels handed out since the page was last packed
+	bool icons; // holds control icons, which are never freed or moved
+} Hatori_Atlas;
+
+typedef struct Hatori_Level {
+	Image image; // level 0 is Hatori_Pixels.image, the others are built on use
+	Hatori_Tile* tiles; // `cols` * `rows`, allocated on first draw
+	int cols;
+	int rows;
+	Rectangle dirty; // part of `image` to rebuild from the level above
+} Hatori_Level;
+
+// Refcounted RGBA8 pixels shared by every image showing the same content.
+// Buffers are looked up by content hash when they are created, so dropping
+// or pasting the same picture twice stores it once, and copies just take
+// another reference. Editing a shared buffer gives the editor its own copy
+// first, see edit_pixels().
+typedef struct Hatori_Pixels {
+	int refs;
+	int width;
+	int height;
+	U64 hash; // 0 while unknown or after an edit, such buffers are not shared
+	Image image; // unloaded until first needed when `blob` is set
+	int level_count;
+	Hatori_Level levels[PIXELS_MAX_LEVELS];
+	Hatori_Atlas* atlas; // page holding the buffer, when it is small enough
+	Rectangle atlas_rect;
+	// Set while `image` is still identical to these bytes, so saving reuses
+	// them instead of encoding again.
+	Hatori_Blob blob;
+	bool owns_blob;
+	bool mark; // scratch flag for compress_originals()
+	// Set while a job decodes `blob` into `decoded`, see pixels_load_async().
+	bool decode_queued;
+	Job_Group decoding;
+	Image decoded;
+	U64 decoded_hash;
+	// Set while a job encodes `image` into `encoded`, see pixels_encode_async().
+	bool encode_queued;
+	Job_Group encoding;
+	Hatori_Blob encoded;
+} Hatori_Pixels;
+
+// Textures of images and board cache tiles that were not drawn for the
+// longest are unloaded once all textures together take more than
+// `texture_budget` bytes of VRAM, and uploaded or drawn again when they come
+// back into view.
+#ifndef TEXTURE_BUDGET
+#define TEXTURE_BUDGET (512 * 1024 * 1024)
+#endif
+
+// Image kernels split their rows over the jobs in pieces of about this many
+// pixels.
+#define KERNEL_GRAIN_PIXELS (64 * 1024)
+
+typedef struct Hatori_Kernel {
+	Image src;
+	Image dst;
+	Rectangle area;
+} Hatori_Kernel;
+
+// An image on its way onto the board. A job decodes the file, unless the
+// pixels are already there, hashes them and encodes the QOI bytes the journal
+// and the board file keep, then the entity is added on the main thread, see
+// add_image_async().
+typedef struct Hatori_ImageLoad {
+	char* path; // of the file to decode, or
+	char file_type[16]; // its extension and bytes
+	U8* file_data;
+	int file_size;
+	Image image;
+	Vector2 pos;
+	Vector2 size; // the size of the pixels when 0
+	U64 hash;
+	Hatori_Blob blob;
+} Hatori_ImageLoad;
+
+typedef struct Hatori_PixelsStats {
+	U64 buffers;
+	U64 compressed; // buffers held only as QOI bytes
+	U64 decoded_bytes;
+	U64 blob_bytes; // QOI bytes, owned or mapped from the board file
+	U64 texture_bytes;
+	U64 refs;
+} Hatori_PixelsStats;
+
+// Bytes held by one kind of resource or by one entity. GPU bytes are
+// estimated from texture sizes. `mapped` are bytes of the board file, which
+// is mapped rather than read where possible and then only takes memory for
+// the pages that were used.
+typedef struct Hatori_MemoryItem {
+	char name[64];
+	U64 cpu;
+	U64 gpu;
+	U64 mapped;
+} Hatori_MemoryItem;
+
+typedef List(Hatori_MemoryItem) Hatori_MemoryItems;
+
+typedef struct Hatori_MemoryReport {
+	Hatori_MemoryItems classes;
+	Hatori_MemoryItems entities; // pixels shared between images count once
+	Hatori_MemoryItem total;
+	U64 resident; // of the whole process, 0 where unknown
+	U64 taken; // frame + 1 when the report was made, 0 if never
+} Hatori_MemoryReport;
+
 typedef struct Hatori_Image {
 	Vector2 pos;
 	Vector2 size;
 
-	Image original;
-	Image current;
-	Texture2D texture;
+	Hatori_Pixels* current;
+	Hatori_Pixels* original; // what reset goes back to
 } Hatori_Image;
 
+// Images, text and strokes are drawn into tiles of BOARD_CACHE_TILE pixels,
+// so panning only draws the tiles coming into view and an edit only redraws
+// the tiles it touches. Tiles are drawn at zoom levels BOARD_CACHE_ZOOM_STEP
+// apart and stretched to the zoom in between, so zooming only redraws when
+// it crosses into another level. The cache keeps the view and the ring
+// around it for two levels, at least BOARD_CACHE_TILES, and the least
+// recently shown tiles go first.
+#define BOARD_CACHE_TILE 256
+#define BOARD_CACHE_TILE_BYTES (BOARD_CACHE_TILE * BOARD_CACHE_TILE * 8ull)
+#ifndef BOARD_CACHE_TILES
+#define BOARD_CACHE_TILES 128
+#endif
+#define BOARD_CACHE_ZOOM_STEP 1.41421356f
+#define BOARD_CACHE_BUDGET_MS 4
+
+typedef struct Hatori_CacheTile {
+	RenderTexture2D target;
+	float scale; // zoom level the tile was drawn at, see board_cache_scale()
+	int x; // in tiles, at `scale`
+	int y;
+	U64 last_used;
+	bool stale;
+	bool incomplete; // drawn while some image tiles were still uploading
+} Hatori_CacheTile;
+
+typedef struct Hatori_CacheKey {
+	int x;
+	int y;
+	float scale;
+} Hatori_CacheKey;
+
 struct Hatori_Controls;
 
 typedef struct Hatori_ControlsBtn {
 	Vector2 pos;
 	Vector2 size;
 	Texture2D texture;
+	Rectangle source; // part of `texture` holding the icon
 	void (*onclick)(void);
 } Hatori_ControlsBtn;
 
@@ -104,7 +402,7 @@ typedef struct Hatori_Resizer {
 
 typedef struct Hatori_Text {
 	Vector2 pos;
-	Vector2 size;
+	Vector2 size; // in virtual units, see measure_text()
 	List(char) text;
 	Color color;
 	int spacing;
@@ -122,8 +420,235 @@ typedef struct Hatori_Entity {
 	int z;
 } Hatori_Entity;
 
+// Board file layout, all fields little endian:
+//
+//   Hatori_BoardHeader
+//   Hatori_BoardLine[line_count]        stroke chunk
+//   Hatori_BoardEntity[entity_count]    entity table
+//   Hatori_BoardBlob[blob_count]        blob table, offsets are absolute
+//   blob bytes                          text and QOI encoded pixels
+//
+// Deleted lines and entities are written as tombstones without payload so
+// that indices on disk match the ones in memory.
+#define BOARD_MAGIC "HTRI"
+#define BOARD_VERSION 1
+#define BOARD_NO_BLOB UINT32_MAX
+
+typedef enum {
+	BLOB_RAW,
+	BLOB_QOI,
+} BlobCodec;
+
+typedef struct Hatori_BoardHeader {
+	char magic[4];
+	U32 version;
+	float offset_x;
+	float offset_y;
+	float scale;
+	U32 line_count;
+	U32 entity_count;
+	U32 blob_count;
+	U64 lines_offset;
+	U64 entities_offset;
+	U64 blobs_offset;
+	U64 journal_seq; // last journal record already contained in the board
+} Hatori_BoardHeader;
+
+typedef struct Hatori_BoardLine {
+	float x0;
+	float y0;
+	float x1;
+	float y1;
+	U32 thickness;
+	U32 deleted;
+} Hatori_BoardLine;
+
+typedef struct Hatori_BoardEntity {
+	U32 type;
+	U32 deleted;
+	int z;
+	Vector2 pos;
+	Vector2 size;
+	U32 blob; // image pixels or text bytes
+	U32 original_blob;
+	int font_size;
+	int spacing;
+	Color color;
+} Hatori_BoardEntity;
+
+typedef struct Hatori_BoardBlob {
+	U64 offset;
+	U32 size;
+	U32 codec;
+} Hatori_BoardBlob;
+
+_Static_assert(sizeof(Hatori_BoardHeader) == 64, "board header layout");
+_Static_assert(sizeof(Hatori_BoardLine) == 24, "board line layout");
+_Static_assert(sizeof(Hatori_BoardEntity) == 48, "board entity layout");
+_Static_assert(sizeof(Hatori_BoardBlob) == 16, "board blob layout");
+
+typedef struct Hatori_BoardMap {
+	U8* data;
+	size_t size;
+	bool mapped;
+} Hatori_BoardMap;
+
+// Board files are written BOARD_WRITE_CHUNK bytes per slice by checkpoints.
+#define BOARD_WRITE_CHUNK (2 * 1024 * 1024)
+
+typedef enum {
+	SAVE_ENCODING,
+	SAVE_WRITING,
+	SAVE_SYNCING,
+} SaveStage;
+
+typedef struct Hatori_SaveBlob {
+	Hatori_Pixels* pixels; // held until the save ends, NULL for text
+	Hatori_Blob bytes; // the text, owned, or the size of the QOI bytes
+} Hatori_SaveBlob;
+
+// A board file being written. board_save_begin() takes a snapshot of the
+// board and has jobs encode the pixels it lacks QOI bytes of, which the
+// snapshot holds references to, so edits copy them rather than changing them.
+// The file is then written in pieces, synced and moved over the old one.
+typedef struct Hatori_BoardSave {
+	bool active;
+	SaveStage stage;
+	bool ok;
+	char path[512];
+	char tmp_path[520];
+	FILE* file;
+	U64 journal_mark; // see journal_mark()
+	double start;
+	List(U8) head; // header, lines, entity table, then the blob table
+	List(Hatori_SaveBlob) blobs;
+	U64 head_written;
+	size_t blob; // being written
+	U64 blob_written;
+	Job_Group syncing;
+} Hatori_BoardSave;
+
+// Journal records, one per board mutation. The record key is the line or
+// entity index the op applies to.
+//
+//   OP_LINE_ADD       Hatori_BoardLine[], appended from index `key`, which
+//                     has to be the line count
+//   OP_LINE_DELETE    -
+//   OP_LINES_CLEAR    -, drops the lines from index `key` on
+//   OP_ENTITY_POS     Vector2
+//   OP_ENTITY_SIZE    Hatori_OpSize
+//   OP_ENTITY_DELETE  -
+//   OP_ENTITY_SWAP    Hatori_OpSwap
+//   OP_TEXT_ADD       Hatori_BoardEntity, text bytes
+//   OP_TEXT_SET       text bytes
+//   OP_IMAGE_ADD      Hatori_BoardEntity, QOI encoded pixels
+//   OP_IMAGE_COPY     Hatori_BoardEntity, copies the pixels of entity `key`
+//   OP_IMAGE_EDIT     Hatori_ImageEdit
+//   OP_LINE_RESTORE   -
+//   OP_ENTITY_RESTORE -, or for images U32 size, QOI pixels of that size and
+//                     the QOI original pixels if they differ
+//   OP_IMAGE_TILES    Hatori_OpTiles, then per tile Hatori_OpTile and its QOI
+//                     encoded pixels
+#ifndef JOURNAL_CHECKPOINT_SIZE
+#define JOURNAL_CHECKPOINT_SIZE (64 * 1024 * 1024)
+#endif
+
+typedef enum {
+	OP_LINE_ADD,
+	OP_LINE_DELETE,
+	OP_LINES_CLEAR,
+	OP_ENTITY_POS,
+	OP_ENTITY_SIZE,
+	OP_ENTITY_DELETE,
+	OP_ENTITY_SWAP,
+	OP_TEXT_ADD,
+	OP_TEXT_SET,
+	OP_IMAGE_ADD,
+	OP_IMAGE_COPY,
+	OP_IMAGE_EDIT,
+	OP_LINE_RESTORE,
+	OP_ENTITY_RESTORE,
+	OP_IMAGE_TILES,
+} OpType;
+
+typedef enum {
+	EDIT_HFLIP,
+	EDIT_VFLIP,
+	EDIT_ERODE,
+	EDIT_FLOOD,
+	EDIT_ERASE,
+	EDIT_RESET,
+} EditType;
+
+// `pos` is in image pixels, `amount` is the flood threshold or erase radius.
+typedef struct Hatori_ImageEdit {
+	U32 type;
+	Vector2 pos;
+	float amount;
+} Hatori_ImageEdit;
+
+typedef struct Hatori_OpSize {
+	Vector2 size;
+	int font_size;
+} Hatori_OpSize;
+
+// Entity `key` trades places with `other`, then they get `z` and `other_z`.
+typedef struct Hatori_OpSwap {
+	U32 other;
+	int z;
+	int other_z;
+} Hatori_OpSwap;
+
+#define UNDO_TILE_SIZE 64
+
+typedef struct Hatori_OpTiles {
+	U32 count;
+	U32 width; // size of the image the tiles belong to
+	U32 height;
+} Hatori_OpTiles;
+
+typedef struct Hatori_OpTile {
+	U16 x; // in tiles
+	U16 y;
+	U32 size;
+} Hatori_OpTile;
+
+// Undo history. Every step is a list of ops that revert one user action, and
+// running it through run_undo_step() yields the step that redoes it. Pixel
+// edits keep only the 64x64 tiles they touched, QOI encoded, so history
+// stays small for large images. The oldest steps are dropped once the
+// history grows past `undo_budget` bytes.
+#ifndef UNDO_BUDGET
+#define UNDO_BUDGET (64 * 1024 * 1024)
+#endif
+
+typedef struct Hatori_UndoOp {
+	U32 op;
+	U32 key;
+	U32 offset; // into Hatori_UndoStep.data
+	U32 size;
+} Hatori_UndoOp;
+
+typedef struct Hatori_UndoStep {
+	List(Hatori_UndoOp) ops;
+	List(U8) data;
+	// (key << 32 | tile) for every image tile captured while the step is open
+	Map(U64, bool) tiles;
+} Hatori_UndoStep;
+
+typedef List(Hatori_UndoStep) Hatori_UndoStack;
+
 Hatori_ControlsBtn create_controls_btn(
-		Texture2D texture, void (*onclick)(void));
+		const char* icon_path, void (*onclick)(void));
+
+void init_hatori(int width, int height);
+void run_frame(void);
+bool input_active(void);
+void run_idle_tasks(U64 frame_start);
+void draw_profiler(void);
+void dump_profile(const char* path);
+void capture_input(Replay_Frame* f);
+void replay_input(const Replay_Frame* f);
 
 Hatori_Controls create_top_controls(void);
 void select_top_controls(U64 index);
@@ -136,6 +661,8 @@ float to_screen_x(float vir_x);
 Vector2 to_screen(Vector2);
 float to_virtual_x(float x);
 float to_virtual_y(float y);
+Rectangle to_virtual_rect(Rectangle r);
+Camera2D board_camera(void);
 Rectangle img_to_rect(Hatori_Image img);
 
 bool is_mouse_moving(void);
@@ -143,6 +670,16 @@ void clear_screen(void);
 
 void handle_input_lines(void);
 void draw_lines(void);
+U32 simplify_polyline(
+		const Vector2* in, U32 count, float tolerance, Vector2* out);
+float stroke_lod_tolerance(int lod);
+void build_strokes(U64 from, U64 to, Hatori_Strokes* out);
+void lines_changed(U64 i);
+void clear_strokes(void);
+void update_strokes(void);
+void simplify_last_stroke(void);
+void draw_segment(Vector2 a, Vector2 b, float thickness, Rectangle clip);
+void load_stroke_shader(void);
 
 void handle_panning(void);
 void handle_scroll(void);
@@ -150,7 +687,9 @@ void handle_shortcuts(void);
 void handle_cursor(void);
 
 void handle_drop_images(void);
+void request_redraw(void);
 
+void flip_rows(U8* dst, const U8* src, int row_bytes, int height);
 void take_screenshot_rect(const char* filepath, Rectangle rect);
 void handle_input_screenshot(void);
 void draw_screenshot(void);
@@ -191,6 +730,10 @@ Rectangle get_text_resizer_rect(Hatori_Text text);
 bool is_similar(Color c1, Color c2, int diff);
 void flood_remove(Image* img, Vector2 pos, int diff);
 void erode_image(Image* img);
+void erode_rows(void* arg, size_t from, size_t to);
+size_t kernel_grain(int width);
+Arena* scratch_arena(void);
+void release_scratch(Arena* scratch, Arena_Mark mark);
 
 void hatori_print_image(Hatori_Image img);
 
@@ -207,14 +750,160 @@ Rectangle get_control_rect(void);
 void handle_mouse_input_entities(void);
 void handle_key_input_entities(void);
 void update_entities(void);
+void measure_text(Hatori_Text* txt);
 void draw_entities(void);
 
+Rectangle draw_clip_rect(void);
+Rectangle entity_world_rect(Hatori_Entity e);
+Rectangle line_world_rect(Hatori_Line l);
+void invalidate_board(Rectangle world, float margin);
+void invalidate_entity(U64 i);
+void invalidate_line(U64 i);
+void invalidate_op(U32 op, U32 key, const U8* payload, U32 size);
+void clear_board_cache(void);
+float board_cache_scale(void);
+int board_cache_capacity(void);
+int find_board_tile(int x, int y);
+void render_board_tile(Hatori_CacheTile* t);
+void board_tiles_in_view(int* x0, int* y0, int* x1, int* y1);
+int add_board_tile(int x, int y);
+void unload_board_tile(Hatori_CacheTile* t);
+void evict_board_tiles(size_t count);
+void compact_board_cache(void);
+bool update_board_cache(void);
+bool next_prefetch_tile(int* x, int* y);
+bool prefetch_board_tile(void* arg);
+void draw_board(bool cached);
+
 bool is_image_selected(void);
 bool is_text_selected(void);
 
 extern void add_image(char* file_type, U8* data, int size);
 extern void download_image(char* file_type, U8* data);
 
+bool save_board(const char* path);
+bool board_save_begin(Hatori_BoardSave* s, const char* path);
+bool board_save_encoded(Hatori_BoardSave* s, bool wait);
+bool board_save_write(Hatori_BoardSave* s, U64 budget);
+void sync_board_job(void* arg);
+bool board_save_end(Hatori_BoardSave* s);
+void board_save_drop(Hatori_BoardSave* s);
+bool load_board(const char* path);
+void clear_board(void);
+bool map_board_file(const char* path, Hatori_BoardMap* map);
+void unmap_board_file(Hatori_BoardMap* map);
+bool board_range_ok(Hatori_BoardMap map, U64 offset, U64 size);
+
+Image decode_blob_image(Hatori_Blob blob);
+Hatori_Blob encode_image_blob(Image img);
+bool load_image_pixels(Hatori_Image* img);
+bool load_original_pixels(Hatori_Image* img);
+
+U64 hash_pixels(Image img);
+void pixels_set_hash(Hatori_Pixels* p, U64 hash);
+Hatori_Pixels* pixels_from_image(Image img);
+Hatori_Pixels* pixels_from_hashed_image(Image img, U64 hash);
+Hatori_Pixels* pixels_from_blob(Hatori_Blob blob, bool owned);
+Hatori_Pixels* pixels_retain(Hatori_Pixels* p);
+void pixels_release(Hatori_Pixels* p);
+bool pixels_load(Hatori_Pixels* p);
+bool pixels_load_async(Hatori_Pixels* p);
+void decode_pixels_job(void* arg);
+void decoded_pixels(void* arg);
+bool pixels_encode_async(Hatori_Pixels* p);
+bool pixels_finish_encode(Hatori_Pixels* p);
+void encode_pixels_job(void* arg);
+void encoded_pixels(void* arg);
+int pixels_level_count(Hatori_Pixels* p);
+Image* pixels_level(Hatori_Pixels* p, int level);
+int pixels_pick_level(Hatori_Pixels* p, float width);
+int pixels_tile_size(void);
+const U8* pack_image_area(Image img, Rectangle area);
+Hatori_Tile* pixels_tile(Hatori_Pixels* p, int level, int tile);
+Texture2D pixels_tile_texture(Hatori_Pixels* p, int level, int tile);
+void upload_textures(void);
+void draw_level_area(
+		Hatori_Pixels* p, int level, Rectangle dest, Rectangle part);
+void draw_pixels(Hatori_Pixels* p, Rectangle dest);
+void pixels_changed(Hatori_Pixels* p, Rectangle area);
+void pixels_unload_texture(Hatori_Tile* t);
+void pixels_unload_levels(Hatori_Pixels* p);
+void evict_textures(void);
+bool pixels_fit_atlas(Hatori_Pixels* p);
+Hatori_Atlas* atlas_new(bool icons);
+bool atlas_place(Hatori_Atlas* a, int width, int height, Rectangle* rect);
+Texture2D pixels_atlas_texture(Hatori_Pixels* p, Rectangle* source);
+void atlas_remove(Hatori_Pixels* p);
+void atlas_repack(Hatori_Atlas* a);
+Texture2D atlas_add_icon(Image icon, Rectangle* source);
+void atlas_upload(Hatori_Atlas* a, Rectangle rect, Image img);
+Image* edit_pixels(Hatori_Pixels** p);
+Hatori_Blob pixels_blob(Hatori_Pixels* p, bool* owned);
+void compress_originals(void);
+bool compress_next_original(void* arg);
+Rectangle rect_union(Rectangle a, Rectangle b);
+void downsample_image(Image src, Image dst, Rectangle area);
+void downsample_rows(void* arg, size_t from, size_t to);
+Hatori_PixelsStats pixels_stats(void);
+void log_pixels_stats(const char* reason);
+Hatori_MemoryItem pixels_memory(Hatori_Pixels* p);
+U64 texture_memory(Texture2D t);
+U64 font_memory(Font font, U64* gpu);
+U64 resident_memory(void);
+void memory_report(Hatori_MemoryReport* r);
+void draw_memory(void);
+void dump_memory(const char* path);
+
+bool open_board(const char* path);
+void checkpoint_board(bool force);
+bool checkpoint_board_step(void* arg);
+void cancel_checkpoint(void);
+void record_op(OpType op, U32 key, const void* payload, U32 size);
+void record_entity_op(
+		OpType op, U32 key, Hatori_BoardEntity be, const void* bytes, U32 size);
+void record_image_add(int i);
+void do_op(OpType op, U32 key, const void* payload, U32 size);
+
+void push_undo_op(Hatori_UndoStep* step, OpType op, U32 key,
+		const void* payload, U32 size);
+void capture_undo_op(Hatori_UndoStep* step, OpType op, U32 key,
+		const void* payload, U32 size);
+Rectangle image_tile_rect(Image img, U32 tile);
+Rectangle image_edit_area(Image img, Hatori_ImageEdit edit);
+void copy_image_tile(Image img, U32 tile, U8* dst);
+void push_image_tiles(Hatori_UndoStep* step, U32 key, Image img,
+		const U32* tiles, U32 count, const U8* pixels);
+void apply_image_tiles(Hatori_Image* img, const U8* payload, U32 size);
+Hatori_UndoStep run_undo_step(Hatori_UndoStep* step);
+void end_undo_step(void);
+void move_undo_step(Hatori_UndoStack* from, Hatori_UndoStack* to);
+void free_undo_step(Hatori_UndoStep* step);
+U64 undo_step_bytes(Hatori_UndoStep* step);
+void clear_undo(void);
+void apply_op(U32 op, U32 key, const U8* payload, U32 size);
+void apply_op_state(U32 op, U32 key, const U8* payload, U32 size);
+
+Hatori_BoardEntity board_entity(Hatori_Entity e);
+Hatori_Text make_text(Hatori_BoardEntity be, const char* bytes, U32 size);
+int add_image_entity(Image img, Vector2 pos, Vector2 size);
+int add_pixels_entity(Hatori_Pixels* pixels, Vector2 pos, Vector2 size);
+void add_image_async(Image img, Vector2 pos, Vector2 size);
+void add_image_file_async(const char* path, Vector2 pos);
+void add_image_bytes_async(
+		const char* file_type, const U8* data, int size, Vector2 pos);
+Hatori_ImageLoad* new_image_load(Vector2 pos, Vector2 size);
+void load_image_job(void* arg);
+void loaded_image(void* arg);
+int add_text_entity(Hatori_Text txt, int z);
+int copy_image_entity(U64 src, Hatori_BoardEntity be);
+void delete_entity(U64 i);
+bool restore_image_entity(U64 i, const U8* payload, U32 size);
+void swap_entities(U64 i, Hatori_OpSwap swap);
+bool edit_image(Hatori_Image* img, Hatori_ImageEdit edit);
+bool apply_image_edit(Image* pixels, Hatori_ImageEdit edit);
+void edit_selected_image(Hatori_ImageEdit edit);
+void flip_image_horizontal(Image* img);
+
 Mode mode;
 float offset_x;
 float offset_y;
@@ -226,6 +915,10 @@ float prev_cursor_y;
 float prev_clicked_cursor_x;
 float prev_clicked_cursor_y;
 List(Hatori_Line) lines;
+Hatori_Strokes strokes;
+U64 strokes_built; // segments of `lines` that `strokes` covers
+U64 stroke_dirty_from = UINT64_MAX; // segments to rebuild strokes around
+U64 stroke_dirty_to;
 int z = 1;
 Hatori_Controls top_controls;
 Hatori_Controls img_controls;
@@ -234,19 +927,51 @@ U64 pen_thickness = 2;
 U64 erasure_thickness = 10;
 Hatori_Resizer resizer = { 0 };
 Font anton_font;
+Shader stroke_shader; // unloaded when it failed to build, see draw_segment()
 int i_selected_text = -1;
 List(Hatori_Entity) entities;
 int selected_entity = -1;
-
-int main(void)
+char board_path[512] = "board.hatori";
+Hatori_BoardMap board_map;
+List(Hatori_Pixels*) pixels_pool;
+Map(U64, Hatori_Pixels*) pixels_by_hash; // one buffer per known hash
+Pool pixels_objects = { .size = sizeof(Hatori_Pixels) };
+Arena frame_arena; // scratch memory, everything in it is freed as a frame ends
+U64 frame;
+U64 texture_bytes;
+U64 texture_budget = TEXTURE_BUDGET;
+List(Hatori_Upload) upload_queue;
+List(Hatori_Atlas*) atlases;
+List(Hatori_CacheTile) board_cache;
+Map(Hatori_CacheKey, int) board_cache_index; // into board_cache
+Rectangle draw_clip; // where drawing ends up, the screen while it is empty
+bool draw_incomplete; // set when an image was drawn from a coarser level
+int redraw_frames = REDRAW_FRAMES;
+U64 board_journal_seq;
+Hatori_BoardSave checkpoint; // written by checkpoint_board_step()
+Journal journal;
+Hatori_UndoStep undo_step;
+Hatori_UndoStack undo_stack;
+Hatori_UndoStack redo_stack;
+Replay input_log; // open while recording, see capture_input()
+Replay_Frame input_frame;
+Profiler profiler;
+Jobs jobs;
+Job_Group image_loads; // see add_image_async()
+Idle idle; // main-thread housekeeping, see run_idle_tasks()
+double idle_budget_ms = IDLE_BUDGET_MS;
+double last_input_time;
+bool show_profiler; // toggled with F3, F4 writes a trace
+bool show_memory; // toggled with F5, F6 writes a report
+Hatori_MemoryReport memory; // refreshed every MEMORY_REFRESH_FRAMES while shown
+U64 undo_bytes;
+U64 undo_budget = UNDO_BUDGET;
+
+void init_hatori(int width, int height)
 {
-	SetConfigFlags(FLAG_MSAA_4X_HINT);
 	SetConfigFlags(FLAG_WINDOW_RESIZABLE);
 
-	const int WIDTH = 800;
-	const int HEIGHT = 600;
-
-	InitWindow(WIDTH, HEIGHT, "hatori");
+	InitWindow(width, height, "hatori");
 	SetExitKey(0);
 	top_controls = create_top_controls();
 	img_controls = create_image_controls();
@@ -258,81 +983,495 @@ int main(void)
 	resizer.selected = -1;
 
 	anton_font = LoadFontEx("assets/Anton-Regular.ttf", 200, NULL, 0);
+	load_stroke_shader();
+	jobs_init(&jobs, jobs_default_workers());
+}
 
-	// Hatori_Slider thickness_slider = {
-	// 	.pos = { top_controls.pos.x + top_controls.size.x + 20,
-	// 			top_controls.pos.y + top_controls.size.y / 2 },
-	// 	.size = { 100, 3 },
-	// 	.percentage = 0,
-	// 	.radius = 7,
-	// };
-
-	SetTargetFPS(60);
+// Handles the input of one frame, draws it and presents it.
+void run_frame(void)
+{
+	U64 frame_start = profile_now();
+	if (input_log.file != NULL) {
+		capture_input(&input_frame);
+	}
+	Vector2 pos = GetMousePosition();
+	cursor_x = pos.x;
+	cursor_y = pos.y;
+	if (input_active()) {
+		last_input_time = GetTime();
+	}
 
-	while (!WindowShouldClose()) {
-		Vector2 pos = GetMousePosition();
-		cursor_x = pos.x;
-		cursor_y = pos.y;
+	PROFILE_CALL(jobs_drain(&jobs));
 
 #if !defined(PLATFORM_WEB)
-		handle_input_screenshot();
-		handle_input_controls(&text_controls);
-		handle_input_controls(&img_controls);
+	PROFILE_CALL(handle_input_screenshot());
+	PROFILE_CALL(handle_input_controls(&text_controls));
+	PROFILE_CALL(handle_input_controls(&img_controls));
 #endif
 
-		handle_drop_images();
+	PROFILE_CALL(handle_drop_images());
+
+	PROFILE_CALL(update_top_controls());
+	PROFILE_CALL(handle_input_controls(&top_controls));
+
+	PROFILE_CALL(handle_cursor());
+	PROFILE_CALL(handle_shortcuts());
+	PROFILE_CALL(handle_color_removal());
+	PROFILE_CALL(handle_input_lines());
+	PROFILE_CALL(handle_panning());
+	PROFILE_CALL(handle_scroll());
+
+	PROFILE_CALL(handle_mouse_input_entities());
+	PROFILE_CALL(handle_key_input_entities());
+
+	PROFILE_CALL(handle_input_resizer());
+
+	PROFILE_CALL(update_resizer());
+	PROFILE_CALL(update_image_controls());
+	PROFILE_CALL(update_text_controls());
+	PROFILE_CALL(update_entities());
+	PROFILE_CALL(upload_textures());
+	U64 cache_start = profile_now();
+	bool cached = update_board_cache();
+	profile_record(&profiler, "update_board_cache()", cache_start, profile_now());
+	int prefetch_x, prefetch_y;
+	if (cached && next_prefetch_tile(&prefetch_x, &prefetch_y)) {
+		idle_post(&idle, "prefetch_board_tile()", prefetch_board_tile, NULL,
+				IDLE_LOW, 1);
+	}
+
+	BeginDrawing();
+	ClearBackground(BLANK);
+	DrawFPS(0, 0);
 
-		update_top_controls();
-		handle_input_controls(&top_controls);
+	PROFILE_CALL(draw_board(cached));
 
-		handle_cursor();
-		handle_shortcuts();
-		handle_color_removal();
-		handle_input_lines();
-		handle_panning();
-		handle_scroll();
+	PROFILE_CALL(draw_resizer());
 
-		handle_mouse_input_entities();
-		handle_key_input_entities();
+	PROFILE_CALL(draw_controls(&text_controls));
+	PROFILE_CALL(draw_controls(&img_controls));
+	PROFILE_CALL(draw_controls(&top_controls));
 
-		handle_input_resizer();
+	PROFILE_CALL(handle_input_erasure());
 
-		update_resizer();
-		update_image_controls();
-		update_text_controls();
-		update_entities();
+	PROFILE_CALL(draw_screenshot());
+	PROFILE_CALL(draw_scale());
+	if (show_profiler) {
+		draw_profiler();
+		request_redraw();
+	}
+	if (show_memory) {
+		PROFILE_CALL(draw_memory());
+	}
+
+#if defined(PLATFORM_WEB)
+	rlDrawRenderBatchActive();
+	handle_input_screenshot();
+	handle_input_controls(&text_controls);
+	handle_input_controls(&img_controls);
+#endif
 
-		BeginDrawing();
-		ClearBackground(BLANK);
-		DrawFPS(0, 0);
+	replay_write(&input_log, &input_frame);
+	PROFILE_CALL(run_idle_tasks(frame_start));
+
+	// Input wakes the loop up by itself, anything else that changes the
+	// screen has to ask for the frames it needs. Jobs and housekeeping can't
+	// wake it, so it polls while there are any.
+	if (redraw_frames > 0) {
+		redraw_frames--;
+		DisableEventWaiting();
+	} else if (jobs_busy(&jobs) || idle_pending(&idle)) {
+		DisableEventWaiting();
+	} else {
+		EnableEventWaiting();
+	}
+	// Also waits for the frame rate cap and, when nothing is going on, for
+	// the next input event.
+	U64 present_start = profile_now();
+	PROFILE_CALL(EndDrawing());
+	U64 present = profile_now() - present_start;
+
+	if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+		PROFILE_CALL(end_undo_step());
+	}
+	PROFILE_CALL(checkpoint_board(false));
+	PROFILE_CALL(evict_textures());
+	profile_end_frame(&profiler, frame_start, present);
+	arena_reset(&frame_arena);
+	frame++;
+}
 
-		draw_entities();
-		draw_lines();
+// Whether the user is doing anything this frame, typing aside.
+bool input_active(void)
+{
+	Vector2 delta = GetMouseDelta();
+	if (delta.x != 0 || delta.y != 0 || GetMouseWheelMove() != 0) {
+		return true;
+	}
+	for (int b = 0; b < REPLAY_MAX_BUTTONS; ++b) {
+		if (IsMouseButtonDown(b)) {
+			return true;
+		}
+	}
+	for (int key = 1; key < REPLAY_MAX_KEYS; ++key) {
+		if (IsKeyDown(key)) {
+			return true;
+		}
+	}
+	return false;
+}
 
-		draw_resizer();
+// Runs housekeeping in the time the frame has left before it is presented.
+// While nobody is using the app the frame rate doesn't matter, and a task
+// too big for any frame gets its turn.
+void run_idle_tasks(U64 frame_start)
+{
+	const double budget_ms = 1000.0 / 60;
+	double elapsed_ms = (profile_now() - frame_start) / 1e6;
+	double slack_ms = fmin(budget_ms - elapsed_ms, idle_budget_ms);
+	bool quiet = GetTime() - last_input_time >= IDLE_QUIET_MS / 1000.0;
+	if (quiet) {
+		slack_ms = IDLE_QUIET_BUDGET_MS;
+	}
+	idle_run(&idle, &profiler, slack_ms, quiet);
+}
 
-		draw_controls(&text_controls);
-		draw_controls(&img_controls);
-		draw_controls(&top_controls);
+// Frame times of the last PROFILE_FRAMES frames, the part spent presenting
+// and waiting drawn dimmer, over the smoothed time of every scope.
+void draw_profiler(void)
+{
+	const float graph_height = 80;
+	const float budget_ms = 1000.0f / 60;
+	const int font_size = 10;
+	int rows = 0;
+	for (int i = 0; i < profiler.scope_count; ++i) {
+		rows += profiler.scopes[i].max_ms >= 0.01;
+	}
+	float height = graph_height + 30 + (rows + 3) * (font_size + 2);
+	Vector2 pos = { 10, GetScreenHeight() - height - 10 };
+	DrawRectangleV(pos, (Vector2) { PROFILE_OVERLAY_WIDTH, height },
+			Fade(HATORI_PRIMARY, 0.9f));
+
+	// 2.5 frame budgets fill the graph.
+	float bar_width = (float)PROFILE_OVERLAY_WIDTH / PROFILE_FRAMES;
+	float px_per_ms = graph_height / (budget_ms * 2.5f);
+	float bottom = pos.y + 10 + graph_height;
+	for (U64 i = 0; i < ring_count(&profiler.history); ++i) {
+		Profile_Frame f = ring_at(&profiler.history, i);
+		float total = fminf(f.ms * px_per_ms, graph_height);
+		float work = fminf((f.ms - f.present_ms) * px_per_ms, graph_height);
+		float x = pos.x + i * bar_width;
+		Color color = f.ms - f.present_ms > budget_ms ? RED : GREEN;
+		DrawRectangleRec(
+				(Rectangle) { x, bottom - total, bar_width, total - work },
+				Fade(color, 0.3f));
+		DrawRectangleRec((Rectangle) { x, bottom - work, bar_width, work }, color);
+	}
+	DrawLineV((Vector2) { pos.x, bottom - budget_ms * px_per_ms },
+			(Vector2) { pos.x + PROFILE_OVERLAY_WIDTH,
+					bottom - budget_ms * px_per_ms },
+			YELLOW);
+
+	Profile_Frame last = { 0 };
+	if (ring_count(&profiler.history) > 0) {
+		last = ring_last(&profiler.history);
+	}
+	float y = bottom + 6;
+	DrawText(TextFormat("frame %.2f ms, work %.2f ms; per scope avg, max",
+						 last.ms, last.ms - last.present_ms),
+			pos.x + 6, y, font_size, RAYWHITE);
+	y += font_size + 4;
+	Jobs_Stats js = jobs_stats(&jobs);
+	DrawText(TextFormat("jobs: %d workers, %d queued (max %d), %d active",
+						 js.workers, js.queued, js.max_queued, js.active),
+			pos.x + 6, y, font_size, LIGHTGRAY);
+	y += font_size + 2;
+	DrawText(TextFormat("%llu run, %llu stolen, %llu inline, %llu completed",
+						 (unsigned long long)js.run, (unsigned long long)js.stolen,
+						 (unsigned long long)js.run_inline,
+						 (unsigned long long)js.completed),
+			pos.x + 6, y, font_size, LIGHTGRAY);
+	y += font_size + 2;
+	DrawText(TextFormat("idle: %zu tasks, %.2f/%.2f ms, %llu slices, %llu late",
+						 idle.tasks.count, idle.used_ms, idle.slack_ms,
+						 (unsigned long long)idle.slices,
+						 (unsigned long long)idle.late),
+			pos.x + 6, y, font_size, LIGHTGRAY);
+	y += font_size + 4;
+	for (int i = 0; i < profiler.scope_count; ++i) {
+		Profile_Scope s = profiler.scopes[i];
+		if (s.max_ms < 0.01) {
+			continue;
+		}
+		DrawText(TextFormat("%6.2f %6.2f  %s", s.ms, s.max_ms, s.name),
+				pos.x + 6, y, font_size, s.max_ms > budget_ms ? RED : LIGHTGRAY);
+		y += font_size + 2;
+	}
+}
 
-		handle_input_erasure();
+void dump_profile(const char* path)
+{
+	if (profile_write_trace(&profiler, path)) {
+		TraceLog(LOG_INFO, "PROFILE: Wrote trace to %s", path);
+	} else {
+		TraceLog(LOG_ERROR, "PROFILE: Can't write trace to %s", path);
+	}
+}
 
-		draw_screenshot();
-		draw_scale();
+// Takes this frame's input state from raylib for the log. Characters and
+// dropped files are added where the app takes them.
+void capture_input(Replay_Frame* f)
+{
+	replay_clear_events(f);
+	Vector2 mouse = GetMousePosition();
+	f->mouse_x = mouse.x;
+	f->mouse_y = mouse.y;
+	f->wheel = GetMouseWheelMove();
+	f->width = GetScreenWidth();
+	f->height = GetScreenHeight();
+	f->buttons = 0;
+	for (int b = 0; b < REPLAY_MAX_BUTTONS; ++b) {
+		f->buttons |= IsMouseButtonDown(b) ? 1 << b : 0;
+	}
+	for (int key = 1; key < REPLAY_MAX_KEYS; ++key) {
+		bool down = IsKeyDown(key);
+		replay_set_key(f, key, down);
+		if (down && IsKeyPressedRepeat(key)
+				&& f->repeat_count < REPLAY_MAX_EVENTS) {
+			f->repeats[f->repeat_count++] = key;
+		}
+	}
+}
 
-#if defined(PLATFORM_WEB)
-		rlDrawRenderBatchActive();
-		handle_input_screenshot();
-		handle_input_controls(&text_controls);
-		handle_input_controls(&img_controls);
+#if defined(PLATFORM_HEADLESS)
+// Makes raylib report a logged frame's input to the next run_frame().
+void replay_input(const Replay_Frame* f)
+{
+	if (f->width != GetScreenWidth() || f->height != GetScreenHeight()) {
+		headless_resize(f->width, f->height);
+	}
+	headless_mouse_move(f->mouse_x, f->mouse_y);
+	for (int b = 0; b < REPLAY_MAX_BUTTONS; ++b) {
+		bool down = f->buttons >> b & 1;
+		if (down != IsMouseButtonDown(b)) {
+			headless_mouse_button(b, down);
+		}
+	}
+	if (f->wheel != 0) {
+		headless_mouse_wheel(f->wheel);
+	}
+	for (int key = 1; key < REPLAY_MAX_KEYS; ++key) {
+		if (replay_key_down(f, key) != IsKeyDown(key)) {
+			headless_key(key, replay_key_down(f, key));
+		}
+	}
+	for (int i = 0; i < f->repeat_count; ++i) {
+		headless_key_repeat(f->repeats[i]);
+	}
+	for (int i = 0; i < f->char_count; ++i) {
+		headless_char(f->chars[i]);
+	}
+	if (f->drop_count > 0) {
+		const char* paths[REPLAY_MAX_EVENTS];
+		const char* path = f->drops.items;
+		for (int i = 0; i < f->drop_count; ++i) {
+			paths[i] = path;
+			path += strlen(path) + 1;
+		}
+		headless_drop_files(paths, f->drop_count);
+	}
+}
 #endif
 
-		EndDrawing();
+#if defined(HATORI_NO_MAIN)
+// Linked into another program, like the benchmarks in src/bench.c.
+#elif defined(PLATFORM_HEADLESS)
+int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+// Runs frames against an offscreen framebuffer, see src/rcore_headless.c.
+// The mouse pans the board in a circle with the right button held and
+// zooms in and out now and then, like a user looking around.
+int main(int argc, char** argv)
+{
+	int width = 1280;
+	int height = 720;
+	int frames = 300;
+	bool pan = true;
+	const char* screenshot = NULL;
+	const char* replay_path = NULL;
+	const char* timings_path = NULL;
+	const char* trace_path = NULL;
+	const char* memory_path = NULL;
+	const char* path = board_path;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+			sscanf(argv[++i], "%dx%d", &width, &height);
+		} else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc) {
+			screenshot = argv[++i];
+		} else if (strcmp(argv[i], "--still") == 0) {
+			pan = false;
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay_path = argv[++i];
+		} else if (strcmp(argv[i], "--timings") == 0 && i + 1 < argc) {
+			timings_path = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+			memory_path = argv[++i];
+		} else if (argv[i][0] != '-') {
+			path = argv[i];
+		} else {
+			fprintf(stderr,
+					"usage: %s [board] [--frames N] [--size WxH] [--still] "
+					"[--replay input.log] [--timings out.csv] "
+					"[--trace out.json] [--memory out.txt] "
+					"[--screenshot out.png]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+
+	// A recorded session decides the frames and the screen size itself.
+	Replay replay = { 0 };
+	Replay_Frame replay_frame = { 0 };
+	bool replaying = replay_path != NULL;
+	if (replaying) {
+		if (!replay_open(&replay, replay_path, false)
+				|| !replay_read(&replay, &replay_frame)) {
+			fprintf(stderr, "%s: can't read input log %s\n", argv[0], replay_path);
+			return 1;
+		}
+		width = replay_frame.width;
+		height = replay_frame.height;
+	}
+
+	init_hatori(width, height);
+	if (!IsWindowReady()) {
+		return 1;
+	}
+	open_board(path);
+
+	List(double) times = { 0 };
+	list_reserve(&times, replaying ? 1024 : (frames > 0 ? frames : 1));
+	headless_mouse_move(width / 2.0f, height / 2.0f);
+	headless_mouse_button(MOUSE_BUTTON_RIGHT, pan && !replaying);
+	for (int i = 0; replaying || i < frames; ++i) {
+		if (replaying) {
+			if (i > 0 && !replay_read(&replay, &replay_frame)) {
+				break;
+			}
+			replay_input(&replay_frame);
+		} else if (pan) {
+			float a = i * 0.05f;
+			headless_mouse_move(width / 2.0f + cosf(a) * height / 3.0f,
+					height / 2.0f + sinf(a) * height / 3.0f);
+			if (i % 60 == 30) {
+				headless_mouse_wheel(i % 120 == 30 ? 1 : -1);
+			}
+		}
+		double start = GetTime();
+		run_frame();
+		list_append(&times, (GetTime() - start) * 1000);
+		// Images come in on the frame they were dropped on, the input after
+		// that may already use them.
+		if (replaying) {
+			job_wait(&jobs, &image_loads);
+			jobs_drain(&jobs);
+		}
+	}
+	replay_close(&replay);
+	free(replay_frame.drops.items);
+	// Images still decoding would be missing from the screenshot.
+	for (int i = 0; screenshot != NULL && jobs_busy(&jobs) && i < 60; ++i) {
+		jobs_finish(&jobs);
+		run_frame();
+	}
+	if (trace_path != NULL) {
+		dump_profile(trace_path);
+	}
+	if (memory_path != NULL) {
+		dump_memory(memory_path);
+	}
+	if (screenshot != NULL) {
+		Image shot = LoadImageFromScreen();
+		ExportImage(shot, screenshot);
+		UnloadImage(shot);
+	}
+	if (timings_path != NULL) {
+		FILE* file = fopen(timings_path, "w");
+		if (file != NULL) {
+			fprintf(file, "frame,ms\n");
+			for (size_t i = 0; i < times.count; ++i) {
+				fprintf(file, "%zu,%.3f\n", i, times.items[i]);
+			}
+			fclose(file);
+		} else {
+			TraceLog(LOG_ERROR, "Can't write frame timings to %s", timings_path);
+		}
+	}
+	frames = times.count;
+	if (frames > 0) {
+		double total = 0;
+		for (int i = 0; i < frames; ++i) {
+			total += times.items[i];
+		}
+		qsort(times.items, frames, sizeof(*times.items), compare_doubles);
+		printf("%d frames at %dx%d: mean %.2f ms, median %.2f ms, max %.2f ms\n",
+				frames, width, height, total / frames, times.items[frames / 2],
+				times.items[frames - 1]);
+	}
+	free(times.items);
+
+	jobs_shutdown(&jobs);
+	journal_close(&journal);
+	CloseWindow();
+	return 0;
+}
+#else
+int main(int argc, char** argv)
+{
+	const char* path = board_path;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			if (!replay_open(&input_log, argv[++i], true)) {
+				TraceLog(LOG_ERROR, "Can't record input to %s", argv[i]);
+			}
+		} else {
+			path = argv[i];
+		}
+	}
+	init_hatori(800, 600);
+	open_board(path);
+
+	// Hatori_Slider thickness_slider = {
+	// 	.pos = { top_controls.pos.x + top_controls.size.x + 20,
+	// 			top_controls.pos.y + top_controls.size.y / 2 },
+	// 	.size = { 100, 3 },
+	// 	.percentage = 0,
+	// 	.radius = 7,
+	// };
+
+	SetTargetFPS(60);
+
+	while (!WindowShouldClose()) {
+		run_frame();
 	}
 
+	replay_close(&input_log);
+	free(input_frame.drops.items);
+	jobs_shutdown(&jobs);
+	journal_close(&journal);
 	CloseWindow();
 	return 0;
 }
+#endif
 
 void clear_on_click(void)
 {
@@ -349,13 +1488,10 @@ void pen_on_click(void) { mode = PEN_MODE; }
 
 void text_on_click(void)
 {
-	Hatori_Text txt = create_text();
-	Hatori_Entity e = { 0 };
-	e.type = ENTITY_TEXT;
-	e.entity.text = txt;
-	selected_entity = entities.count;
-	list_append(&entities, e);
-
+	selected_entity = add_text_entity(create_text(), 0);
+	Hatori_Text txt = entities.items[selected_entity].entity.text;
+	record_entity_op(OP_TEXT_ADD, 0, board_entity(entities.items[selected_entity]),
+			txt.text.items, txt.text.count);
 	top_controls.selected = -1;
 }
 
@@ -376,41 +1512,47 @@ Hatori_Controls create_top_controls(void)
 
 	list_init(&container.buttons, 5);
 
-	Texture2D bin_txt = LoadTexture("assets/bin.png");
-	Texture2D pointer_txt = LoadTexture("assets/pointer.png");
-	Texture2D rect_txt = LoadTexture("assets/rectangle.png");
-	Texture2D pen_txt = LoadTexture("assets/pen.png");
-	Texture2D text_txt = LoadTexture("assets/text.png");
-	Texture2D image_txt = LoadTexture("assets/image.png");
-	Texture2D erasure_txt = LoadTexture("assets/erasure.png");
-
-	list_append(
-			&container.buttons, create_controls_btn(bin_txt, *clear_on_click));
+	list_append(&container.buttons,
+			create_controls_btn("assets/bin.png", *clear_on_click));
 
-	list_append(
-			&container.buttons, create_controls_btn(pointer_txt, pointer_on_click));
+	list_append(&container.buttons,
+			create_controls_btn("assets/pointer.png", pointer_on_click));
 
-	list_append(&container.buttons, create_controls_btn(rect_txt, rect_on_click));
+	list_append(&container.buttons,
+			create_controls_btn("assets/rectangle.png", rect_on_click));
 
-	list_append(&container.buttons, create_controls_btn(pen_txt, pen_on_click));
+	list_append(&container.buttons,
+			create_controls_btn("assets/pen.png", pen_on_click));
 
-	list_append(&container.buttons, create_controls_btn(text_txt, text_on_click));
+	list_append(&container.buttons,
+			create_controls_btn("assets/text.png", text_on_click));
 
-	list_append(
-			&container.buttons, create_controls_btn(image_txt, image_on_click));
+	list_append(&container.buttons,
+			create_controls_btn("assets/image.png", image_on_click));
 
-	list_append(
-			&container.buttons, create_controls_btn(erasure_txt, erasure_on_click));
+	list_append(&container.buttons,
+			create_controls_btn("assets/erasure.png", erasure_on_click));
 
 	return container;
 }
 
-Hatori_ControlsBtn create_controls_btn(Texture2D texture, void (*onclick)(void))
+// The icon goes onto an atlas page shared by all controls, or into its own
+// texture when it doesn't fit there.
+Hatori_ControlsBtn create_controls_btn(
+		const char* icon_path, void (*onclick)(void))
 {
-	return (Hatori_ControlsBtn) {
-		.texture = texture,
+	Image icon = LoadImage(icon_path);
+	ImageFormat(&icon, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	Hatori_ControlsBtn btn = {
+		.source = { 0, 0, icon.width, icon.height },
 		.onclick = onclick,
 	};
+	btn.texture = atlas_add_icon(icon, &btn.source);
+	if (btn.texture.id == 0) {
+		btn.texture = LoadTextureFromImage(icon);
+	}
+	UnloadImage(icon);
+	return btn;
 }
 
 void select_top_controls(U64 index) { top_controls.selected = index; }
@@ -471,7 +1613,6 @@ void draw_controls(Hatori_Controls* controls)
 	}
 	DrawRectangleV(controls->pos, controls->size, HATORI_PRIMARY);
 	for (size_t i = 0; i < controls->buttons.count; ++i) {
-		const Texture2D text = controls->buttons.items[i].texture;
 		// hovered over
 		if (controls->hovered == i) {
 			DrawRectangle(controls->buttons.items[i].pos.x - controls->pad / 2,
@@ -487,7 +1628,7 @@ void draw_controls(Hatori_Controls* controls)
 					controls->buttons.items[i].size.y + controls->pad, PURPLE);
 		}
 		DrawTexturePro(controls->buttons.items[i].texture,
-				(Rectangle) { 0, 0, (float)text.width, (float)text.height },
+				controls->buttons.items[i].source,
 				(Rectangle) {
 						controls->buttons.items[i].pos.x,
 						controls->buttons.items[i].pos.y,
@@ -514,6 +1655,22 @@ float to_virtual_x(float x) { return (x / scale) - offset_x; }
 
 float to_virtual_y(float y) { return (y / scale) - offset_y; }
 
+Rectangle to_virtual_rect(Rectangle r)
+{
+	return (Rectangle) { to_virtual_x(r.x), to_virtual_y(r.y), r.width / scale,
+		r.height / scale };
+}
+
+// The board is drawn in virtual coordinates under this camera, so the view
+// transform is done once on the GPU instead of for every entity and stroke.
+Camera2D board_camera(void)
+{
+	return (Camera2D) {
+		.offset = { offset_x * scale, offset_y * scale },
+		.zoom = scale,
+	};
+}
+
 bool is_mouse_moving(void)
 {
 	return prev_cursor_x != cursor_x || prev_cursor_y != cursor_y;
@@ -521,6 +1678,9 @@ bool is_mouse_moving(void)
 
 void handle_input_lines(void)
 {
+	if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+		simplify_last_stroke();
+	}
 	if (mode == PEN_MODE
 			&& !CheckCollisionPointRec(GetMousePosition(),
 					(Rectangle) { top_controls.pos.x, top_controls.pos.y,
@@ -530,97 +1690,432 @@ void handle_input_lines(void)
 			prev_cursor_y = cursor_y;
 		}
 		if (is_mouse_moving() && IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-			Hatori_Line l = (Hatori_Line) {
+			Hatori_BoardLine l = {
 				.x0 = to_virtual_x(prev_cursor_x),
 				.y0 = to_virtual_y(prev_cursor_y),
 				.x1 = to_virtual_x(cursor_x),
 				.y1 = to_virtual_y(cursor_y),
 				.thickness = pen_thickness,
 			};
-			list_append(&lines, l);
+			do_op(OP_LINE_ADD, lines.count, &l, sizeof(l));
 			prev_cursor_x = cursor_x;
 			prev_cursor_y = cursor_y;
 		}
 	}
 }
 
-void draw_lines(void)
+// Douglas-Peucker: keeps the points of `in` that are further than
+// `tolerance` from the line between the points kept around them. Returns
+// how many were written to `out`.
+U32 simplify_polyline(
+		const Vector2* in, U32 count, float tolerance, Vector2* out)
 {
-	for (size_t i = 0; i < lines.count; ++i) {
+	static List(U64) keep = { 0 };
+	static List(U32) stack = { 0 };
+	if (count < 3) {
+		memcpy(out, in, count * sizeof(*in));
+		return count;
+	}
+	list_clear(&keep);
+	list_reserve(&keep, BITSET_WORDS(count));
+	memset(keep.items, 0, BITSET_WORDS(count) * sizeof(*keep.items));
+	bitset_set(keep.items, 0, true);
+	bitset_set(keep.items, count - 1, true);
+	list_clear(&stack);
+	list_append(&stack, 0);
+	list_append(&stack, count - 1);
+	while (stack.count > 0) {
+		U32 last = stack.items[--stack.count];
+		U32 first = stack.items[--stack.count];
+		Vector2 a = in[first];
+		Vector2 d = { in[last].x - a.x, in[last].y - a.y };
+		float len = sqrtf(d.x * d.x + d.y * d.y);
+		float worst = 0;
+		U32 worst_i = 0;
+		for (U32 i = first + 1; i < last; ++i) {
+			Vector2 p = { in[i].x - a.x, in[i].y - a.y };
+			float dist = len > 0 ? fabsf(p.x * d.y - p.y * d.x) / len
+								 : sqrtf(p.x * p.x + p.y * p.y);
+			if (dist > worst) {
+				worst = dist;
+				worst_i = i;
+			}
+		}
+		if (worst > tolerance) {
+			bitset_set(keep.items, worst_i, true);
+			list_append(&stack, first);
+			list_append(&stack, worst_i);
+			list_append(&stack, worst_i);
+			list_append(&stack, last);
+		}
+	}
+	U32 n = 0;
+	for (U32 i = 0; i < count; ++i) {
+		if (bitset_get(keep.items, i)) {
+			out[n++] = in[i];
+		}
+	}
+	return n;
+}
+
+// Joins the live segments of `lines` in [from, to) into strokes and
+// simplifies each of them for every LOD.
+void build_strokes(U64 from, U64 to, Hatori_Strokes* out)
+{
+	static List(Vector2) points = { 0 };
+	U64 i = from;
+	while (i < to) {
 		if (lines.items[i].deleted) {
+			i++;
 			continue;
 		}
-		DrawLineEx((Vector2) { to_screen_x(lines.items[i].x0),
-									 to_screen_y(lines.items[i].y0) },
-				(Vector2) {
-						to_screen_x(lines.items[i].x1), to_screen_y(lines.items[i].y1) },
-				lines.items[i].thickness, WHITE);
+		Hatori_Line l = lines.items[i];
+		Hatori_Stroke s = { .first = i, .count = 1, .thickness = l.thickness };
+		list_clear(&points);
+		list_append(&points, ((Vector2) { l.x0, l.y0 }));
+		list_append(&points, ((Vector2) { l.x1, l.y1 }));
+		for (i++; i < to; ++i) {
+			Hatori_Line next = lines.items[i];
+			if (next.deleted || next.thickness != l.thickness || next.x0 != l.x1
+					|| next.y0 != l.y1) {
+				break;
+			}
+			list_append(&points, ((Vector2) { next.x1, next.y1 }));
+			l = next;
+			s.count++;
+		}
+		Vector2 min = points.items[0], max = points.items[0];
+		for (size_t k = 1; k < points.count; ++k) {
+			min = (Vector2) { fminf(min.x, points.items[k].x),
+				fminf(min.y, points.items[k].y) };
+			max = (Vector2) { fmaxf(max.x, points.items[k].x),
+				fmaxf(max.y, points.items[k].y) };
+		}
+		s.bounds = (Rectangle) { min.x, min.y, max.x - min.x, max.y - min.y };
+		if (s.count > 1) {
+			s.points = malloc(
+					(STROKE_LODS - 1) * points.count * sizeof(*s.points));
+			assert(s.points != NULL && "Buy more RAM!!");
+			U32 offset = 0;
+			for (int k = 1; k < STROKE_LODS; ++k) {
+				s.lod_points[k] = simplify_polyline(points.items, points.count,
+						stroke_lod_tolerance(k), s.points + offset);
+				offset += s.lod_points[k];
+			}
+		}
+		list_append(out, s);
 	}
 }
 
-void clear_screen(void) { list_clear(&lines); }
+float stroke_lod_tolerance(int lod)
+{
+	return STROKE_LOD_TOLERANCE * (float)(1 << (2 * (lod - 1)));
+}
 
-void handle_panning(void)
+// Call when segment `i` of `lines` was deleted or restored.
+void lines_changed(U64 i)
 {
-	if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT)) {
-		prev_cursor_x = cursor_x;
-		prev_cursor_y = cursor_y;
+	if (i < stroke_dirty_from) {
+		stroke_dirty_from = i;
 	}
-	if (is_mouse_moving() && IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
-		offset_x -= (prev_cursor_x - cursor_x) / scale;
-		offset_y -= (prev_cursor_y - cursor_y) / scale;
-
-		prev_cursor_x = cursor_x;
-		prev_cursor_y = cursor_y;
+	if (i + 1 > stroke_dirty_to) {
+		stroke_dirty_to = i + 1;
 	}
 }
 
-void handle_scroll(void)
+void clear_strokes(void)
 {
-	float move = GetMouseWheelMove();
-	if (move != 0) {
-		float scale_amount = .20 * move;
-		scale = scale * (1 + scale_amount);
-
-		float x = ((float)GetScreenWidth() / scale) * scale_amount;
-		float y = ((float)GetScreenHeight() / scale) * scale_amount;
-
-		float left = x * (cursor_x / GetScreenWidth());
-		float top = y * (cursor_y / GetScreenHeight());
-
-		offset_x -= left;
-		offset_y -= top;
+	for (size_t i = 0; i < strokes.count; ++i) {
+		free(strokes.items[i].points);
 	}
+	list_clear(&strokes);
+	strokes_built = 0;
+	stroke_dirty_from = UINT64_MAX;
+	stroke_dirty_to = 0;
 }
 
-void handle_drop_images(void)
+// Brings `strokes` up to date with `lines`. Only the strokes around changed
+// or appended segments are rebuilt, and neighbours are included since a
+// restored segment can join them.
+void update_strokes(void)
 {
-	if (IsFileDropped()) {
-		FilePathList dropped_files = LoadDroppedFiles();
-		for (int i = 0; i < dropped_files.count; ++i) {
-			Image img = LoadImage(dropped_files.paths[i]);
-			ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
-			Texture2D texture = LoadTextureFromImage(img);
-			if (!IsTextureReady(texture)) {
-				continue;
-			}
-			Hatori_Image new_img = { 0 };
-			Vector2 pos = GetMousePosition();
-			new_img.pos.x = to_virtual_x(pos.x);
-			new_img.pos.y = to_virtual_y(pos.y);
-			new_img.size.x = texture.width;
-			new_img.size.y = texture.height;
-			new_img.texture = texture;
-			new_img.original = img;
-			new_img.current = ImageCopy(img);
-
-			Hatori_Entity e = { 0 };
-			e.z = z++;
-			e.type = ENTITY_IMAGE;
-			e.entity.image = new_img;
-			list_append(&entities, e);
+	static Hatori_Strokes rebuilt = { 0 };
+	if (lines.count < strokes_built) {
+		// Lines were taken off the end, drop the strokes that reach past it.
+		while (strokes.count > 0
+				&& strokes.items[strokes.count - 1].first
+								+ strokes.items[strokes.count - 1].count
+						> lines.count) {
+			free(strokes.items[--strokes.count].points);
 		}
-		UnloadDroppedFiles(dropped_files);
+		strokes_built = strokes.count > 0
+				? strokes.items[strokes.count - 1].first
+						+ strokes.items[strokes.count - 1].count
+				: 0;
+		if (stroke_dirty_to > lines.count) {
+			stroke_dirty_to = lines.count;
+		}
+	}
+	if (stroke_dirty_from == UINT64_MAX && strokes.count > 0) {
+		// Segments that continue the last stroke, as while it is drawn, only
+		// extend it. Simplifying it again for every segment would be quadratic,
+		// so it is drawn from its segments until simplify_last_stroke().
+		Hatori_Stroke* s = &strokes.items[strokes.count - 1];
+		Hatori_Line l = lines.items[s->first + s->count - 1];
+		U64 extended = strokes_built;
+		while (strokes_built < lines.count
+				&& s->first + s->count == strokes_built) {
+			Hatori_Line next = lines.items[strokes_built];
+			if (next.deleted || next.thickness != l.thickness || next.x0 != l.x1
+					|| next.y0 != l.y1) {
+				break;
+			}
+			Rectangle r = s->bounds;
+			float x = fminf(r.x, next.x1);
+			float y = fminf(r.y, next.y1);
+			s->bounds = (Rectangle) { x, y, fmaxf(r.x + r.width, next.x1) - x,
+				fmaxf(r.y + r.height, next.y1) - y };
+			s->count++;
+			strokes_built++;
+			l = next;
+		}
+		if (strokes_built > extended) {
+			free(s->points);
+			s->points = NULL;
+			memset(s->lod_points, 0, sizeof(s->lod_points));
+		}
+	}
+	if (lines.count > strokes_built) {
+		lines_changed(strokes_built);
+		stroke_dirty_to = lines.count;
+	}
+	if (stroke_dirty_from >= stroke_dirty_to) {
+		return;
+	}
+	U64 from = stroke_dirty_from;
+	U64 to = stroke_dirty_to;
+	size_t s0 = 0;
+	while (s0 < strokes.count
+			&& strokes.items[s0].first + strokes.items[s0].count < from) {
+		s0++;
+	}
+	size_t s1 = s0;
+	U64 limit = to;
+	while (s1 < strokes.count && strokes.items[s1].first <= limit) {
+		Hatori_Stroke s = strokes.items[s1++];
+		from = s.first < from ? s.first : from;
+		to = s.first + s.count > to ? s.first + s.count : to;
+	}
+	list_clear(&rebuilt);
+	build_strokes(from, to, &rebuilt);
+	for (size_t i = s0; i < s1; ++i) {
+		free(strokes.items[i].points);
+	}
+	size_t count = strokes.count - s1 + s0 + rebuilt.count;
+	list_reserve(&strokes, count);
+	memmove(strokes.items + s0 + rebuilt.count, strokes.items + s1,
+			(strokes.count - s1) * sizeof(*strokes.items));
+	memcpy(strokes.items + s0, rebuilt.items,
+			rebuilt.count * sizeof(*rebuilt.items));
+	strokes.count = count;
+	strokes_built = lines.count;
+	stroke_dirty_from = UINT64_MAX;
+	stroke_dirty_to = 0;
+}
+
+// Call once the last stroke is no longer drawn, update_strokes() then
+// simplifies it if it was only extended.
+void simplify_last_stroke(void)
+{
+	if (strokes.count > 0) {
+		Hatori_Stroke s = strokes.items[strokes.count - 1];
+		if (s.points == NULL && s.count > 1) {
+			lines_changed(s.first);
+		}
+	}
+}
+
+void draw_segment(Vector2 a, Vector2 b, float thickness, Rectangle clip)
+{
+	if (fmaxf(a.x, b.x) + thickness < clip.x
+			|| fminf(a.x, b.x) - thickness > clip.x + clip.width
+			|| fmaxf(a.y, b.y) + thickness < clip.y
+			|| fminf(a.y, b.y) - thickness > clip.y + clip.height) {
+		return;
+	}
+	if (stroke_shader.id == 0) {
+		if (a.x == b.x && a.y == b.y) {
+			DrawRectangleV((Vector2) { a.x - thickness / 2, a.y - thickness / 2 },
+					(Vector2) { thickness, thickness }, WHITE);
+		} else {
+			DrawLineEx(a, b, thickness, WHITE);
+		}
+		return;
+	}
+	// A quad one pixel wider than the round capped stroke on every side,
+	// with pixel coordinates along and across the segment for the shader.
+	float dx = b.x - a.x;
+	float dy = b.y - a.y;
+	float len = sqrtf(dx * dx + dy * dy);
+	if (len > 0) {
+		dx /= len;
+		dy /= len;
+	} else {
+		dx = 1;
+		dy = 0;
+	}
+	float r = thickness * scale / 2;
+	float e = (r + 1) / scale;
+	float u = len * scale + r + 1;
+	rlSetTexture(rlGetTextureIdDefault());
+	rlBegin(RL_QUADS);
+	rlColor4ub(255, 255, 255, 255);
+	// rlgl normalizes normals, the shader divides by z to undo that.
+	rlNormal3f(len * scale, r, 1);
+	rlTexCoord2f(-r - 1, -r - 1);
+	rlVertex2f(a.x - (dx - dy) * e, a.y - (dy + dx) * e);
+	rlTexCoord2f(-r - 1, r + 1);
+	rlVertex2f(a.x - (dx + dy) * e, a.y - (dy - dx) * e);
+	rlTexCoord2f(u, r + 1);
+	rlVertex2f(b.x + (dx - dy) * e, b.y + (dy + dx) * e);
+	rlTexCoord2f(u, -r - 1);
+	rlVertex2f(b.x + (dx + dy) * e, b.y + (dy - dx) * e);
+	rlEnd();
+	rlSetTexture(0);
+}
+
+void load_stroke_shader(void)
+{
+	stroke_shader = LoadShaderFromMemory(STROKE_VS, STROKE_FS);
+	if (!IsShaderReady(stroke_shader)
+			|| stroke_shader.id == rlGetShaderIdDefault()) {
+		TraceLog(LOG_WARNING, "STROKES: Shader failed, drawing without smoothing");
+		stroke_shader = (Shader) { 0 };
+	}
+}
+
+// Draws under board_camera(), like draw_entities().
+void draw_lines(void)
+{
+	update_strokes();
+	Rectangle clip = to_virtual_rect(draw_clip_rect());
+	int lod = 0;
+	while (lod + 1 < STROKE_LODS
+			&& stroke_lod_tolerance(lod + 1) * scale <= STROKE_LOD_ERROR) {
+		lod++;
+	}
+	if (stroke_shader.id > 0) {
+		BeginShaderMode(stroke_shader);
+	}
+	for (size_t i = 0; i < strokes.count; ++i) {
+		Hatori_Stroke s = strokes.items[i];
+		// Thickness is in screen pixels whatever the zoom.
+		float t = s.thickness / scale;
+		Rectangle r = s.bounds;
+		if (!CheckCollisionRecs((Rectangle) { r.x - t, r.y - t,
+										r.width + t * 2, r.height + t * 2 },
+						clip)) {
+			continue;
+		}
+		if (r.width * scale < 1 && r.height * scale < 1) {
+			// Smaller than a pixel, a dot looks the same.
+			Vector2 c = { r.x + r.width / 2, r.y + r.height / 2 };
+			draw_segment(c, c, t, clip);
+			continue;
+		}
+		if (lod == 0 || s.points == NULL) {
+			for (U64 j = s.first; j < s.first + s.count; ++j) {
+				Hatori_Line l = lines.items[j];
+				draw_segment((Vector2) { l.x0, l.y0 }, (Vector2) { l.x1, l.y1 }, t,
+						clip);
+			}
+			continue;
+		}
+		const Vector2* p = s.points;
+		for (int k = 1; k < lod; ++k) {
+			p += s.lod_points[k];
+		}
+		for (U32 j = 0; j + 1 < s.lod_points[lod]; ++j) {
+			draw_segment(p[j], p[j + 1], t, clip);
+		}
+	}
+	if (stroke_shader.id > 0) {
+		EndShaderMode();
+	}
+}
+
+void clear_screen(void)
+{
+	do_op(OP_LINES_CLEAR, 0, NULL, 0);
+}
+
+void handle_panning(void)
+{
+	if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT)) {
+		prev_cursor_x = cursor_x;
+		prev_cursor_y = cursor_y;
+	}
+	if (is_mouse_moving() && IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+		offset_x -= (prev_cursor_x - cursor_x) / scale;
+		offset_y -= (prev_cursor_y - cursor_y) / scale;
+
+		prev_cursor_x = cursor_x;
+		prev_cursor_y = cursor_y;
+	}
+}
+
+void handle_scroll(void)
+{
+	float move = GetMouseWheelMove();
+	if (move != 0) {
+		float scale_amount = .20 * move;
+		scale = scale * (1 + scale_amount);
+
+		float x = ((float)GetScreenWidth() / scale) * scale_amount;
+		float y = ((float)GetScreenHeight() / scale) * scale_amount;
+
+		float left = x * (cursor_x / GetScreenWidth());
+		float top = y * (cursor_y / GetScreenHeight());
+
+		offset_x -= left;
+		offset_y -= top;
+	}
+}
+
+// Keeps the main loop drawing for the next REDRAW_FRAMES frames instead of
+// blocking until input arrives. Call it for changes that don't come from an
+// input event of the current frame.
+void request_redraw(void)
+{
+	redraw_frames = REDRAW_FRAMES;
+}
+
+void handle_drop_images(void)
+{
+	if (IsFileDropped()) {
+		FilePathList dropped_files = LoadDroppedFiles();
+		for (int i = 0; i < dropped_files.count; ++i) {
+			if (input_log.file != NULL) {
+				replay_add_drop(&input_frame, dropped_files.paths[i]);
+			}
+			if (IsFileExtension(dropped_files.paths[i], ".hatori")) {
+				open_board(dropped_files.paths[i]);
+				continue;
+			}
+			Vector2 pos = GetMousePosition();
+			add_image_file_async(dropped_files.paths[i],
+					(Vector2) { to_virtual_x(pos.x), to_virtual_y(pos.y) });
+		}
+		UnloadDroppedFiles(dropped_files);
+	}
+}
+
+// GL reads the framebuffer bottom row first, images start at the top.
+void flip_rows(U8* dst, const U8* src, int row_bytes, int height)
+{
+	for (int y = 0; y < height; ++y) {
+		memcpy(dst + (size_t)(height - 1 - y) * row_bytes,
+				src + (size_t)y * row_bytes, row_bytes);
 	}
 }
 
@@ -633,9 +2128,10 @@ void take_screenshot_rect(const char* filepath, Rectangle rect)
 	int y = (GetScreenHeight() - rect.y - height) * win_scale.y;
 
 	unsigned char* screenData
-			= (unsigned char*)calloc(width * height * 4, sizeof(unsigned char));
+			= arena_alloc(&frame_arena, (size_t)width * height * 4);
 
-	glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, screenData);
+	PROFILE_CALL(glReadPixels(
+			x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, screenData));
 
 	bool is_empty = true;
 
@@ -648,19 +2144,12 @@ void take_screenshot_rect(const char* filepath, Rectangle rect)
 
 	if (is_empty) {
 		printf("empty data\n");
-		RL_FREE(screenData);
 		return;
 	}
 
 	unsigned char* imgData
 			= (unsigned char*)malloc(height * width * 4 * sizeof(unsigned char));
-
-	for (int y = height - 1; y >= 0; y--) {
-		for (int x = 0; x < (width * 4); x++) {
-			imgData[((height - 1) - y) * width * 4 + x]
-					= screenData[(y * width * 4) + x];
-		}
-	}
+	flip_rows(imgData, screenData, width * 4, height);
 
 	Image image = { 0 };
 	image.data = imgData;
@@ -669,26 +2158,6 @@ void take_screenshot_rect(const char* filepath, Rectangle rect)
 	image.mipmaps = 1;
 	image.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
 
-	Texture2D texture = LoadTextureFromImage(image);
-
-	Hatori_Image img;
-	img.pos.x = to_virtual_x(rect.x) + 40;
-	img.pos.y = to_virtual_y(rect.y) + 40;
-	img.size.x = (float)texture.width / scale;
-	img.size.y = (float)texture.height / scale;
-	img.original = image;
-	img.current = ImageCopy(img.original);
-	img.texture = texture;
-
-	RL_FREE(screenData);
-
-	Hatori_Entity e = { 0 };
-	e.type = ENTITY_IMAGE;
-	e.entity.image = img;
-	e.z = z++;
-
-	list_append(&entities, e);
-
 	char path[512] = { 0 };
 #if defined(PLATFORM_WEB)
 	U8* filedata = stbi_write_png_to_mem(
@@ -699,6 +2168,10 @@ void take_screenshot_rect(const char* filepath, Rectangle rect)
 			path, TextFormat("%s/%s", GetWorkingDirectory(), GetFileName(filepath)));
 	ExportImage(image, path);
 #endif
+
+	add_image_async(image,
+			(Vector2) { to_virtual_x(rect.x) + 40, to_virtual_y(rect.y) + 40 },
+			(Vector2) { (float)width / scale, (float)height / scale });
 }
 
 void handle_input_screenshot(void)
@@ -742,31 +2215,29 @@ void draw_screenshot(void)
 void bin_on_click(void)
 {
 	if (is_image_selected() || is_text_selected()) {
-		if (is_image_selected()) {
-			UnloadImage(entities.items[selected_entity].entity.image.original);
-			UnloadImage(entities.items[selected_entity].entity.image.current);
-		}
-		entities.items[selected_entity].deleted = true;
+		do_op(OP_ENTITY_DELETE, selected_entity, NULL, 0);
 		selected_entity = -1;
 		img_controls.selected = -1;
 		text_controls.selected = -1;
 	}
 }
 
+void flip_image_horizontal(Image* img)
+{
+	uint32_t* ptr = (uint32_t*)img->data;
+	for (int y = 0; y < img->height; y++) {
+		for (int x = 0; x < img->width / 2; x++) {
+			uint32_t backup = ptr[y * img->width + x];
+			ptr[y * img->width + x] = ptr[y * img->width + (img->width - 1 - x)];
+			ptr[y * img->width + (img->width - 1 - x)] = backup;
+		}
+	}
+}
+
 void hflip_on_click_image(void)
 {
 	if (is_image_selected()) {
-		Hatori_Image image = entities.items[selected_entity].entity.image;
-		uint32_t* ptr = (uint32_t*)image.current.data;
-		for (int y = 0; y < image.current.height; y++) {
-			for (int x = 0; x < image.current.width / 2; x++) {
-				uint32_t backup = ptr[y * image.current.width + x];
-				ptr[y * image.current.width + x]
-						= ptr[y * image.current.width + (image.current.width - 1 - x)];
-				ptr[y * image.current.width + (image.current.width - 1 - x)] = backup;
-			}
-		}
-		UpdateTexture(image.texture, image.current.data);
+		edit_selected_image((Hatori_ImageEdit) { .type = EDIT_HFLIP });
 		img_controls.selected = -1;
 	}
 }
@@ -774,10 +2245,7 @@ void hflip_on_click_image(void)
 void vflip_on_click_image(void)
 {
 	if (is_image_selected()) {
-		Hatori_Image image = entities.items[selected_entity].entity.image;
-		ImageFlipVertical(&image.current);
-		entities.items[selected_entity].entity.image.current = image.current;
-		UpdateTexture(image.texture, image.current.data);
+		edit_selected_image((Hatori_ImageEdit) { .type = EDIT_VFLIP });
 		img_controls.selected = -1;
 	}
 }
@@ -794,11 +2262,12 @@ void back_on_click(void)
 			text_controls.selected = -1;
 			return;
 		}
-		Hatori_Entity tmp = entities.items[i];
-		entities.items[selected_entity].z = tmp.z;
-		tmp.z++;
-		entities.items[i] = entities.items[selected_entity];
-		entities.items[selected_entity] = tmp;
+		Hatori_OpSwap swap = {
+			.other = i,
+			.z = entities.items[i].z + 1,
+			.other_z = entities.items[i].z,
+		};
+		do_op(OP_ENTITY_SWAP, selected_entity, &swap, sizeof(swap));
 
 		selected_entity = i;
 		img_controls.selected = -1;
@@ -818,11 +2287,12 @@ void front_on_click(void)
 			text_controls.selected = -1;
 			return;
 		}
-		Hatori_Entity tmp = entities.items[i];
-		entities.items[selected_entity].z = tmp.z;
-		tmp.z--;
-		entities.items[i] = entities.items[selected_entity];
-		entities.items[selected_entity] = tmp;
+		Hatori_OpSwap swap = {
+			.other = i,
+			.z = entities.items[i].z - 1,
+			.other_z = entities.items[i].z,
+		};
+		do_op(OP_ENTITY_SWAP, selected_entity, &swap, sizeof(swap));
 
 		selected_entity = i;
 		img_controls.selected = -1;
@@ -835,10 +2305,7 @@ void fill_on_click_image(void) { }
 void dig_on_click_image(void)
 {
 	if (is_image_selected()) {
-		Hatori_Image image = entities.items[selected_entity].entity.image;
-		erode_image(&image.current);
-		entities.items[selected_entity].entity.image.current = image.current;
-		UpdateTexture(image.texture, image.current.data);
+		edit_selected_image((Hatori_ImageEdit) { .type = EDIT_ERODE });
 		img_controls.selected = -1;
 	}
 }
@@ -846,11 +2313,7 @@ void dig_on_click_image(void)
 void reset_on_click_image(void)
 {
 	if (is_image_selected()) {
-		UnloadImage(entities.items[selected_entity].entity.image.current);
-		entities.items[selected_entity].entity.image.current
-				= ImageCopy(entities.items[selected_entity].entity.image.original);
-		UpdateTexture(entities.items[selected_entity].entity.image.texture,
-				entities.items[selected_entity].entity.image.current.data);
+		edit_selected_image((Hatori_ImageEdit) { .type = EDIT_RESET });
 		img_controls.selected = -1;
 	}
 }
@@ -869,8 +2332,8 @@ void save_on_click(void)
 		Hatori_Text txt = entities.items[selected_entity].entity.text;
 		pos.x = to_screen_x(txt.pos.x);
 		pos.y = to_screen_y(txt.pos.y);
-		size.x = txt.size.x;
-		size.y = txt.size.y;
+		size.x = txt.size.x * scale;
+		size.y = txt.size.y * scale;
 	}
 	Rectangle rect = { 0 };
 	rect.x = pos.x;
@@ -887,39 +2350,23 @@ void save_on_click(void)
 void copy_on_click(void)
 {
 	if (is_image_selected()) {
-		Hatori_Image new_img = entities.items[selected_entity].entity.image;
-		new_img.original = ImageCopy(new_img.current);
-		new_img.current = ImageCopy(new_img.current);
-		new_img.texture = LoadTextureFromImage(new_img.current);
-		new_img.pos.x += 10 * scale;
-		new_img.pos.y += 10 * scale;
-		Hatori_Entity e = { 0 };
-		e.z = z++;
-		e.type = ENTITY_IMAGE;
-		e.entity.image = new_img;
-		list_append(&entities, e);
+		Hatori_BoardEntity be = board_entity(entities.items[selected_entity]);
+		be.pos.x += 10 * scale;
+		be.pos.y += 10 * scale;
+		be.z = z++;
+		if (copy_image_entity(selected_entity, be) >= 0) {
+			record_entity_op(OP_IMAGE_COPY, selected_entity, be, NULL, 0);
+		}
 		img_controls.selected = -1;
 	}
 	if (is_text_selected()) {
 		Hatori_Text htxt = entities.items[selected_entity].entity.text;
-		List(char) copy_text = { 0 };
-		list_init(&copy_text, htxt.text.count);
-		for (U64 i = 0; i < htxt.text.count; ++i) {
-			list_append(&copy_text, htxt.text.items[i]);
-		}
-		for (int i = copy_text.count; i < copy_text.capacity; ++i) {
-			copy_text.items[i] = '\0';
-		}
-		htxt.pos.x += 10 * scale;
-		htxt.pos.y += 10 * scale;
-		htxt.text.items = copy_text.items;
-		htxt.text.count = copy_text.count;
-		htxt.text.capacity = copy_text.capacity;
-		Hatori_Entity e = { 0 };
-		e.z = z++;
-		e.type = ENTITY_TEXT;
-		e.entity.text = htxt;
-		list_append(&entities, e);
+		Hatori_BoardEntity be = board_entity(entities.items[selected_entity]);
+		be.pos.x += 10 * scale;
+		be.pos.y += 10 * scale;
+		be.z = z++;
+		add_text_entity(make_text(be, htxt.text.items, htxt.text.count), be.z);
+		record_entity_op(OP_TEXT_ADD, 0, be, htxt.text.items, htxt.text.count);
 
 		text_controls.selected = -1;
 	}
@@ -936,31 +2383,26 @@ Hatori_Controls create_image_controls(void)
 
 	list_init(&controls.buttons, 3);
 
-	Texture2D hflip = LoadTexture("assets/horizontal-flip.png");
-	Texture2D vflip = LoadTexture("assets/vertical-flip.png");
-	Texture2D bin = LoadTexture("assets/bin.png");
-	Texture2D up = LoadTexture("assets/up.png");
-	Texture2D down = LoadTexture("assets/down.png");
-	Texture2D fill = LoadTexture("assets/fill.png");
-	Texture2D copy = LoadTexture("assets/copy.png");
-	Texture2D save = LoadTexture("assets/save.png");
-	Texture2D reset = LoadTexture("assets/reset.png");
-	Texture2D dig = LoadTexture("assets/dig.png");
-
-	list_append(
-			&controls.buttons, create_controls_btn(hflip, hflip_on_click_image));
-	list_append(
-			&controls.buttons, create_controls_btn(vflip, vflip_on_click_image));
-	list_append(&controls.buttons, create_controls_btn(bin, bin_on_click));
-	list_append(&controls.buttons, create_controls_btn(up, front_on_click));
-	list_append(&controls.buttons, create_controls_btn(down, back_on_click));
-	list_append(
-			&controls.buttons, create_controls_btn(fill, fill_on_click_image));
-	list_append(&controls.buttons, create_controls_btn(copy, copy_on_click));
-	list_append(&controls.buttons, create_controls_btn(save, save_on_click));
-	list_append(
-			&controls.buttons, create_controls_btn(reset, reset_on_click_image));
-	list_append(&controls.buttons, create_controls_btn(dig, dig_on_click_image));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/horizontal-flip.png", hflip_on_click_image));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/vertical-flip.png", vflip_on_click_image));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/bin.png", bin_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/up.png", front_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/down.png", back_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/fill.png", fill_on_click_image));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/copy.png", copy_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/save.png", save_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/reset.png", reset_on_click_image));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/dig.png", dig_on_click_image));
 
 	return controls;
 }
@@ -969,6 +2411,7 @@ void update_image_controls(void)
 {
 	if (is_image_selected()) {
 		img_controls.show = true;
+		load_image_pixels(&entities.items[selected_entity].entity.image);
 		Hatori_Image img = entities.items[selected_entity].entity.image;
 		img_controls.pos.x = to_screen_x(img.pos.x);
 		img_controls.pos.y = to_screen_y(img.pos.y) - img_controls.side
@@ -993,6 +2436,21 @@ void update_image_controls(void)
 
 void handle_shortcuts(void)
 {
+	if (IsKeyPressed(KEY_F3)) {
+		show_profiler = !show_profiler;
+		request_redraw();
+	}
+	if (IsKeyPressed(KEY_F4)) {
+		dump_profile("hatori-trace.json");
+	}
+	if (IsKeyPressed(KEY_F5)) {
+		show_memory = !show_memory;
+		memory.taken = 0;
+		request_redraw();
+	}
+	if (IsKeyPressed(KEY_F6)) {
+		dump_memory("hatori-memory.txt");
+	}
 	if (IsKeyPressed(KEY_ESCAPE)) {
 		img_controls.selected = -1;
 		top_controls.selected = 1;
@@ -1041,9 +2499,25 @@ void handle_shortcuts(void)
 			}
 		}
 	}
+	if ((IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL))
+			&& IsKeyPressed(KEY_S)) {
+		checkpoint_board(true);
+	}
+	if ((IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL))
+			&& (IsKeyPressed(KEY_Z) || IsKeyPressedRepeat(KEY_Z))) {
+		if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
+			move_undo_step(&redo_stack, &undo_stack);
+		} else {
+			move_undo_step(&undo_stack, &redo_stack);
+		}
+	}
+	if ((IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL))
+			&& (IsKeyPressed(KEY_Y) || IsKeyPressedRepeat(KEY_Y))) {
+		move_undo_step(&redo_stack, &undo_stack);
+	}
 	if (IsKeyPressed(KEY_DELETE)) {
 		if (is_image_selected() || is_text_selected()) {
-			entities.items[selected_entity].deleted = true;
+			do_op(OP_ENTITY_DELETE, selected_entity, NULL, 0);
 
 			selected_entity = -1;
 			img_controls.selected = -1;
@@ -1106,8 +2580,8 @@ Rectangle img_to_rect(Hatori_Image img)
 	Rectangle r = { 0 };
 	r.x = to_screen_x(img.pos.x);
 	r.y = to_screen_y(img.pos.y);
-	r.width = img.texture.width * scale;
-	r.height = img.texture.height * scale;
+	r.width = img.current->width * scale;
+	r.height = img.current->height * scale;
 	return r;
 }
 
@@ -1121,11 +2595,13 @@ void handle_input_erasure(void)
 			if (CheckCollisionCircleRec(pos, erasure_thickness, img_to_rect(img))) {
 				if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)
 						|| IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-					ImageDrawCircle(&img.current, to_true_img_x(img, pos.x),
-							to_true_img_y(img, pos.y),
-							(erasure_thickness / scale) / (img.size.x / img.texture.width),
-							BLANK);
-					UpdateTexture(img.texture, img.current.data);
+					edit_selected_image((Hatori_ImageEdit) {
+							.type = EDIT_ERASE,
+							.pos = { (int)to_true_img_x(img, pos.x),
+									(int)to_true_img_y(img, pos.y) },
+							.amount = (int)((erasure_thickness / scale)
+									/ (img.size.x / img.current->width)),
+					});
 				}
 			}
 		}
@@ -1136,7 +2612,7 @@ void handle_input_erasure(void)
 								(Vector2) { to_screen_x(l.x0), to_screen_y(l.y0) },
 								(Vector2) { to_screen_x(l.x1), to_screen_y(l.y1) })
 						&& IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-					lines.items[i].deleted = true;
+					do_op(OP_LINE_DELETE, i, NULL, 0);
 				}
 			}
 		}
@@ -1165,10 +2641,11 @@ void handle_input_resizer(void)
 	if (resizer.selected != -1 && is_mouse_moving()) {
 		if (is_image_selected()) {
 			if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-				entities.items[selected_entity].entity.image.size.x
-						+= (cursor_x - prev_cursor_x) / scale;
-				entities.items[selected_entity].entity.image.size.y
-						+= (cursor_y - prev_cursor_y) / scale;
+				Hatori_OpSize op
+						= { entities.items[selected_entity].entity.image.size, 0 };
+				op.size.x += (cursor_x - prev_cursor_x) / scale;
+				op.size.y += (cursor_y - prev_cursor_y) / scale;
+				do_op(OP_ENTITY_SIZE, selected_entity, &op, sizeof(op));
 
 				// if (entities.items[selected_entity].entity.image.size.x < 0) {
 				// 	entities.items[selected_entity].entity.image.pos.x
@@ -1189,8 +2666,10 @@ void handle_input_resizer(void)
 			}
 		} else if (is_text_selected()) {
 			if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-				entities.items[selected_entity].entity.text.font_size
-						+= (cursor_x - prev_cursor_x) * 0.50 / scale;
+				Hatori_OpSize op = { { 0 },
+					entities.items[selected_entity].entity.text.font_size };
+				op.font_size += (cursor_x - prev_cursor_x) * 0.50 / scale;
+				do_op(OP_ENTITY_SIZE, selected_entity, &op, sizeof(op));
 				prev_cursor_x = cursor_x;
 				prev_cursor_y = cursor_y;
 			} else {
@@ -1285,17 +2764,17 @@ void update_resizer(void)
 			};
 
 			resizer.tr = (Vector2) {
-				tl.x + txt.size.x + 2 * resizer.padding - resizer.side / 2,
+				tl.x + txt.size.x * scale + 2 * resizer.padding - resizer.side / 2,
 				tl.y - resizer.side / 2.0,
 			};
 
 			resizer.bl = (Vector2) {
 				tl.x - resizer.side / 2,
-				tl.y + txt.size.y + 2 * resizer.padding - resizer.side / 2,
+				tl.y + txt.size.y * scale + 2 * resizer.padding - resizer.side / 2,
 			};
 
 			resizer.br = (Vector2) {
-				tl.x + txt.size.x + 2 * resizer.padding - resizer.side / 2,
+				tl.x + txt.size.x * scale + 2 * resizer.padding - resizer.side / 2,
 				resizer.bl.y,
 			};
 		}
@@ -1312,8 +2791,8 @@ void draw_resizer(void)
 			DrawRectangleLinesEx(
 					(Rectangle) { to_screen_x(text.pos.x) - resizer.padding,
 							to_screen_y(text.pos.y) - resizer.padding,
-							text.size.x + 2 * resizer.padding,
-							text.size.y + 2 * resizer.padding },
+							text.size.x * scale + 2 * resizer.padding,
+							text.size.y * scale + 2 * resizer.padding },
 					resizer.thickness, PURPLE);
 		} else if (entities.items[selected_entity].type == ENTITY_IMAGE) {
 			Hatori_Image img = entities.items[selected_entity].entity.image;
@@ -1350,8 +2829,9 @@ void flood_remove(Image* img, Vector2 pos, int diff)
 	int width = img->width;
 	Color color = ((Color*)img->data)[(int)((int)pos.y * width + (int)pos.x)];
 
-	List(Vector2) stack;
-	list_init(&stack, 10);
+	Arena* scratch = scratch_arena();
+	Arena_Mark mark = arena_mark(scratch);
+	List(Vector2) stack = { .arena = scratch };
 	list_append(&stack, pos);
 
 	while (stack.count > 0) {
@@ -1378,18 +2858,63 @@ void flood_remove(Image* img, Vector2 pos, int diff)
 			list_append(&stack, ((Vector2) { curr_pos.x - 1, curr_pos.y })); // left
 		}
 	}
+	release_scratch(scratch, mark);
+}
+
+size_t kernel_grain(int width)
+{
+	return width > 0 && width < KERNEL_GRAIN_PIXELS
+			? KERNEL_GRAIN_PIXELS / width
+			: 1;
 }
 
 void erode_image(Image* img)
 {
-	int width = img->width;
-	int height = img->height;
-	Color* pixels = (Color*)img->data;
+	if (img->width < 3 || img->height < 3) {
+		return;
+	}
 	Color* eroded_pixels = LoadImageColors(*img);
 	if (!eroded_pixels) {
 		printf("Error allocating memory for eroded image\n");
 		return;
 	}
+	Hatori_Kernel k = { *img, *img };
+	k.dst.data = eroded_pixels;
+	jobs_parallel_for(
+			&jobs, img->height - 2, kernel_grain(img->width), erode_rows, &k);
+	memcpy(img->data, eroded_pixels, (size_t)img->width * img->height * 4);
+	RL_FREE(eroded_pixels);
+}
+
+// Scratch memory of the calling thread: `frame_arena` on the main thread and
+// one of its own on each worker, so a job gives back what it takes with
+// release_scratch().
+Arena* scratch_arena(void)
+{
+	static _Thread_local Arena worker_arena;
+	return job_thread > 0 ? &worker_arena : &frame_arena;
+}
+
+// Frees what was taken from `scratch` since `mark`. A worker's arena is
+// trimmed like `frame_arena` at the end of a frame once nothing is left in it,
+// so one large job doesn't keep its peak for the rest of the process.
+void release_scratch(Arena* scratch, Arena_Mark mark)
+{
+	arena_rewind(scratch, mark);
+	if (scratch != &frame_arena
+			&& (mark.block == NULL
+					|| (mark.block == scratch->first && mark.used == 0))) {
+		arena_reset(scratch);
+	}
+}
+
+// Rows `from` to `to` of the inner rows, the border is never eroded.
+void erode_rows(void* arg, size_t from, size_t to)
+{
+	Hatori_Kernel* k = arg;
+	int width = k->src.width;
+	Color* pixels = k->src.data;
+	Color* eroded_pixels = k->dst.data;
 	int kernel_width = 3;
 	int kernel_height = 3;
 	int kernel[9] = {
@@ -1403,12 +2928,9 @@ void erode_image(Image* img)
 		1,
 		0,
 	};
-	for (int i = 0; i < width * height; i++) {
-		eroded_pixels[i] = pixels[i];
-	}
 	int pad_w = kernel_width / 2;
 	int pad_h = kernel_height / 2;
-	for (int y = pad_h; y < height - pad_h; y++) {
+	for (int y = pad_h + from; y < pad_h + (int)to; y++) {
 		for (int x = pad_w; x < width - pad_w; x++) {
 			int erode = 0;
 
@@ -1433,10 +2955,6 @@ void erode_image(Image* img)
 			}
 		}
 	}
-	for (int i = 0; i < width * height; i++) {
-		pixels[i] = eroded_pixels[i];
-	}
-	RL_FREE(eroded_pixels);
 }
 
 void handle_color_removal(void)
@@ -1450,8 +2968,11 @@ void handle_color_removal(void)
 			rel_pos.x = (int)to_true_img_x(img, pos.x);
 			rel_pos.y = (int)to_true_img_y(img, pos.y);
 
-			flood_remove(&img.current, rel_pos, 30);
-			UpdateTexture(img.texture, img.current.data);
+			edit_selected_image((Hatori_ImageEdit) {
+					.type = EDIT_FLOOD,
+					.pos = rel_pos,
+					.amount = 30,
+			});
 		} else {
 			if (!CheckCollisionPointRec(pos,
 							(Rectangle) { img_controls.pos.x, img_controls.pos.y,
@@ -1467,26 +2988,25 @@ void hatori_print_image(Hatori_Image img)
 {
 	printf("pos: %f, %f\n", img.pos.x, img.pos.y);
 	printf("size: %f, %f\n", img.size.x, img.size.y);
-	printf("texture:\n");
-	printf("\tid: %d\n", img.texture.id);
-	printf("\twidth: %d\n", img.texture.width);
-	printf("\theight: %d\n", img.texture.height);
-	printf("\tmipmaps: %d\n", img.texture.mipmaps);
-	printf("\tformat: %d\n", img.texture.format);
-	printf("original: %p\n", img.original);
-	printf("current: %p\n", img.current);
+	printf("pixels:\n");
+	printf("\twidth: %d\n", img.current->width);
+	printf("\theight: %d\n", img.current->height);
+	printf("\trefs: %d\n", img.current->refs);
+	printf("\tlevels: %d\n", img.current->level_count);
+	printf("original: %p\n", (void*)img.original);
+	printf("current: %p\n", (void*)img.current);
 }
 
 float to_true_img_x(Hatori_Image img, float x)
 {
 	return ((x - to_screen_x(img.pos.x)) / scale)
-			/ (img.size.x / img.texture.width);
+			/ (img.size.x / img.current->width);
 }
 
 float to_true_img_y(Hatori_Image img, float y)
 {
 	return ((y - to_screen_y(img.pos.y)) / scale)
-			/ (img.size.y / img.texture.height);
+			/ (img.size.y / img.current->height);
 }
 
 Hatori_Text create_text()
@@ -1519,8 +3039,8 @@ Rectangle get_text_resizer_rect(Hatori_Text text)
 	Rectangle rect = (Rectangle) {
 		to_screen_x(text.pos.x) - resizer.padding - resizer.side / 2.0,
 		to_screen_y(text.pos.y) - resizer.padding - resizer.side / 2.0,
-		text.size.x + 2 * resizer.padding + resizer.side,
-		text.size.y + 2 * resizer.padding + resizer.side,
+		text.size.x * scale + 2 * resizer.padding + resizer.side,
+		text.size.y * scale + 2 * resizer.padding + resizer.side,
 	};
 	return rect;
 }
@@ -1542,8 +3062,8 @@ Rectangle get_resizer_rect(U64 i)
 		return (Rectangle) {
 			to_screen_x(text.pos.x) - resizer.padding - resizer.side / 2.0,
 			to_screen_y(text.pos.y) - resizer.padding - resizer.side / 2.0,
-			text.size.x + 2 * resizer.padding + resizer.side,
-			text.size.y + 2 * resizer.padding + resizer.side,
+			text.size.x * scale + 2 * resizer.padding + resizer.side,
+			text.size.y * scale + 2 * resizer.padding + resizer.side,
 		};
 	}
 	return rect;
@@ -1650,161 +3170,3452 @@ void handle_mouse_input_entities(void)
 void update_entities(void)
 {
 	if (selected_entity != -1 && mode == MOVE_OBJECT_MODE) {
+		Vector2 pos = { 0 };
 		if (entities.items[selected_entity].type == ENTITY_TEXT) {
-			entities.items[selected_entity].entity.text.pos.x
-					+= (cursor_x - prev_cursor_x) / scale;
-			entities.items[selected_entity].entity.text.pos.y
-					+= (cursor_y - prev_cursor_y) / scale;
+			pos = entities.items[selected_entity].entity.text.pos;
 		} else if (entities.items[selected_entity].type == ENTITY_IMAGE) {
-			entities.items[selected_entity].entity.image.pos.x
-					+= (cursor_x - prev_cursor_x) / scale;
-			entities.items[selected_entity].entity.image.pos.y
-					+= (cursor_y - prev_cursor_y) / scale;
+			pos = entities.items[selected_entity].entity.image.pos;
+		}
+		if (is_mouse_moving()) {
+			pos.x += (cursor_x - prev_cursor_x) / scale;
+			pos.y += (cursor_y - prev_cursor_y) / scale;
+			do_op(OP_ENTITY_POS, selected_entity, &pos, sizeof(pos));
 		}
 		prev_cursor_x = cursor_x;
 		prev_cursor_y = cursor_y;
 	}
-	for (int i = entities.count - 1; i >= 0; --i) {
-		if (entities.items[i].type == ENTITY_TEXT) {
-			Hatori_Text txt = entities.items[i].entity.text;
-			entities.items[i].entity.text.size = MeasureTextEx(anton_font,
-					txt.text.items, (float)txt.font_size * scale, txt.spacing * scale);
-		}
-	}
 }
 
+// Text is measured in virtual units whenever it or its size changes, see
+// Hatori_Text.size.
+void measure_text(Hatori_Text* txt)
+{
+	txt->size = MeasureTextEx(anton_font,
+			txt->text.items != NULL ? txt->text.items : "", txt->font_size,
+			txt->spacing);
+}
+
+// Draws in virtual coordinates, between BeginMode2D(board_camera()) and
+// EndMode2D().
 void draw_entities(void)
 {
+	Rectangle clip = to_virtual_rect(draw_clip_rect());
+	float pad = 2 / scale;
+	clip = (Rectangle) { clip.x - pad, clip.y - pad, clip.width + pad * 2,
+		clip.height + pad * 2 };
 	for (int i = 0; i < entities.count; ++i) {
-		if (entities.items[i].deleted) {
+		if (entities.items[i].deleted
+				|| !CheckCollisionRecs(entity_world_rect(entities.items[i]), clip)) {
 			continue;
 		}
 		if (entities.items[i].type == ENTITY_TEXT) {
 			Hatori_Text txt = entities.items[i].entity.text;
-			DrawTextEx(anton_font, txt.text.items, to_screen(txt.pos),
-					txt.font_size * scale, txt.spacing * scale, WHITE);
+			DrawTextEx(anton_font, txt.text.items, txt.pos, txt.font_size,
+					txt.spacing, WHITE);
 		} else if (entities.items[i].type == ENTITY_IMAGE) {
 			Hatori_Image img = entities.items[i].entity.image;
-			DrawTexturePro(img.texture,
-					(Rectangle) {
-							0, 0, (float)img.texture.width, (float)img.texture.height },
-					(Rectangle) { to_screen_x(img.pos.x), to_screen_y(img.pos.y),
-							(int)img.size.x * scale, (int)img.size.y * scale },
-					(Vector2) { 0, 0 }, 0, WHITE);
+			if (img.current == NULL) {
+				continue;
+			}
+			draw_pixels(img.current,
+					(Rectangle) { img.pos.x, img.pos.y, (int)img.size.x,
+							(int)img.size.y });
 		}
 	}
 }
 
-bool is_image_selected(void)
+Rectangle draw_clip_rect(void)
 {
-	return selected_entity != -1
-			&& entities.items[selected_entity].type == ENTITY_IMAGE;
+	if (draw_clip.width > 0) {
+		return draw_clip;
+	}
+	return (Rectangle) { 0, 0, (float)GetScreenWidth(), (float)GetScreenHeight() };
 }
 
-bool is_text_selected(void)
+Rectangle entity_world_rect(Hatori_Entity e)
 {
-	return selected_entity != -1
-			&& entities.items[selected_entity].type == ENTITY_TEXT;
+	if (e.type == ENTITY_IMAGE) {
+		return (Rectangle) { e.entity.image.pos.x, e.entity.image.pos.y,
+			e.entity.image.size.x, e.entity.image.size.y };
+	}
+	Hatori_Text txt = e.entity.text;
+	Vector2 size = txt.size;
+	// Glyphs are rasterized per zoom and may spill a little past the
+	// measured box.
+	float pad = txt.font_size * 0.1f;
+	return (Rectangle) { txt.pos.x - pad, txt.pos.y - pad, size.x + pad * 2,
+		size.y + pad * 2 };
 }
 
-void handle_key_input_entities(void)
+Rectangle line_world_rect(Hatori_Line l)
 {
-	if (is_image_selected()) { }
-	if (is_text_selected()) {
-		if ((IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE))
-				&& entities.items[selected_entity].entity.text.text.count > 0) {
-			entities.items[selected_entity].entity.text.text.count--;
-			int count = entities.items[selected_entity].entity.text.text.count;
-			entities.items[selected_entity].entity.text.text.items[count] = '\0';
-			return;
+	return (Rectangle) { fminf(l.x0, l.x1), fminf(l.y0, l.y1),
+		fabsf(l.x1 - l.x0), fabsf(l.y1 - l.y0) };
+}
+
+// Marks cached tiles overlapping `world` for redraw, at every zoom. `margin`
+// is in screen pixels, for strokes whose thickness doesn't scale.
+void invalidate_board(Rectangle world, float margin)
+{
+	float size = BOARD_CACHE_TILE;
+	for (size_t i = 0; i < board_cache.count; ++i) {
+		Hatori_CacheTile* t = &board_cache.items[i];
+		Rectangle r = { world.x * t->scale - margin, world.y * t->scale - margin,
+			world.width * t->scale + margin * 2,
+			world.height * t->scale + margin * 2 };
+		if (CheckCollisionRecs(
+						r, (Rectangle) { t->x * size, t->y * size, size, size })) {
+			t->stale = true;
 		}
-		if (IsKeyPressed(KEY_ENTER)) {
-			list_append(&entities.items[selected_entity].entity.text.text, '\n');
-			return;
+	}
+}
+
+void invalidate_entity(U64 i)
+{
+	if (i < entities.count && !entities.items[i].deleted) {
+		invalidate_board(entity_world_rect(entities.items[i]), 2);
+	}
+}
+
+void invalidate_line(U64 i)
+{
+	if (i < lines.count) {
+		invalidate_board(
+				line_world_rect(lines.items[i]), lines.items[i].thickness + 2);
+	}
+}
+
+// Marks what `op` changes for redraw. apply_op() calls it before and after
+// applying, so both where things were and where they end up are covered.
+// Pixel edits mark their own area through pixels_changed().
+void invalidate_op(U32 op, U32 key, const U8* payload, U32 size)
+{
+	switch (op) {
+	case OP_LINE_ADD:
+		for (U32 i = 0; i + sizeof(Hatori_BoardLine) <= size;
+				i += sizeof(Hatori_BoardLine)) {
+			Hatori_BoardLine bl;
+			memcpy(&bl, payload + i, sizeof(bl));
+			invalidate_board(
+					line_world_rect((Hatori_Line) { bl.x0, bl.y0, bl.x1, bl.y1 }),
+					bl.thickness + 2);
 		}
-		if (IsKeyPressed(KEY_TAB)) {
-			list_append(&entities.items[selected_entity].entity.text.text, '\t');
-			return;
+		break;
+	case OP_LINE_DELETE:
+	case OP_LINE_RESTORE:
+		invalidate_line(key);
+		break;
+	case OP_LINES_CLEAR:
+		for (size_t i = key; i < lines.count; ++i) {
+			invalidate_line(i);
+		}
+		break;
+	case OP_ENTITY_SWAP: {
+		Hatori_OpSwap swap;
+		if (size == sizeof(swap)) {
+			memcpy(&swap, payload, sizeof(swap));
+			invalidate_entity(swap.other);
 		}
-		char key = GetCharPressed();
-		if (key != 0
-				&& entities.items[selected_entity].entity.text.text.count < 100) {
-			list_append(&entities.items[selected_entity].entity.text.text, key);
+		invalidate_entity(key);
+	} break;
+	case OP_TEXT_ADD:
+	case OP_IMAGE_ADD:
+	case OP_IMAGE_COPY:
+		if (entities.count > 0) {
+			invalidate_entity(entities.count - 1);
 		}
+		break;
+	case OP_IMAGE_EDIT:
+	case OP_IMAGE_TILES:
+		break;
+	default:
+		invalidate_entity(key);
+		break;
 	}
 }
 
-Hatori_Controls create_text_controls()
+void clear_board_cache(void)
 {
-	Hatori_Controls controls = { 0 };
-	controls.pad = 10;
-	controls.side = 18;
-	controls.selected = -1;
-	controls.hovered = -1;
-	controls.show = false;
-
-	list_init(&controls.buttons, 4);
+	for (size_t i = 0; i < board_cache.count; ++i) {
+		unload_board_tile(&board_cache.items[i]);
+	}
+	list_clear(&board_cache);
+	map_clear(&board_cache_index);
+}
 
-	Texture2D bin = LoadTexture("assets/bin.png");
-	Texture2D up = LoadTexture("assets/up.png");
-	Texture2D down = LoadTexture("assets/down.png");
-	Texture2D copy = LoadTexture("assets/copy.png");
-	Texture2D save = LoadTexture("assets/save.png");
+// The zoom level closest to the zoom, exactly 1 at 1.
+float board_cache_scale(void)
+{
+	float level = roundf(logf(scale) / logf(BOARD_CACHE_ZOOM_STEP));
+	return powf(BOARD_CACHE_ZOOM_STEP, level);
+}
 
-	list_append(&controls.buttons, create_controls_btn(bin, bin_on_click));
-	list_append(&controls.buttons, create_controls_btn(up, front_on_click));
-	list_append(&controls.buttons, create_controls_btn(down, back_on_click));
-	list_append(&controls.buttons, create_controls_btn(copy, copy_on_click));
-	list_append(&controls.buttons, create_controls_btn(save, save_on_click));
+int find_board_tile(int x, int y)
+{
+	return map_get(&board_cache_index,
+			((Hatori_CacheKey) { x, y, board_cache_scale() }), -1);
+}
 
-	return controls;
+void render_board_tile(Hatori_CacheTile* t)
+{
+	float saved_x = offset_x;
+	float saved_y = offset_y;
+	float saved_scale = scale;
+	scale = t->scale;
+	offset_x = -t->x * BOARD_CACHE_TILE / scale;
+	offset_y = -t->y * BOARD_CACHE_TILE / scale;
+	draw_clip = (Rectangle) { 0, 0, BOARD_CACHE_TILE, BOARD_CACHE_TILE };
+	draw_incomplete = false;
+
+	BeginTextureMode(t->target);
+	ClearBackground(BLANK);
+	// Keep alpha right where things overlap nothing, the tile is then drawn
+	// premultiplied.
+	rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE,
+			RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+	BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+	BeginMode2D(board_camera());
+	PROFILE_CALL(draw_entities());
+	PROFILE_CALL(draw_lines());
+	EndMode2D();
+	EndBlendMode();
+	PROFILE_CALL(EndTextureMode());
+
+	offset_x = saved_x;
+	offset_y = saved_y;
+	scale = saved_scale;
+	draw_clip = (Rectangle) { 0 };
+	t->stale = false;
+	t->incomplete = draw_incomplete;
 }
 
-void update_text_controls(void)
+// Tile coordinates of the first and last cached tiles on screen, at the
+// current zoom level.
+void board_tiles_in_view(int* x0, int* y0, int* x1, int* y1)
 {
-	if (is_text_selected()) {
-		text_controls.show = true;
-		Hatori_Text text = entities.items[selected_entity].entity.text;
-		text_controls.pos.x = to_screen_x(text.pos.x);
-		text_controls.pos.y = to_screen_y(text.pos.y) - text_controls.side
-				- text_controls.pad - resizer.padding;
+	float size = BOARD_CACHE_TILE / board_cache_scale(); // in world units
+	*x0 = floorf(-offset_x / size);
+	*y0 = floorf(-offset_y / size);
+	*x1 = floorf((GetScreenWidth() / scale - offset_x) / size);
+	*y1 = floorf((GetScreenHeight() / scale - offset_y) / size);
+}
 
-		text_controls.size.x = ((text_controls.side + text_controls.pad)
-				* text_controls.buttons.count);
-		text_controls.size.y = (text_controls.side + text_controls.pad);
+// The view and its prefetch ring, at this level and the one zoomed from.
+int board_cache_capacity(void)
+{
+	int x0, y0, x1, y1;
+	board_tiles_in_view(&x0, &y0, &x1, &y1);
+	int tiles = 2 * (x1 - x0 + 3) * (y1 - y0 + 3);
+	return tiles > BOARD_CACHE_TILES ? tiles : BOARD_CACHE_TILES;
+}
 
-		for (size_t i = 0; i < text_controls.buttons.count; ++i) {
-			text_controls.buttons.items[i].pos.x = text_controls.pos.x
-					+ (text_controls.side + text_controls.pad) * i
-					+ text_controls.pad / 2;
-			text_controls.buttons.items[i].pos.y
-					= text_controls.pos.y + text_controls.pad / 2;
-			text_controls.buttons.items[i].size.x = text_controls.side;
-			text_controls.buttons.items[i].size.y = text_controls.side;
-		}
-	} else {
-		text_controls.show = false;
+// Adds a stale tile at the current zoom level, -1 when out of GPU memory.
+int add_board_tile(int x, int y)
+{
+	RenderTexture2D target
+			= LoadRenderTexture(BOARD_CACHE_TILE, BOARD_CACHE_TILE);
+	if (target.id == 0) {
+		return -1;
 	}
+	// Stretched between zoom levels.
+	SetTextureFilter(target.texture, TEXTURE_FILTER_BILINEAR);
+	texture_bytes += BOARD_CACHE_TILE_BYTES;
+	float level = board_cache_scale();
+	list_append(&board_cache,
+			((Hatori_CacheTile) { target, level, x, y, 0, true }));
+	int i = board_cache.count - 1;
+	map_put(&board_cache_index, ((Hatori_CacheKey) { x, y, level }), i);
+	return i;
 }
 
-void add_image(char* file_type, U8* data, int size)
+// Draws every tile in view that is missing or stale for the current zoom,
+// for up to BOARD_CACHE_BUDGET_MS. Returns false when some are left, the
+// board is then drawn directly for this frame and the rest next frame.
+bool update_board_cache(void)
 {
-	Image img = LoadImageFromMemory(file_type, data, size);
-	ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
-	Texture2D texture = LoadTextureFromImage(img);
-
-	Hatori_Image himg = { 0 };
-	himg.pos.x = to_virtual_x(GetScreenWidth() / 2.0);
-	himg.pos.y = to_virtual_y(GetScreenHeight() / 2.0);
-	himg.size.x = img.width;
-	himg.size.y = img.height;
-	himg.texture = texture;
-	himg.original = img;
-	himg.current = ImageCopy(img);
-
-	Hatori_Entity e = { 0 };
+	double until = GetTime() + BOARD_CACHE_BUDGET_MS / 1000.0;
+	int x0, y0, x1, y1;
+	board_tiles_in_view(&x0, &y0, &x1, &y1);
+	bool ready = true;
+	for (int y = y0; y <= y1; ++y) {
+		for (int x = x0; x <= x1; ++x) {
+			int i = find_board_tile(x, y);
+			bool out_of_time = GetTime() >= until;
+			if (i < 0) {
+				if (out_of_time) {
+					ready = false;
+					continue;
+				}
+				i = add_board_tile(x, y);
+				if (i < 0) {
+					ready = false;
+					continue;
+				}
+			}
+			Hatori_CacheTile* t = &board_cache.items[i];
+			t->last_used = frame;
+			if (t->stale && out_of_time) {
+				ready = false;
+			} else if (t->stale
+					|| (t->incomplete && upload_queue.count == 0 && !out_of_time)) {
+				render_board_tile(t);
+			}
+		}
+	}
+	size_t capacity = board_cache_capacity();
+	if (board_cache.count > capacity) {
+		evict_board_tiles(board_cache.count - capacity);
+	}
+	if (!ready) {
+		request_redraw();
+	}
+	return ready;
+}
+
+// Finds a tile in the ring just outside the view that is missing or stale,
+// for panning to find it ready. Nothing is prefetched when the view and the
+// ring wouldn't all fit in the cache.
+static int compare_last_used(const void* a, const void* b)
+{
+	U64 x = (*(Hatori_CacheTile* const*)a)->last_used;
+	U64 y = (*(Hatori_CacheTile* const*)b)->last_used;
+	return x < y ? -1 : x > y;
+}
+
+// Unloads up to `count` of the least recently shown tiles, never one shown
+// this frame.
+void evict_board_tiles(size_t count)
+{
+	List(Hatori_CacheTile*) candidates = { .arena = &frame_arena };
+	for (size_t i = 0; i < board_cache.count; ++i) {
+		if (board_cache.items[i].last_used < frame) {
+			list_append(&candidates, &board_cache.items[i]);
+		}
+	}
+	qsort(candidates.items, candidates.count, sizeof(*candidates.items),
+			compare_last_used);
+	for (size_t i = 0; i < count && i < candidates.count; ++i) {
+		unload_board_tile(candidates.items[i]);
+	}
+	compact_board_cache();
+}
+
+// Leaves the tile without a target, compact_board_cache() then drops it.
+void unload_board_tile(Hatori_CacheTile* t)
+{
+	if (t->target.id > 0) {
+		UnloadRenderTexture(t->target);
+		texture_bytes -= BOARD_CACHE_TILE_BYTES;
+		t->target = (RenderTexture2D) { 0 };
+	}
+}
+
+// Drops the tiles whose target was unloaded and moves the rest down.
+void compact_board_cache(void)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < board_cache.count; ++i) {
+		Hatori_CacheTile t = board_cache.items[i];
+		Hatori_CacheKey key = { t.x, t.y, t.scale };
+		if (t.target.id == 0) {
+			map_remove(&board_cache_index, key);
+			continue;
+		}
+		if (n < i) {
+			board_cache.items[n] = t;
+			map_put(&board_cache_index, key, n);
+		}
+		n++;
+	}
+	board_cache.count = n;
+}
+
+bool next_prefetch_tile(int* x, int* y)
+{
+	int x0, y0, x1, y1;
+	board_tiles_in_view(&x0, &y0, &x1, &y1);
+	x0--;
+	y0--;
+	x1++;
+	y1++;
+	if ((x1 - x0 + 1) * (y1 - y0 + 1) > board_cache_capacity()
+			|| texture_bytes + BOARD_CACHE_TILE_BYTES > texture_budget) {
+		return false;
+	}
+	for (int ty = y0; ty <= y1; ++ty) {
+		int step = ty == y0 || ty == y1 ? 1 : x1 - x0;
+		for (int tx = x0; tx <= x1; tx += step) {
+			int i = find_board_tile(tx, ty);
+			if (i < 0 || board_cache.items[i].stale) {
+				*x = tx;
+				*y = ty;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Idle task, draws one tile of the ring around the view.
+bool prefetch_board_tile(void* arg)
+{
+	int x, y;
+	if (!next_prefetch_tile(&x, &y)) {
+		return true;
+	}
+	int i = find_board_tile(x, y);
+	if (i < 0) {
+		i = add_board_tile(x, y);
+		if (i < 0) {
+			return true;
+		}
+	}
+	board_cache.items[i].last_used = frame;
+	render_board_tile(&board_cache.items[i]);
+	return false;
+}
+
+// Draws the images, text and strokes of the board, from the cache when
+// update_board_cache() got it ready.
+void draw_board(bool cached)
+{
+	if (!cached) {
+		BeginMode2D(board_camera());
+		PROFILE_CALL(draw_entities());
+		PROFILE_CALL(draw_lines());
+		EndMode2D();
+		return;
+	}
+	int x0, y0, x1, y1;
+	board_tiles_in_view(&x0, &y0, &x1, &y1);
+	// Screen pixels per tile, edges are rounded so neighbours meet.
+	float size = BOARD_CACHE_TILE * scale / board_cache_scale();
+	BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+	for (int y = y0; y <= y1; ++y) {
+		for (int x = x0; x <= x1; ++x) {
+			int i = find_board_tile(x, y);
+			if (i < 0) {
+				continue;
+			}
+			float left = roundf(x * size + offset_x * scale);
+			float top = roundf(y * size + offset_y * scale);
+			Rectangle dest = { left, top,
+				roundf((x + 1) * size + offset_x * scale) - left,
+				roundf((y + 1) * size + offset_y * scale) - top };
+			// Render textures are stored upside down.
+			DrawTexturePro(board_cache.items[i].target.texture,
+					(Rectangle) { 0, 0, BOARD_CACHE_TILE, -BOARD_CACHE_TILE }, dest,
+					(Vector2) { 0, 0 }, 0, WHITE);
+		}
+	}
+	EndBlendMode();
+}
+
+bool is_image_selected(void)
+{
+	return selected_entity != -1
+			&& entities.items[selected_entity].type == ENTITY_IMAGE;
+}
+
+bool is_text_selected(void)
+{
+	return selected_entity != -1
+			&& entities.items[selected_entity].type == ENTITY_TEXT;
+}
+
+void handle_key_input_entities(void)
+{
+	if (is_image_selected()) { }
+	if (is_text_selected()) {
+		static List(char) edit = { 0 };
+		Hatori_Text txt = entities.items[selected_entity].entity.text;
+		list_clear(&edit);
+		list_append_many(&edit, txt.text.items, txt.text.count);
+		if ((IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE))
+				&& edit.count > 0) {
+			edit.count--;
+		} else if (IsKeyPressed(KEY_ENTER)) {
+			list_append(&edit, '\n');
+		} else if (IsKeyPressed(KEY_TAB)) {
+			list_append(&edit, '\t');
+		} else {
+			char key = GetCharPressed();
+			if (key != 0 && input_log.file != NULL) {
+				replay_add_char(&input_frame, (U8)key);
+			}
+			if (key == 0 || edit.count >= 100) {
+				return;
+			}
+			list_append(&edit, key);
+		}
+		do_op(OP_TEXT_SET, selected_entity, edit.items, edit.count);
+	}
+}
+
+Hatori_Controls create_text_controls()
+{
+	Hatori_Controls controls = { 0 };
+	controls.pad = 10;
+	controls.side = 18;
+	controls.selected = -1;
+	controls.hovered = -1;
+	controls.show = false;
+
+	list_init(&controls.buttons, 4);
+
+	list_append(&controls.buttons,
+			create_controls_btn("assets/bin.png", bin_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/up.png", front_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/down.png", back_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/copy.png", copy_on_click));
+	list_append(&controls.buttons,
+			create_controls_btn("assets/save.png", save_on_click));
+
+	return controls;
+}
+
+void update_text_controls(void)
+{
+	if (is_text_selected()) {
+		text_controls.show = true;
+		Hatori_Text text = entities.items[selected_entity].entity.text;
+		text_controls.pos.x = to_screen_x(text.pos.x);
+		text_controls.pos.y = to_screen_y(text.pos.y) - text_controls.side
+				- text_controls.pad - resizer.padding;
+
+		text_controls.size.x = ((text_controls.side + text_controls.pad)
+				* text_controls.buttons.count);
+		text_controls.size.y = (text_controls.side + text_controls.pad);
+
+		for (size_t i = 0; i < text_controls.buttons.count; ++i) {
+			text_controls.buttons.items[i].pos.x = text_controls.pos.x
+					+ (text_controls.side + text_controls.pad) * i
+					+ text_controls.pad / 2;
+			text_controls.buttons.items[i].pos.y
+					= text_controls.pos.y + text_controls.pad / 2;
+			text_controls.buttons.items[i].size.x = text_controls.side;
+			text_controls.buttons.items[i].size.y = text_controls.side;
+		}
+	} else {
+		text_controls.show = false;
+	}
+}
+
+void add_image(char* file_type, U8* data, int size)
+{
+	add_image_bytes_async(file_type, data, size,
+			(Vector2) { to_virtual_x(GetScreenWidth() / 2.0),
+					to_virtual_y(GetScreenHeight() / 2.0) });
+}
+
+Image decode_blob_image(Hatori_Blob blob)
+{
+	Image img = { 0 };
+	qoi_desc desc = { 0 };
+	img.data = qoi_decode(blob.data, (int)blob.size, &desc, 4);
+	if (img.data == NULL) {
+		return img;
+	}
+	img.width = desc.width;
+	img.height = desc.height;
+	img.mipmaps = 1;
+	img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+	return img;
+}
+
+Hatori_Blob encode_image_blob(Image img)
+{
+	qoi_desc desc = {
+		.width = img.width,
+		.height = img.height,
+		.channels = 4,
+		.colorspace = QOI_SRGB,
+	};
+	int size = 0;
+	U8* data = qoi_encode(img.data, &desc, &size);
+	return (Hatori_Blob) { data, data == NULL ? 0 : (U32)size };
+}
+
+bool load_image_pixels(Hatori_Image* img)
+{
+	return img->current != NULL && pixels_load(img->current);
+}
+
+bool load_original_pixels(Hatori_Image* img)
+{
+	return img->original != NULL && pixels_load(img->original);
+}
+
+U64 hash_pixels(Image img)
+{
+	// FNV-1a, a word at a time.
+	const U8* data = img.data;
+	size_t size = (size_t)img.width * img.height * 4;
+	U64 hash = 0xcbf29ce484222325ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		U64 word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ull;
+	}
+	for (; i < size; ++i) {
+		hash = (hash ^ data[i]) * 0x100000001b3ull;
+	}
+	return hash == 0 ? 1 : hash;
+}
+
+// Takes ownership of `img`, which must be RGBA8.
+Hatori_Pixels* pixels_from_image(Image img)
+{
+	if (img.data == NULL) {
+		return NULL;
+	}
+	return pixels_from_hashed_image(img, hash_pixels(img));
+}
+
+// Like pixels_from_image() with the hash_pixels() of `img` already known.
+Hatori_Pixels* pixels_from_hashed_image(Image img, U64 hash)
+{
+	if (img.data == NULL) {
+		return NULL;
+	}
+	size_t bytes = (size_t)img.width * img.height * 4;
+	Hatori_Pixels* same = map_get(&pixels_by_hash, hash, NULL);
+	if (same != NULL && same->width == img.width && same->height == img.height
+			&& pixels_load(same)
+			&& memcmp(same->image.data, img.data, bytes) == 0) {
+		UnloadImage(img);
+		return pixels_retain(same);
+	}
+	Hatori_Pixels* p = pool_alloc(&pixels_objects);
+	p->refs = 1;
+	p->width = img.width;
+	p->height = img.height;
+	pixels_set_hash(p, hash);
+	p->image = img;
+	list_append(&pixels_pool, p);
+	return p;
+}
+
+// Pixels that get decoded from `blob` the first time they are needed.
+Hatori_Pixels* pixels_from_blob(Hatori_Blob blob, bool owned)
+{
+	// The 14 byte QOI header: the magic, width and height big endian, channels
+	// and colorspace, then at least the 8 byte end marker. The size is only
+	// trusted when qoi_decode() would accept it, a corrupt board file must not
+	// drive the allocations.
+	if (blob.data == NULL || blob.size < 14 + 8) {
+		return NULL;
+	}
+	const U8* b = blob.data;
+	U32 width = (U32)b[4] << 24 | (U32)b[5] << 16 | (U32)b[6] << 8 | b[7];
+	U32 height = (U32)b[8] << 24 | (U32)b[9] << 16 | (U32)b[10] << 8 | b[11];
+	if (memcmp(b, "qoif", 4) != 0 || width == 0 || height == 0
+			|| height >= QOI_MAX_PIXELS / width || (b[12] != 3 && b[12] != 4)
+			|| b[13] > 1) {
+		TraceLog(LOG_WARNING, "PIXELS: Blob of %u bytes is not a QOI image",
+				blob.size);
+		return NULL;
+	}
+	Hatori_Pixels* p = pool_alloc(&pixels_objects);
+	p->refs = 1;
+	p->width = (int)width;
+	p->height = (int)height;
+	p->blob = blob;
+	p->owns_blob = owned;
+	list_append(&pixels_pool, p);
+	return p;
+}
+
+// Keeps `pixels_by_hash` pointing at one of the buffers with each hash.
+void pixels_set_hash(Hatori_Pixels* p, U64 hash)
+{
+	if (p->hash != 0 && map_get(&pixels_by_hash, p->hash, NULL) == p) {
+		map_remove(&pixels_by_hash, p->hash);
+	}
+	p->hash = hash;
+	if (hash != 0 && !map_has(&pixels_by_hash, hash)) {
+		map_put(&pixels_by_hash, hash, p);
+	}
+}
+
+Hatori_Pixels* pixels_retain(Hatori_Pixels* p)
+{
+	if (p != NULL) {
+		p->refs++;
+	}
+	return p;
+}
+
+void pixels_release(Hatori_Pixels* p)
+{
+	if (p == NULL || --p->refs > 0) {
+		return;
+	}
+	pixels_unload_levels(p);
+	UnloadImage(p->image);
+	if (p->owns_blob) {
+		RL_FREE((void*)p->blob.data);
+	}
+	pixels_set_hash(p, 0);
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		if (pixels_pool.items[i] == p) {
+			pixels_pool.items[i] = pixels_pool.items[--pixels_pool.count];
+			break;
+		}
+	}
+	pool_free(&pixels_objects, p);
+}
+
+bool pixels_load(Hatori_Pixels* p)
+{
+	if (p->image.data != NULL) {
+		return true;
+	}
+	if (p->blob.data == NULL) {
+		return false;
+	}
+	U64 hash = 0;
+	if (p->decode_queued) {
+		job_wait(&jobs, &p->decoding);
+		p->decode_queued = false;
+		p->image = p->decoded;
+		p->decoded = (Image) { 0 };
+		hash = p->decoded_hash;
+	} else {
+		U64 decode_start = profile_now();
+		p->image = decode_blob_image(p->blob);
+		profile_record(
+				&profiler, "decode_blob_image()", decode_start, profile_now());
+		hash = p->image.data != NULL ? hash_pixels(p->image) : 0;
+	}
+	if (p->image.data == NULL) {
+		TraceLog(LOG_WARNING, "BOARD: Failed to decode image pixels");
+		if (p->owns_blob) {
+			RL_FREE((void*)p->blob.data);
+		}
+		p->blob = (Hatori_Blob) { 0 };
+		p->owns_blob = false;
+		return false;
+	}
+	pixels_set_hash(p, hash);
+	return true;
+}
+
+// Like pixels_load() but decodes on a worker, false until that is done.
+bool pixels_load_async(Hatori_Pixels* p)
+{
+	if (p->image.data != NULL || p->blob.data == NULL) {
+		return p->image.data != NULL;
+	}
+	if (!p->decode_queued) {
+		p->decode_queued = true;
+		jobs_spawn(&jobs, &p->decoding, decode_pixels_job, pixels_retain(p));
+	}
+	// Without workers the job already ran.
+	return atomic_load(&p->decoding.pending) == 0 && pixels_load(p);
+}
+
+// Only reads `blob`, which stays put while the job holds a reference.
+void decode_pixels_job(void* arg)
+{
+	Hatori_Pixels* p = arg;
+	U64 start = profile_now();
+	p->decoded = decode_blob_image(p->blob);
+	p->decoded_hash = p->decoded.data != NULL ? hash_pixels(p->decoded) : 0;
+	profile_record(&profiler, "decode_pixels_job()", start, profile_now());
+	jobs_complete(&jobs, decoded_pixels, p);
+}
+
+void decoded_pixels(void* arg)
+{
+	Hatori_Pixels* p = arg;
+	pixels_load(p);
+	pixels_release(p);
+	request_redraw();
+}
+
+// Gives `p` QOI bytes that stay until it is edited, encoded on a worker.
+// False until that is done. The job holds a reference, so edits meanwhile
+// copy the pixels first instead of changing what it reads.
+bool pixels_encode_async(Hatori_Pixels* p)
+{
+	if (p->blob.data != NULL || (p->image.data == NULL && !p->encode_queued)) {
+		return p->blob.data != NULL;
+	}
+	if (!p->encode_queued) {
+		p->encode_queued = true;
+		jobs_spawn(&jobs, &p->encoding, encode_pixels_job, pixels_retain(p));
+	}
+	return atomic_load(&p->encoding.pending) == 0 && pixels_finish_encode(p);
+}
+
+// Waits for the job pixels_encode_async() queued, if any, and takes its bytes.
+bool pixels_finish_encode(Hatori_Pixels* p)
+{
+	if (p->encode_queued) {
+		job_wait(&jobs, &p->encoding);
+		p->encode_queued = false;
+		if (p->blob.data == NULL) {
+			p->blob = p->encoded;
+			p->owns_blob = p->encoded.data != NULL;
+		} else {
+			RL_FREE((void*)p->encoded.data);
+		}
+		p->encoded = (Hatori_Blob) { 0 };
+	}
+	return p->blob.data != NULL;
+}
+
+void encode_pixels_job(void* arg)
+{
+	Hatori_Pixels* p = arg;
+	U64 start = profile_now();
+	p->encoded = encode_image_blob(p->image);
+	profile_record(&profiler, "encode_pixels_job()", start, profile_now());
+	jobs_complete(&jobs, encoded_pixels, p);
+}
+
+void encoded_pixels(void* arg)
+{
+	Hatori_Pixels* p = arg;
+	bool encoded = pixels_finish_encode(p);
+	pixels_release(p);
+	// Originals no image shows can be unloaded now.
+	if (encoded) {
+		compress_originals();
+	}
+}
+
+// Smallest rectangle holding both, empty rectangles have no width.
+Rectangle rect_union(Rectangle a, Rectangle b)
+{
+	if (a.width <= 0 || a.height <= 0) {
+		return b;
+	}
+	if (b.width <= 0 || b.height <= 0) {
+		return a;
+	}
+	float x = fminf(a.x, b.x);
+	float y = fminf(a.y, b.y);
+	return (Rectangle) { x, y, fmaxf(a.x + a.width, b.x + b.width) - x,
+		fmaxf(a.y + a.height, b.y + b.height) - y };
+}
+
+// Halves `area` of the level above into `dst` with an alpha weighted 2x2 box
+// filter, so transparent pixels don't darken the edges around them.
+void downsample_image(Image src, Image dst, Rectangle area)
+{
+	Hatori_Kernel k = { src, dst, area };
+	jobs_parallel_for(&jobs, area.height > 0 ? area.height : 0,
+			kernel_grain(area.width), downsample_rows, &k);
+}
+
+void downsample_rows(void* arg, size_t from, size_t to)
+{
+	Hatori_Kernel* k = arg;
+	Image src = k->src;
+	Image dst = k->dst;
+	Rectangle area = k->area;
+	const U8* in = src.data;
+	U8* out = dst.data;
+	for (int y = area.y + from; y < area.y + to; ++y) {
+		int y0 = y * 2;
+		int y1 = y0 + 1 < src.height ? y0 + 1 : y0;
+		for (int x = area.x; x < area.x + area.width; ++x) {
+			int x0 = x * 2;
+			int x1 = x0 + 1 < src.width ? x0 + 1 : x0;
+			const U8* c[4] = {
+				in + ((size_t)y0 * src.width + x0) * 4,
+				in + ((size_t)y0 * src.width + x1) * 4,
+				in + ((size_t)y1 * src.width + x0) * 4,
+				in + ((size_t)y1 * src.width + x1) * 4,
+			};
+			U32 r = 0, g = 0, b = 0, a = 0;
+			for (int i = 0; i < 4; ++i) {
+				r += c[i][0] * c[i][3];
+				g += c[i][1] * c[i][3];
+				b += c[i][2] * c[i][3];
+				a += c[i][3];
+			}
+			U8* o = out + ((size_t)y * dst.width + x) * 4;
+			if (a == 0) {
+				memset(o, 0, 4);
+				continue;
+			}
+			o[0] = (r + a / 2) / a;
+			o[1] = (g + a / 2) / a;
+			o[2] = (b + a / 2) / a;
+			o[3] = (a + 2) / 4;
+		}
+	}
+}
+
+int pixels_level_count(Hatori_Pixels* p)
+{
+	if (p->level_count == 0) {
+		int w = p->width, h = p->height;
+		p->level_count = 1;
+		while (p->level_count < PIXELS_MAX_LEVELS
+				&& (w > PIXELS_PROXY_SIZE || h > PIXELS_PROXY_SIZE)) {
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+			p->level_count++;
+		}
+	}
+	return p->level_count;
+}
+
+// Pixels of pyramid level `level`, built from the level above on first use
+// and rebuilt where they went stale after an edit.
+Image* pixels_level(Hatori_Pixels* p, int level)
+{
+	if (!pixels_load(p)) {
+		return NULL;
+	}
+	if (level >= pixels_level_count(p)) {
+		level = p->level_count - 1;
+	}
+	p->levels[0].image = p->image;
+	if (level == 0) {
+		return &p->image;
+	}
+	Hatori_Level* l = &p->levels[level];
+	if (l->image.data != NULL && l->dirty.width <= 0) {
+		return &l->image;
+	}
+	Image* above = pixels_level(p, level - 1);
+	if (above == NULL) {
+		return NULL;
+	}
+	if (l->image.data == NULL) {
+		l->image = GenImageColor(
+				(above->width + 1) / 2, (above->height + 1) / 2, BLANK);
+		l->dirty = (Rectangle) { 0, 0, l->image.width, l->image.height };
+	}
+	PROFILE_CALL(downsample_image(*above, l->image, l->dirty));
+	l->dirty = (Rectangle) { 0 };
+	return &l->image;
+}
+
+// Level whose pixels are closest to `width` screen pixels without being
+// smaller, so images are only ever minified.
+int pixels_pick_level(Hatori_Pixels* p, float width)
+{
+	int level = 0;
+	int w = p->width;
+	while (level + 1 < pixels_level_count(p) && (w + 1) / 2 >= width) {
+		w = (w + 1) / 2;
+		level++;
+	}
+	return level;
+}
+
+// Tiles are the unit of upload, culling and eviction, so images larger than
+// GL_MAX_TEXTURE_SIZE can be drawn and only what is on screen is resident.
+int pixels_tile_size(void)
+{
+	static int size = 0;
+	if (size == 0) {
+		GLint max = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max);
+		size = max > 0 && max - 2 < PIXELS_TILE_SIZE ? max - 2 : PIXELS_TILE_SIZE;
+	}
+	return size;
+}
+
+// Rows of `area` of `img` packed one after another.
+const U8* pack_image_area(Image img, Rectangle area)
+{
+	static List(U8) rows = { 0 };
+	if (area.x == 0 && area.width == img.width) {
+		return (const U8*)img.data + (size_t)area.y * img.width * 4;
+	}
+	size_t row = (size_t)area.width * 4;
+	list_clear(&rows);
+	list_reserve(&rows, row * (size_t)area.height);
+	for (int y = 0; y < area.height; ++y) {
+		memcpy(rows.items + y * row,
+				(U8*)img.data + (((size_t)area.y + y) * img.width + (size_t)area.x) * 4,
+				row);
+	}
+	return rows.items;
+}
+
+// Tile `tile` of `level`, its area grown by a pixel on every side so that
+// filtering across tile seams samples the right neighbours.
+Hatori_Tile* pixels_tile(Hatori_Pixels* p, int level, int tile)
+{
+	Hatori_Level* l = &p->levels[level];
+	if (l->tiles == NULL) {
+		int size = pixels_tile_size();
+		l->cols = (l->image.width + size - 1) / size;
+		l->rows = (l->image.height + size - 1) / size;
+		l->tiles = calloc((size_t)l->cols * l->rows, sizeof(*l->tiles));
+		assert(l->tiles != NULL && "Buy more RAM!!");
+		for (int i = 0; i < l->cols * l->rows; ++i) {
+			float x0 = fmaxf(i % l->cols * size - 1, 0);
+			float y0 = fmaxf(i / l->cols * size - 1, 0);
+			float x1 = fminf((i % l->cols + 1) * size + 1, l->image.width);
+			float y1 = fminf((i / l->cols + 1) * size + 1, l->image.height);
+			l->tiles[i].area = (Rectangle) { x0, y0, x1 - x0, y1 - y0 };
+		}
+	}
+	return &l->tiles[tile];
+}
+
+// Fully uploaded texture of a tile, or none while it is still streaming in.
+// Tiles small enough to fit in one chunk are uploaded on the spot, the proxy
+// level always is.
+Texture2D pixels_tile_texture(Hatori_Pixels* p, int level, int tile)
+{
+	Image* img = pixels_level(p, level);
+	if (img == NULL) {
+		return (Texture2D) { 0 };
+	}
+	Hatori_Tile* t = pixels_tile(p, level, tile);
+	t->last_drawn = frame;
+	if (t->texture.id == 0) {
+		bool now = t->area.width * t->area.height * 4 <= UPLOAD_CHUNK_BYTES;
+		Image part = {
+			.data = now ? (void*)pack_image_area(*img, t->area) : NULL,
+			.width = t->area.width,
+			.height = t->area.height,
+			.mipmaps = 1,
+			.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+		};
+		t->texture = LoadTextureFromImage(part);
+		texture_bytes += GetPixelDataSize(
+				t->texture.width, t->texture.height, t->texture.format);
+		t->upload = (Rectangle) { 0 };
+		t->loaded_rows = now ? part.height : 0;
+		if (!now && t->texture.id > 0) {
+			list_append(&upload_queue, ((Hatori_Upload) { p, level, t }));
+		}
+	}
+	if (t->loaded_rows < t->area.height) {
+		return (Texture2D) { 0 };
+	}
+	if (t->upload.width > 0) {
+		UpdateTextureRec(t->texture,
+				(Rectangle) { t->upload.x - t->area.x, t->upload.y - t->area.y,
+						t->upload.width, t->upload.height },
+				pack_image_area(*img, t->upload));
+		t->upload = (Rectangle) { 0 };
+	}
+	return t->texture;
+}
+
+// Streams queued tiles into their textures a chunk of rows at a time for at
+// most UPLOAD_BUDGET_MS, coarse levels first since they stand in for the
+// rest while it loads.
+void upload_textures(void)
+{
+	double until = GetTime() + UPLOAD_BUDGET_MS / 1000.0;
+	while (upload_queue.count > 0 && GetTime() < until) {
+		size_t next = 0;
+		for (size_t i = 1; i < upload_queue.count; ++i) {
+			if (upload_queue.items[i].level > upload_queue.items[next].level) {
+				next = i;
+			}
+		}
+		Hatori_Upload u = upload_queue.items[next];
+		Hatori_Tile* t = u.tile;
+		Image* img = pixels_level(u.pixels, u.level);
+		if (img == NULL) {
+			pixels_unload_texture(t);
+			continue;
+		}
+		int rows = UPLOAD_CHUNK_BYTES / ((int)t->area.width * 4);
+		if (rows < 1) {
+			rows = 1;
+		}
+		if (rows > t->area.height - t->loaded_rows) {
+			rows = t->area.height - t->loaded_rows;
+		}
+		UpdateTextureRec(t->texture,
+				(Rectangle) { 0, t->loaded_rows, t->area.width, rows },
+				pack_image_area(*img,
+						(Rectangle) { t->area.x, t->area.y + t->loaded_rows,
+								t->area.width, rows }));
+		t->loaded_rows += rows;
+		if (t->loaded_rows >= t->area.height) {
+			memmove(upload_queue.items + next, upload_queue.items + next + 1,
+					(upload_queue.count - next - 1) * sizeof(*upload_queue.items));
+			upload_queue.count--;
+		}
+	}
+	if (upload_queue.count > 0) {
+		request_redraw();
+	}
+}
+
+// Draws `part` of level `level`, in that level's pixels, as `p` stretched
+// over `dest`. Tiles that are still uploading are filled in from the level
+// below.
+void draw_level_area(
+		Hatori_Pixels* p, int level, Rectangle dest, Rectangle part)
+{
+	Image* img = pixels_level(p, level);
+	if (img == NULL) {
+		return;
+	}
+	Hatori_Level* l = &p->levels[level];
+	pixels_tile(p, level, 0);
+	float size = pixels_tile_size();
+	float sx = dest.width / img->width;
+	float sy = dest.height / img->height;
+	Rectangle clip = to_virtual_rect(draw_clip_rect());
+	Rectangle visible = { (clip.x - dest.x) / sx, (clip.y - dest.y) / sy,
+		clip.width / sx, clip.height / sy };
+	if (!CheckCollisionRecs(part, visible)) {
+		return;
+	}
+	part = GetCollisionRec(part, visible);
+	int col0 = floorf(part.x / size);
+	int row0 = floorf(part.y / size);
+	int col1 = fminf(ceilf((part.x + part.width) / size), l->cols);
+	int row1 = fminf(ceilf((part.y + part.height) / size), l->rows);
+	for (int row = row0; row < row1; ++row) {
+		for (int col = col0; col < col1; ++col) {
+			Rectangle r = GetCollisionRec(
+					part, (Rectangle) { col * size, row * size, size, size });
+			if (r.width <= 0 || r.height <= 0) {
+				continue;
+			}
+			int tile = row * l->cols + col;
+			Texture2D texture = pixels_tile_texture(p, level, tile);
+			if (texture.id == 0) {
+				draw_incomplete = true;
+				if (level + 1 < p->level_count) {
+					draw_level_area(p, level + 1, dest,
+							(Rectangle) { r.x / 2, r.y / 2, r.width / 2, r.height / 2 });
+				}
+				continue;
+			}
+			// Neighbouring tiles compute their shared edge the same way, so
+			// no seam opens between them.
+			Rectangle area = l->tiles[tile].area;
+			Rectangle to = { dest.x + r.x * sx, dest.y + r.y * sy, 0, 0 };
+			to.width = dest.x + (r.x + r.width) * sx - to.x;
+			to.height = dest.y + (r.y + r.height) * sy - to.y;
+			DrawTexturePro(texture,
+					(Rectangle) { r.x - area.x, r.y - area.y, r.width, r.height },
+					to, (Vector2) { 0, 0 }, 0, WHITE);
+		}
+	}
+}
+
+// Draws `p` stretched over `dest`, in virtual coordinates, from the level
+// that suits its size on screen. Tiles outside the screen are skipped.
+void draw_pixels(Hatori_Pixels* p, Rectangle dest)
+{
+	if (!pixels_load_async(p)) {
+		draw_incomplete = true;
+		return;
+	}
+	if (pixels_fit_atlas(p)) {
+		Rectangle source;
+		Texture2D texture = pixels_atlas_texture(p, &source);
+		if (texture.id > 0) {
+			DrawTexturePro(texture, source, dest, (Vector2) { 0, 0 }, 0, WHITE);
+		}
+		return;
+	}
+	int level = pixels_pick_level(p, dest.width * scale);
+	Image* img = pixels_level(p, level);
+	if (img == NULL || dest.width <= 0 || dest.height <= 0) {
+		return;
+	}
+	draw_level_area(
+			p, level, dest, (Rectangle) { 0, 0, img->width, img->height });
+}
+
+// Call after changing `area` of the pixels returned by edit_pixels(). Only
+// that part of each level is rebuilt and uploaded again, when next drawn.
+void pixels_changed(Hatori_Pixels* p, Rectangle area)
+{
+	for (size_t i = 0; i < entities.count; ++i) {
+		Hatori_Image img = entities.items[i].entity.image;
+		if (entities.items[i].type == ENTITY_IMAGE && img.current == p) {
+			float sx = img.size.x / p->width;
+			float sy = img.size.y / p->height;
+			invalidate_board((Rectangle) { img.pos.x + area.x * sx,
+									 img.pos.y + area.y * sy, area.width * sx,
+									 area.height * sy },
+					2);
+		}
+	}
+	float x0 = fmaxf(area.x, 0);
+	float y0 = fmaxf(area.y, 0);
+	float x1 = fminf(area.x + area.width, p->width);
+	float y1 = fminf(area.y + area.height, p->height);
+	if (p->atlas != NULL && x1 > x0 && y1 > y0) {
+		Rectangle r = { x0, y0, x1 - x0, y1 - y0 };
+		if (x0 == 0 || y0 == 0 || x1 == p->width || y1 == p->height) {
+			// The gutter copies the edges.
+			atlas_upload(p->atlas, p->atlas_rect, p->image);
+		} else {
+			UpdateTextureRec(p->atlas->texture,
+					(Rectangle) { p->atlas_rect.x + r.x, p->atlas_rect.y + r.y, r.width,
+							r.height },
+					pack_image_area(p->image, r));
+		}
+	}
+	for (int k = 0; k < p->level_count; ++k) {
+		if (x1 <= x0 || y1 <= y0) {
+			break;
+		}
+		Hatori_Level* l = &p->levels[k];
+		Rectangle r = { x0, y0, x1 - x0, y1 - y0 };
+		if (k > 0 && l->image.data != NULL) {
+			l->dirty = rect_union(l->dirty, r);
+		}
+		for (int i = 0; l->tiles != NULL && i < l->cols * l->rows; ++i) {
+			Hatori_Tile* t = &l->tiles[i];
+			if (t->texture.id > 0 && CheckCollisionRecs(t->area, r)) {
+				t->upload = rect_union(t->upload, GetCollisionRec(t->area, r));
+			}
+		}
+		x0 = floorf(x0 / 2);
+		y0 = floorf(y0 / 2);
+		x1 = ceilf(x1 / 2);
+		y1 = ceilf(y1 / 2);
+	}
+	request_redraw();
+}
+
+void pixels_unload_texture(Hatori_Tile* t)
+{
+	if (t->texture.id == 0) {
+		return;
+	}
+	texture_bytes -= GetPixelDataSize(
+			t->texture.width, t->texture.height, t->texture.format);
+	UnloadTexture(t->texture);
+	t->texture = (Texture2D) { 0 };
+	t->upload = (Rectangle) { 0 };
+	t->loaded_rows = 0;
+	for (size_t i = 0; i < upload_queue.count; ++i) {
+		if (upload_queue.items[i].tile == t) {
+			memmove(upload_queue.items + i, upload_queue.items + i + 1,
+					(upload_queue.count - i - 1) * sizeof(*upload_queue.items));
+			upload_queue.count--;
+			break;
+		}
+	}
+}
+
+// Drops every texture and every level but `image` itself.
+void pixels_unload_levels(Hatori_Pixels* p)
+{
+	atlas_remove(p);
+	for (int k = 0; k < p->level_count; ++k) {
+		Hatori_Level* l = &p->levels[k];
+		for (int i = 0; l->tiles != NULL && i < l->cols * l->rows; ++i) {
+			pixels_unload_texture(&l->tiles[i]);
+		}
+		free(l->tiles);
+		if (k > 0) {
+			UnloadImage(l->image);
+		}
+		*l = (Hatori_Level) { 0 };
+	}
+	p->level_count = 0;
+}
+
+static int compare_last_drawn(const void* a, const void* b)
+{
+	U64 x = (*(Hatori_Tile* const*)a)->last_drawn;
+	U64 y = (*(Hatori_Tile* const*)b)->last_drawn;
+	return x < y ? -1 : x > y;
+}
+
+// Unloads least recently drawn image and board cache tiles until they fit
+// `texture_budget`. Tiles drawn this frame are kept even when they alone
+// exceed it.
+void evict_textures(void)
+{
+	if (texture_bytes <= texture_budget) {
+		return;
+	}
+	List(Hatori_Tile*) candidates = { .arena = &frame_arena };
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		Hatori_Pixels* p = pixels_pool.items[i];
+		for (int k = 0; k < p->level_count; ++k) {
+			Hatori_Level* l = &p->levels[k];
+			for (int j = 0; l->tiles != NULL && j < l->cols * l->rows; ++j) {
+				if (l->tiles[j].texture.id > 0 && l->tiles[j].last_drawn < frame) {
+					list_append(&candidates, &l->tiles[j]);
+				}
+			}
+		}
+	}
+	qsort(candidates.items, candidates.count, sizeof(*candidates.items),
+			compare_last_drawn);
+	List(Hatori_CacheTile*) cached = { .arena = &frame_arena };
+	for (size_t i = 0; i < board_cache.count; ++i) {
+		if (board_cache.items[i].last_used < frame) {
+			list_append(&cached, &board_cache.items[i]);
+		}
+	}
+	qsort(cached.items, cached.count, sizeof(*cached.items), compare_last_used);
+	// Both lists are oldest first, the older of their heads goes.
+	size_t evicted = 0;
+	size_t dropped = 0;
+	while (texture_bytes > texture_budget
+			&& (evicted < candidates.count || dropped < cached.count)) {
+		if (dropped == cached.count
+				|| (evicted < candidates.count
+						&& candidates.items[evicted]->last_drawn
+								<= cached.items[dropped]->last_used)) {
+			pixels_unload_texture(candidates.items[evicted++]);
+		} else {
+			unload_board_tile(cached.items[dropped++]);
+		}
+	}
+	if (dropped > 0) {
+		compact_board_cache();
+	}
+	TraceLog(LOG_DEBUG,
+			"PIXELS: Evicted %zu tiles and %zu cache tiles, %.1f MB resident",
+			evicted, dropped, texture_bytes / 1048576.0);
+}
+
+bool pixels_fit_atlas(Hatori_Pixels* p)
+{
+	return p->width <= ATLAS_MAX_IMAGE && p->height <= ATLAS_MAX_IMAGE;
+}
+
+Hatori_Atlas* atlas_new(bool icons)
+{
+	Hatori_Atlas* a = calloc(1, sizeof(*a));
+	assert(a != NULL && "Buy more RAM!!");
+	Image blank = GenImageColor(ATLAS_SIZE, ATLAS_SIZE, BLANK);
+	a->texture = LoadTextureFromImage(blank);
+	UnloadImage(blank);
+	if (a->texture.id == 0) {
+		free(a);
+		return NULL;
+	}
+	texture_bytes += GetPixelDataSize(
+			a->texture.width, a->texture.height, a->texture.format);
+	stbrp_init_target(&a->packer, ATLAS_SIZE, ATLAS_SIZE, a->nodes, ATLAS_SIZE);
+	a->icons = icons;
+	list_append(&atlases, a);
+	return a;
+}
+
+// Finds room for `width` x `height` pixels plus a one pixel gutter, `rect`
+// receives where they go.
+bool atlas_place(Hatori_Atlas* a, int width, int height, Rectangle* rect)
+{
+	stbrp_rect r = { .w = width + 2, .h = height + 2 };
+	if (!stbrp_pack_rects(&a->packer, &r, 1)) {
+		return false;
+	}
+	*rect = (Rectangle) { r.x + 1, r.y + 1, width, height };
+	a->slots++;
+	a->area += r.w * r.h;
+	a->packed += r.w * r.h;
+	return true;
+}
+
+// Copies `img` into `rect` of the page and its edge pixels into the gutter
+// around it, so filtering at the edges doesn't pick up the neighbours.
+void atlas_upload(Hatori_Atlas* a, Rectangle rect, Image img)
+{
+	static List(U8) padded = { 0 };
+	int w = img.width;
+	int h = img.height;
+	size_t row = (size_t)(w + 2) * 4;
+	list_clear(&padded);
+	list_reserve(&padded, row * (h + 2));
+	for (int y = -1; y <= h; ++y) {
+		const U8* src = (const U8*)img.data
+				+ (size_t)(y < 0 ? 0 : y < h ? y : h - 1) * w * 4;
+		U8* dst = padded.items + (size_t)(y + 1) * row;
+		memcpy(dst, src, 4);
+		memcpy(dst + 4, src, (size_t)w * 4);
+		memcpy(dst + 4 + (size_t)w * 4, src + (size_t)(w - 1) * 4, 4);
+	}
+	UpdateTextureRec(a->texture,
+			(Rectangle) { rect.x - 1, rect.y - 1, w + 2, h + 2 }, padded.items);
+}
+
+// Page holding a small buffer, placing it on first use. `source` receives the
+// part of the page to draw.
+Texture2D pixels_atlas_texture(Hatori_Pixels* p, Rectangle* source)
+{
+	if (p->atlas == NULL) {
+		if (!pixels_load(p)) {
+			return (Texture2D) { 0 };
+		}
+		for (size_t i = 0; i < atlases.count && p->atlas == NULL; ++i) {
+			Hatori_Atlas* a = atlases.items[i];
+			if (!a->icons && atlas_place(a, p->width, p->height, &p->atlas_rect)) {
+				p->atlas = a;
+			}
+		}
+		if (p->atlas == NULL) {
+			Hatori_Atlas* a = atlas_new(false);
+			if (a == NULL || !atlas_place(a, p->width, p->height, &p->atlas_rect)) {
+				return (Texture2D) { 0 };
+			}
+			p->atlas = a;
+		}
+		atlas_upload(p->atlas, p->atlas_rect, p->image);
+	}
+	*source = p->atlas_rect;
+	return p->atlas->texture;
+}
+
+// Gives back the slot of `p`. Empty pages are unloaded, mostly empty ones are
+// packed again so their free space is in one piece.
+void atlas_remove(Hatori_Pixels* p)
+{
+	Hatori_Atlas* a = p->atlas;
+	if (a == NULL) {
+		return;
+	}
+	p->atlas = NULL;
+	a->slots--;
+	a->area -= (p->atlas_rect.width + 2) * (p->atlas_rect.height + 2);
+	if (a->slots > 0) {
+		if (a->area * 2 < a->packed) {
+			atlas_repack(a);
+		}
+		return;
+	}
+	for (size_t i = 0; i < atlases.count; ++i) {
+		if (atlases.items[i] == a) {
+			atlases.items[i] = atlases.items[--atlases.count];
+			break;
+		}
+	}
+	texture_bytes -= GetPixelDataSize(
+			a->texture.width, a->texture.height, a->texture.format);
+	UnloadTexture(a->texture);
+	free(a);
+}
+
+void atlas_repack(Hatori_Atlas* a)
+{
+	List(stbrp_rect) rects = { .arena = &frame_arena };
+	List(Hatori_Pixels*) placed = { .arena = &frame_arena };
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		Hatori_Pixels* p = pixels_pool.items[i];
+		if (p->atlas == a) {
+			stbrp_rect r = { .id = placed.count,
+				.w = p->width + 2,
+				.h = p->height + 2 };
+			list_append(&rects, r);
+			list_append(&placed, p);
+		}
+	}
+	// Quads already batched would otherwise sample the moved pixels.
+	rlDrawRenderBatchActive();
+	// What was freed would otherwise keep its pixels in between the slots.
+	U8* blank = calloc((size_t)ATLAS_SIZE * ATLAS_SIZE, 4);
+	assert(blank != NULL && "Buy more RAM!!");
+	UpdateTexture(a->texture, blank);
+	free(blank);
+	stbrp_init_target(&a->packer, ATLAS_SIZE, ATLAS_SIZE, a->nodes, ATLAS_SIZE);
+	stbrp_pack_rects(&a->packer, rects.items, rects.count);
+	a->slots = 0;
+	a->area = 0;
+	a->packed = 0;
+	for (size_t i = 0; i < rects.count; ++i) {
+		stbrp_rect r = rects.items[i];
+		Hatori_Pixels* p = placed.items[r.id];
+		if (!r.was_packed) {
+			p->atlas = NULL;
+			continue;
+		}
+		p->atlas_rect = (Rectangle) { r.x + 1, r.y + 1, p->width, p->height };
+		atlas_upload(a, p->atlas_rect, p->image);
+		a->slots++;
+		a->area += r.w * r.h;
+		a->packed += r.w * r.h;
+	}
+	TraceLog(LOG_DEBUG, "PIXELS: Repacked atlas page with %d buffers", a->slots);
+}
+
+// Copies a control icon onto an icon page and returns the page, or no texture
+// when the icon doesn't fit. `source` receives where it went.
+Texture2D atlas_add_icon(Image icon, Rectangle* source)
+{
+	if (icon.data == NULL || icon.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+			|| icon.width > ATLAS_MAX_IMAGE || icon.height > ATLAS_MAX_IMAGE) {
+		return (Texture2D) { 0 };
+	}
+	Hatori_Atlas* a = NULL;
+	Rectangle rect;
+	for (size_t i = 0; i < atlases.count && a == NULL; ++i) {
+		if (atlases.items[i]->icons
+				&& atlas_place(atlases.items[i], icon.width, icon.height, &rect)) {
+			a = atlases.items[i];
+		}
+	}
+	if (a == NULL) {
+		a = atlas_new(true);
+		if (a == NULL || !atlas_place(a, icon.width, icon.height, &rect)) {
+			return (Texture2D) { 0 };
+		}
+	}
+	atlas_upload(a, rect, icon);
+	*source = rect;
+	return a->texture;
+}
+
+// Returns pixels that are safe to modify in place, copying them first when
+// another image shares them.
+Image* edit_pixels(Hatori_Pixels** pixels)
+{
+	Hatori_Pixels* p = *pixels;
+	if (p == NULL || !pixels_load(p)) {
+		return NULL;
+	}
+	if (p->refs > 1) {
+		Hatori_Pixels* copy = pool_alloc(&pixels_objects);
+		copy->refs = 1;
+		copy->width = p->width;
+		copy->height = p->height;
+		copy->image = ImageCopy(p->image);
+		list_append(&pixels_pool, copy);
+		pixels_release(p);
+		*pixels = p = copy;
+	}
+	pixels_set_hash(p, 0);
+	if (p->owns_blob) {
+		RL_FREE((void*)p->blob.data);
+	}
+	p->blob = (Hatori_Blob) { 0 };
+	p->owns_blob = false;
+	return &p->image;
+}
+
+// Originals only matter again on reset or undo, so once no image shows them
+// they are kept as QOI bytes and decoded again on demand. Jobs encode them and
+// the pixels are unloaded when a frame has time for it.
+void compress_originals(void)
+{
+	idle_post(&idle, "compress_next_original()", compress_next_original, NULL,
+			IDLE_LOW, 8);
+}
+
+// Idle task, compresses one of the originals or queues the encoding of those
+// without QOI bytes, encoded_pixels() posts it again for them.
+bool compress_next_original(void* arg)
+{
+	static int count;
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		pixels_pool.items[i]->mark = false;
+	}
+	for (size_t i = 0; i < entities.count; ++i) {
+		Hatori_Entity e = entities.items[i];
+		if (e.type == ENTITY_IMAGE && !e.deleted && e.entity.image.current) {
+			e.entity.image.current->mark = true;
+		}
+	}
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		Hatori_Pixels* p = pixels_pool.items[i];
+		if (p->mark || p->image.data == NULL || !pixels_encode_async(p)) {
+			continue;
+		}
+		pixels_unload_levels(p);
+		UnloadImage(p->image);
+		p->image = (Image) { 0 };
+		count++;
+		return false;
+	}
+	if (count > 0) {
+		log_pixels_stats(TextFormat("compressed %d originals", count));
+	}
+	count = 0;
+	return true;
+}
+
+Hatori_PixelsStats pixels_stats(void)
+{
+	Hatori_PixelsStats stats = { 0 };
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		Hatori_Pixels* p = pixels_pool.items[i];
+		stats.buffers++;
+		stats.refs += p->refs;
+		stats.blob_bytes += p->blob.size;
+		if (p->image.data == NULL) {
+			stats.compressed++;
+		}
+		for (int k = 0; k < p->level_count; ++k) {
+			Hatori_Level* l = &p->levels[k];
+			if (l->image.data != NULL) {
+				stats.decoded_bytes += (U64)l->image.width * l->image.height * 4;
+			}
+			for (int i = 0; l->tiles != NULL && i < l->cols * l->rows; ++i) {
+				Texture2D t = l->tiles[i].texture;
+				if (t.id > 0) {
+					stats.texture_bytes
+							+= GetPixelDataSize(t.width, t.height, t.format);
+				}
+			}
+		}
+	}
+	for (size_t i = 0; i < atlases.count; ++i) {
+		Texture2D t = atlases.items[i]->texture;
+		stats.texture_bytes += GetPixelDataSize(t.width, t.height, t.format);
+	}
+	return stats;
+}
+
+void log_pixels_stats(const char* reason)
+{
+	Hatori_PixelsStats stats = pixels_stats();
+	TraceLog(LOG_INFO,
+			"PIXELS: %s: %llu buffers for %llu refs, %llu compressed, "
+			"%.1f MB decoded, %.1f MB QOI, %.1f MB textures",
+			reason, (unsigned long long)stats.buffers,
+			(unsigned long long)stats.refs, (unsigned long long)stats.compressed,
+			stats.decoded_bytes / 1048576.0, stats.blob_bytes / 1048576.0,
+			stats.texture_bytes / 1048576.0);
+}
+
+U64 texture_memory(Texture2D t)
+{
+	return t.id > 0 ? GetPixelDataSize(t.width, t.height, t.format) : 0;
+}
+
+// Decoded levels, owned QOI bytes and tile textures of one buffer. Buffers on
+// an atlas page only count the part of the page they cover.
+Hatori_MemoryItem pixels_memory(Hatori_Pixels* p)
+{
+	Hatori_MemoryItem m = { .cpu = sizeof(*p) };
+	if (p->owns_blob) {
+		m.cpu += p->blob.size;
+	} else {
+		m.mapped += p->blob.size;
+	}
+	if (p->image.data != NULL) {
+		m.cpu += (U64)p->image.width * p->image.height * 4;
+	}
+	for (int k = 0; k < p->level_count; ++k) {
+		Hatori_Level* l = &p->levels[k];
+		if (k > 0 && l->image.data != NULL) {
+			m.cpu += (U64)l->image.width * l->image.height * 4;
+		}
+		if (l->tiles != NULL) {
+			m.cpu += (U64)l->cols * l->rows * sizeof(*l->tiles);
+			for (int i = 0; i < l->cols * l->rows; ++i) {
+				m.gpu += texture_memory(l->tiles[i].texture);
+			}
+		}
+	}
+	if (p->atlas != NULL) {
+		m.gpu += (U64)p->atlas_rect.width * p->atlas_rect.height * 4;
+	}
+	return m;
+}
+
+// Glyph tables and images on the CPU, the glyph atlas on the GPU.
+U64 font_memory(Font font, U64* gpu)
+{
+	U64 cpu = (U64)font.glyphCount * (sizeof(GlyphInfo) + sizeof(Rectangle));
+	for (int i = 0; font.glyphs != NULL && i < font.glyphCount; ++i) {
+		Image img = font.glyphs[i].image;
+		cpu += GetPixelDataSize(img.width, img.height, img.format);
+	}
+	*gpu += texture_memory(font.texture);
+	return cpu;
+}
+
+// Resident set size from the kernel, which also covers what isn't accounted
+// for here: the allocator, the GL driver and anything leaked.
+U64 resident_memory(void)
+{
+#if defined(__linux__)
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file == NULL) {
+		return 0;
+	}
+	unsigned long long size = 0;
+	unsigned long long resident = 0;
+	int read = fscanf(file, "%llu %llu", &size, &resident);
+	fclose(file);
+	return read == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+	return 0;
+#endif
+}
+
+static void add_memory(
+		Hatori_MemoryItems* items, const char* name, U64 cpu, U64 gpu)
+{
+	Hatori_MemoryItem m = { .cpu = cpu, .gpu = gpu };
+	snprintf(m.name, sizeof(m.name), "%s", name);
+	list_append(items, m);
+}
+
+static int compare_memory(const void* a, const void* b)
+{
+	const Hatori_MemoryItem* x = a;
+	const Hatori_MemoryItem* y = b;
+	U64 sx = x->cpu + x->gpu + x->mapped;
+	U64 sy = y->cpu + y->gpu + y->mapped;
+	return sx < sy ? 1 : sx > sy ? -1 : 0;
+}
+
+// Walks everything the app holds on to, biggest first.
+void memory_report(Hatori_MemoryReport* r)
+{
+	list_clear(&r->classes);
+	list_clear(&r->entities);
+
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		pixels_pool.items[i]->mark = false;
+	}
+	Hatori_MemoryItem images = { 0 };
+	U64 text_bytes = 0;
+	for (size_t i = 0; i < entities.count; ++i) {
+		Hatori_Entity* e = &entities.items[i];
+		if (e->type == ENTITY_TEXT) {
+			text_bytes += e->entity.text.text.capacity;
+			if (!e->deleted) {
+				Hatori_MemoryItem m = { .cpu = e->entity.text.text.capacity };
+				snprintf(m.name, sizeof(m.name), "text %zu \"%.24s\"", i,
+						e->entity.text.text.items != NULL ? e->entity.text.text.items
+														  : "");
+				list_append(&r->entities, m);
+			}
+			continue;
+		}
+		if (e->type != ENTITY_IMAGE || e->deleted) {
+			continue;
+		}
+		Hatori_Image* img = &e->entity.image;
+		Hatori_MemoryItem m = { 0 };
+		Hatori_Pixels* pixels[2] = { img->current, img->original };
+		for (int k = 0; k < 2; ++k) {
+			if (pixels[k] == NULL || pixels[k]->mark) {
+				continue;
+			}
+			pixels[k]->mark = true;
+			Hatori_MemoryItem p = pixels_memory(pixels[k]);
+			m.cpu += p.cpu;
+			m.gpu += p.gpu;
+			m.mapped += p.mapped;
+		}
+		snprintf(m.name, sizeof(m.name), "image %zu %dx%d", i,
+				img->current != NULL ? img->current->width : 0,
+				img->current != NULL ? img->current->height : 0);
+		images.cpu += m.cpu;
+		images.gpu += m.gpu;
+		images.mapped += m.mapped;
+		list_append(&r->entities, m);
+	}
+
+	// Buffers no live image uses are kept by undo and redo, or leaked.
+	Hatori_MemoryItem unused = { 0 };
+	for (size_t i = 0; i < pixels_pool.count; ++i) {
+		if (!pixels_pool.items[i]->mark) {
+			Hatori_MemoryItem p = pixels_memory(pixels_pool.items[i]);
+			unused.cpu += p.cpu;
+			unused.gpu += p.gpu;
+			unused.mapped += p.mapped;
+		}
+	}
+
+	snprintf(images.name, sizeof(images.name), "image pixels");
+	list_append(&r->classes, images);
+	snprintf(unused.name, sizeof(unused.name), "pixels held by undo/redo");
+	list_append(&r->classes, unused);
+	add_memory(&r->classes, "text buffers", text_bytes, 0);
+	add_memory(&r->classes, "entities",
+			entities.capacity * sizeof(*entities.items), 0);
+	add_memory(&r->classes, "lines", lines.capacity * sizeof(*lines.items), 0);
+	U64 stroke_bytes = strokes.capacity * sizeof(*strokes.items);
+	for (size_t i = 0; i < strokes.count; ++i) {
+		for (int k = 1; k < STROKE_LODS; ++k) {
+			stroke_bytes += strokes.items[i].lod_points[k] * sizeof(Vector2);
+		}
+	}
+	add_memory(&r->classes, "stroke levels", stroke_bytes, 0);
+
+	U64 undo = undo_step_bytes(&undo_step);
+	for (size_t i = 0; i < undo_stack.count; ++i) {
+		undo += undo_step_bytes(&undo_stack.items[i]);
+	}
+	for (size_t i = 0; i < redo_stack.count; ++i) {
+		undo += undo_step_bytes(&redo_stack.items[i]);
+	}
+	add_memory(&r->classes, "undo/redo history", undo, 0);
+	add_memory(&r->classes, "journal buffers", journal_buffer_bytes(&journal), 0);
+
+	// Image atlas pages only count their free space, the rest is in the
+	// images on them.
+	U64 icons = 0;
+	U64 atlas_free = 0;
+	for (size_t i = 0; i < atlases.count; ++i) {
+		Hatori_Atlas* a = atlases.items[i];
+		if (a->icons) {
+			icons += texture_memory(a->texture);
+		} else {
+			atlas_free += texture_memory(a->texture) - (U64)a->area * 4;
+		}
+	}
+	add_memory(&r->classes, "control icons", 0, icons);
+	add_memory(&r->classes, "free atlas space", 0, atlas_free);
+	add_memory(&r->classes, "board cache tiles", 0,
+			board_cache.count * BOARD_CACHE_TILE_BYTES);
+	U64 font_gpu = 0;
+	U64 font_cpu = font_memory(anton_font, &font_gpu);
+	font_cpu += font_memory(GetFontDefault(), &font_gpu);
+	add_memory(&r->classes, "fonts", font_cpu, font_gpu);
+	add_memory(&r->classes, "profiler", sizeof(profiler), 0);
+	add_memory(&r->classes, "frame scratch", arena_bytes(&frame_arena), 0);
+	add_memory(&r->classes, "bookkeeping",
+			pixels_pool.capacity * sizeof(*pixels_pool.items)
+					+ upload_queue.capacity * sizeof(*upload_queue.items)
+					+ board_cache.capacity * sizeof(*board_cache.items)
+					+ map_bytes(&board_cache_index) + map_bytes(&pixels_by_hash)
+					+ atlases.count * sizeof(Hatori_Atlas),
+			0);
+	// The image bytes in the file are counted with their images.
+	U64 blobs = images.mapped + unused.mapped;
+	Hatori_MemoryItem file = {
+		.name = "board file",
+		.mapped = board_map.size > blobs ? board_map.size - blobs : 0,
+	};
+	list_append(&r->classes, file);
+
+	r->total = (Hatori_MemoryItem) { .name = "total" };
+	for (size_t i = 0; i < r->classes.count; ++i) {
+		r->total.cpu += r->classes.items[i].cpu;
+		r->total.gpu += r->classes.items[i].gpu;
+		r->total.mapped += r->classes.items[i].mapped;
+	}
+	r->resident = resident_memory();
+	r->taken = frame + 1;
+	qsort(r->classes.items, r->classes.count, sizeof(*r->classes.items),
+			compare_memory);
+	qsort(r->entities.items, r->entities.count, sizeof(*r->entities.items),
+			compare_memory);
+}
+
+// The default font isn't monospaced, so numbers are right aligned by hand.
+static void draw_memory_row(
+		float x, float y, const char* cpu, const char* gpu, const char* name,
+		Color color)
+{
+	const int font_size = 10;
+	DrawText(cpu, x + 50 - MeasureText(cpu, font_size), y, font_size, color);
+	DrawText(gpu, x + 100 - MeasureText(gpu, font_size), y, font_size, color);
+	DrawText(name, x + 110, y, font_size, color);
+}
+
+// What memory_report() finds, with the entities that hold the most.
+void draw_memory(void)
+{
+	if (memory.taken == 0 || frame + 1 - memory.taken >= MEMORY_REFRESH_FRAMES) {
+		memory_report(&memory);
+	}
+	const int font_size = 10;
+	const int row = font_size + 2;
+	int entity_rows = memory.entities.count < 8 ? memory.entities.count : 8;
+	float height = (memory.classes.count + entity_rows + 5) * row + 10;
+	Vector2 pos = { GetScreenWidth() - MEMORY_OVERLAY_WIDTH - 10,
+		GetScreenHeight() - height - 10 };
+	DrawRectangleV(pos, (Vector2) { MEMORY_OVERLAY_WIDTH, height },
+			Fade(HATORI_PRIMARY, 0.9f));
+	float x = pos.x + 6;
+	float y = pos.y + 6;
+	const double mb = 1048576.0;
+	DrawText(TextFormat("CPU %.1f MB, GPU ~%.1f MB, mapped %.1f MB",
+						 memory.total.cpu / mb, memory.total.gpu / mb,
+						 memory.total.mapped / mb),
+			x, y, font_size, RAYWHITE);
+	y += row;
+	if (memory.resident > 0) {
+		// The GL driver and the allocator hold some of it, leaks show up as
+		// this growing while the rest does not.
+		double other = (double)memory.resident - memory.total.cpu;
+		DrawText(TextFormat("resident %.1f MB, not accounted for %.1f MB",
+							 memory.resident / mb, other / mb),
+				x, y, font_size, RAYWHITE);
+	}
+	y += row * 1.5f;
+	draw_memory_row(x, y, "CPU MB", "GPU MB", "", GRAY);
+	y += row;
+	for (size_t i = 0; i < memory.classes.count; ++i) {
+		Hatori_MemoryItem m = memory.classes.items[i];
+		draw_memory_row(x, y, TextFormat("%.2f", (m.cpu + m.mapped) / mb),
+				TextFormat("%.2f", m.gpu / mb), m.name, LIGHTGRAY);
+		y += row;
+	}
+	y += row / 2;
+	for (int i = 0; i < entity_rows; ++i) {
+		Hatori_MemoryItem m = memory.entities.items[i];
+		draw_memory_row(x, y, TextFormat("%.2f", (m.cpu + m.mapped) / mb),
+				TextFormat("%.2f", m.gpu / mb), m.name, LIGHTGRAY);
+		y += row;
+	}
+}
+
+
+void dump_memory(const char* path)
+{
+	memory_report(&memory);
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		TraceLog(LOG_ERROR, "MEMORY: Can't write report to %s", path);
+		return;
+	}
+	fprintf(file, "%14s %14s %14s  %s\n", "cpu", "gpu", "mapped", "what");
+	fprintf(file, "%14llu %14llu %14llu  %s\n",
+			(unsigned long long)memory.total.cpu,
+			(unsigned long long)memory.total.gpu,
+			(unsigned long long)memory.total.mapped, memory.total.name);
+	if (memory.resident > 0) {
+		fprintf(file, "%14llu %14s %14s  resident\n",
+				(unsigned long long)memory.resident, "", "");
+	}
+	Hatori_MemoryItems* lists[] = { &memory.classes, &memory.entities };
+	for (int k = 0; k < 2; ++k) {
+		fprintf(file, "\n");
+		for (size_t i = 0; i < lists[k]->count; ++i) {
+			Hatori_MemoryItem m = lists[k]->items[i];
+			fprintf(file, "%14llu %14llu %14llu  %s\n", (unsigned long long)m.cpu,
+					(unsigned long long)m.gpu, (unsigned long long)m.mapped, m.name);
+		}
+	}
+	fclose(file);
+	TraceLog(LOG_INFO,
+			"MEMORY: Wrote report to %s: %.1f MB CPU, ~%.1f MB GPU, %.1f MB resident",
+			path, memory.total.cpu / 1048576.0, memory.total.gpu / 1048576.0,
+			memory.resident / 1048576.0);
+}
+
+// QOI bytes of `p`, encoded on the spot unless it still has its blob.
+// `owned` tells whether the caller has to RL_FREE() them.
+Hatori_Blob pixels_blob(Hatori_Pixels* p, bool* owned)
+{
+	*owned = false;
+	if (p == NULL) {
+		return (Hatori_Blob) { 0 };
+	}
+	if (pixels_finish_encode(p)) {
+		return p->blob;
+	}
+	if (!pixels_load(p)) {
+		return (Hatori_Blob) { 0 };
+	}
+	*owned = true;
+	return encode_image_blob(p->image);
+}
+
+bool map_board_file(const char* path, Hatori_BoardMap* map)
+{
+	*map = (Hatori_BoardMap) { 0 };
+#if defined(PLATFORM_WEB)
+	int size = 0;
+	map->data = LoadFileData(path, &size);
+	map->size = size;
+	return map->data != NULL;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	map->data = data;
+	map->size = st.st_size;
+	map->mapped = true;
+	return true;
+#endif
+}
+
+void unmap_board_file(Hatori_BoardMap* map)
+{
+	if (map->data == NULL) {
+		return;
+	}
+#if !defined(PLATFORM_WEB)
+	if (map->mapped) {
+		munmap(map->data, map->size);
+	}
+#else
+	UnloadFileData(map->data);
+#endif
+	*map = (Hatori_BoardMap) { 0 };
+}
+
+void clear_board(void)
+{
+	// Decoding jobs read from the board file, which is unmapped next.
+	jobs_finish(&jobs);
+	cancel_checkpoint();
+	for (size_t i = 0; i < entities.count; ++i) {
+		if (entities.items[i].type == ENTITY_IMAGE) {
+			pixels_release(entities.items[i].entity.image.current);
+			pixels_release(entities.items[i].entity.image.original);
+		} else if (entities.items[i].type == ENTITY_TEXT) {
+			free(entities.items[i].entity.text.text.items);
+		}
+	}
+	list_clear(&entities);
+	list_clear(&lines);
+	clear_strokes();
+	selected_entity = -1;
+	resizer.selected = -1;
+	img_controls.selected = -1;
+	text_controls.selected = -1;
+	mode = SELECTION_MODE;
+}
+
+bool save_board(const char* path)
+{
+	Hatori_BoardSave s = { 0 };
+	if (board_save_begin(&s, path)) {
+		board_save_encoded(&s, true);
+		board_save_write(&s, UINT64_MAX);
+		sync_board_job(&s);
+	}
+	return board_save_end(&s);
+}
+
+// Takes the snapshot and opens the temporary file, see Hatori_BoardSave.
+bool board_save_begin(Hatori_BoardSave* s, const char* path)
+{
+	*s = (Hatori_BoardSave) { .active = true, .start = GetTime() };
+	snprintf(s->path, sizeof(s->path), "%s", path);
+	snprintf(s->tmp_path, sizeof(s->tmp_path), "%s.tmp", path);
+	s->journal_mark = journal_mark(&journal);
+
+	List(Hatori_BoardEntity) table = { 0 };
+	for (size_t i = 0; i < entities.count; ++i) {
+		Hatori_Entity e = entities.items[i];
+		Hatori_BoardEntity be = board_entity(e);
+		if (e.type == ENTITY_IMAGE && !e.deleted) {
+			// Shared pixels are written once.
+			Hatori_Pixels* pixels[2]
+					= { e.entity.image.current, e.entity.image.original };
+			U32* index[2] = { &be.blob, &be.original_blob };
+			for (int k = 0; k < 2 && pixels[k] != NULL; ++k) {
+				for (size_t b = 0; b < s->blobs.count; ++b) {
+					if (s->blobs.items[b].pixels == pixels[k]) {
+						*index[k] = b;
+						break;
+					}
+				}
+				if (*index[k] == BOARD_NO_BLOB) {
+					*index[k] = s->blobs.count;
+					pixels_encode_async(pixels[k]);
+					list_append(&s->blobs,
+							((Hatori_SaveBlob) { pixels_retain(pixels[k]) }));
+				}
+			}
+		} else if (e.type == ENTITY_TEXT && !e.deleted) {
+			Hatori_Text txt = e.entity.text;
+			U8* bytes = malloc(txt.text.count + 1);
+			assert(bytes != NULL && "Buy more RAM!!");
+			memcpy(bytes, txt.text.items, txt.text.count);
+			be.blob = s->blobs.count;
+			list_append(&s->blobs,
+					((Hatori_SaveBlob) { NULL, { bytes, (U32)txt.text.count } }));
+		}
+		list_append(&table, be);
+	}
+
+	Hatori_BoardHeader header = {
+		.magic = BOARD_MAGIC,
+		.version = BOARD_VERSION,
+		.offset_x = offset_x,
+		.offset_y = offset_y,
+		.scale = scale,
+		.line_count = lines.count,
+		.entity_count = table.count,
+		.blob_count = s->blobs.count,
+		.journal_seq = journal.seq,
+	};
+	header.lines_offset = sizeof(header);
+	header.entities_offset
+			= header.lines_offset + lines.count * sizeof(Hatori_BoardLine);
+	header.blobs_offset
+			= header.entities_offset + table.count * sizeof(Hatori_BoardEntity);
+	list_reserve(&s->head,
+			header.blobs_offset + s->blobs.count * sizeof(Hatori_BoardBlob));
+	list_append_many(&s->head, (const U8*)&header, sizeof(header));
+	for (size_t i = 0; i < lines.count; ++i) {
+		Hatori_Line l = lines.items[i];
+		Hatori_BoardLine bl
+				= { l.x0, l.y0, l.x1, l.y1, (U32)l.thickness, l.deleted };
+		list_append_many(&s->head, (const U8*)&bl, sizeof(bl));
+	}
+	list_append_many(&s->head, (const U8*)table.items,
+			table.count * sizeof(*table.items));
+	free(table.items);
+
+	s->file = fopen(s->tmp_path, "wb");
+	s->ok = s->file != NULL;
+	return s->ok;
+}
+
+// True once every image has its QOI bytes, which the blob table then lists.
+// With `wait` it waits for the jobs encoding them.
+bool board_save_encoded(Hatori_BoardSave* s, bool wait)
+{
+	for (size_t i = 0; i < s->blobs.count; ++i) {
+		Hatori_Pixels* p = s->blobs.items[i].pixels;
+		if (p == NULL) {
+			continue;
+		}
+		if (wait) {
+			pixels_finish_encode(p);
+		} else if (!pixels_encode_async(p) && p->encode_queued) {
+			return false;
+		}
+	}
+	Hatori_BoardHeader header;
+	memcpy(&header, s->head.items, sizeof(header));
+	U64 offset = header.blobs_offset + s->blobs.count * sizeof(Hatori_BoardBlob);
+	for (size_t i = 0; i < s->blobs.count; ++i) {
+		Hatori_SaveBlob* b = &s->blobs.items[i];
+		U32 codec = BLOB_RAW;
+		if (b->pixels != NULL) {
+			// Pixels that could not be encoded are written without bytes.
+			b->bytes.size = b->pixels->blob.size;
+			codec = BLOB_QOI;
+		}
+		Hatori_BoardBlob bb = { offset, b->bytes.size, codec };
+		list_append_many(&s->head, (const U8*)&bb, sizeof(bb));
+		offset += bb.size;
+	}
+	return true;
+}
+
+// Writes up to `budget` bytes, true once the whole file is written or
+// writing failed.
+bool board_save_write(Hatori_BoardSave* s, U64 budget)
+{
+	while (s->ok && budget > 0) {
+		const U8* data = NULL;
+		U64 left = 0;
+		if (s->head_written < s->head.count) {
+			data = s->head.items + s->head_written;
+			left = s->head.count - s->head_written;
+		} else if (s->blob < s->blobs.count) {
+			Hatori_SaveBlob b = s->blobs.items[s->blob];
+			Hatori_Blob bytes = b.pixels != NULL ? b.pixels->blob : b.bytes;
+			// Pixels that failed to decode since drop their bytes.
+			if (bytes.size != b.bytes.size) {
+				s->ok = false;
+				break;
+			}
+			data = bytes.data + s->blob_written;
+			left = bytes.size - s->blob_written;
+			if (left == 0) {
+				s->blob++;
+				s->blob_written = 0;
+				continue;
+			}
+		} else {
+			break;
+		}
+		U64 n = left < budget ? left : budget;
+		s->ok = fwrite(data, n, 1, s->file) == 1;
+		if (s->head_written < s->head.count) {
+			s->head_written += n;
+		} else {
+			s->blob_written += n;
+		}
+		budget -= n;
+	}
+	return !s->ok || s->blob == s->blobs.count;
+}
+
+// Flushes and closes the file, which can take long, on any thread.
+void sync_board_job(void* arg)
+{
+	Hatori_BoardSave* s = arg;
+	if (s->file == NULL) {
+		return;
+	}
+	U64 start = profile_now();
+#if !defined(PLATFORM_WEB)
+	s->ok = s->ok && fflush(s->file) == 0 && fsync(fileno(s->file)) == 0;
+#endif
+	s->ok = fclose(s->file) == 0 && s->ok;
+	s->file = NULL;
+	profile_record(&profiler, "sync_board_job()", start, profile_now());
+}
+
+// Moves the file over the old one unless anything failed, then drops the
+// snapshot.
+bool board_save_end(Hatori_BoardSave* s)
+{
+	if (s->file != NULL) {
+		fclose(s->file);
+		s->file = NULL;
+		s->ok = false;
+	}
+	bool ok = s->ok && rename(s->tmp_path, s->path) == 0;
+	board_save_drop(s);
+	if (!ok) {
+		TraceLog(LOG_WARNING, "BOARD: [%s] Failed to save board", s->path);
+		remove(s->tmp_path);
+		return false;
+	}
+	TraceLog(LOG_INFO, "BOARD: [%s] Saved in %.2f ms", s->path,
+			(GetTime() - s->start) * 1000);
+	return true;
+}
+
+// Lets go of the snapshot.
+void board_save_drop(Hatori_BoardSave* s)
+{
+	for (size_t i = 0; i < s->blobs.count; ++i) {
+		if (s->blobs.items[i].pixels != NULL) {
+			pixels_release(s->blobs.items[i].pixels);
+		} else {
+			free((void*)s->blobs.items[i].bytes.data);
+		}
+	}
+	free(s->blobs.items);
+	free(s->head.items);
+	memset(&s->blobs, 0, sizeof(s->blobs));
+	memset(&s->head, 0, sizeof(s->head));
+	s->active = false;
+}
+
+// Whether `size` bytes at `offset` are inside the file, without overflowing.
+bool board_range_ok(Hatori_BoardMap map, U64 offset, U64 size)
+{
+	return offset <= map.size && size <= map.size - offset;
+}
+
+bool load_board(const char* path)
+{
+	double start = GetTime();
+	Hatori_BoardMap map = { 0 };
+	if (!map_board_file(path, &map)) {
+		TraceLog(LOG_WARNING, "BOARD: [%s] Failed to open board", path);
+		return false;
+	}
+
+	Hatori_BoardHeader header = { 0 };
+	bool ok = map.size >= sizeof(header);
+	if (ok) {
+		memcpy(&header, map.data, sizeof(header));
+		ok = memcmp(header.magic, BOARD_MAGIC, 4) == 0
+				&& header.version == BOARD_VERSION
+				&& board_range_ok(map, header.lines_offset,
+						(U64)header.line_count * sizeof(Hatori_BoardLine))
+				&& board_range_ok(map, header.entities_offset,
+						(U64)header.entity_count * sizeof(Hatori_BoardEntity))
+				&& board_range_ok(map, header.blobs_offset,
+						(U64)header.blob_count * sizeof(Hatori_BoardBlob));
+	}
+	const Hatori_BoardBlob* blob_table
+			= (const Hatori_BoardBlob*)(map.data + header.blobs_offset);
+	for (U32 i = 0; ok && i < header.blob_count; ++i) {
+		ok = board_range_ok(map, blob_table[i].offset, blob_table[i].size);
+	}
+	if (!ok) {
+		TraceLog(LOG_WARNING, "BOARD: [%s] Not a valid board file", path);
+		unmap_board_file(&map);
+		return false;
+	}
+
+	clear_board();
+	unmap_board_file(&board_map);
+	board_map = map;
+
+	const Hatori_BoardLine* board_lines
+			= (const Hatori_BoardLine*)(map.data + header.lines_offset);
+	for (U32 i = 0; i < header.line_count; ++i) {
+		Hatori_BoardLine bl = board_lines[i];
+		list_append(&lines,
+				((Hatori_Line) { bl.x0, bl.y0, bl.x1, bl.y1, bl.thickness,
+						bl.deleted != 0 }));
+	}
+
+	z = 1;
+	// One Hatori_Pixels per blob, so images that shared pixels still do.
+	Hatori_Pixels** shared = calloc(header.blob_count + 1, sizeof(*shared));
+	const Hatori_BoardEntity* board_entities
+			= (const Hatori_BoardEntity*)(map.data + header.entities_offset);
+	for (U32 i = 0; i < header.entity_count; ++i) {
+		Hatori_BoardEntity be = board_entities[i];
+		Hatori_Entity e = { 0 };
+		e.type = be.type;
+		e.deleted = be.deleted != 0;
+		e.z = be.z;
+		if (e.z >= z) {
+			z = e.z + 1;
+		}
+		Hatori_Blob blob = { 0 };
+		if (be.blob < header.blob_count) {
+			blob.data = map.data + blob_table[be.blob].offset;
+			blob.size = blob_table[be.blob].size;
+		}
+		if (e.type == ENTITY_IMAGE) {
+			e.entity.image.pos = be.pos;
+			e.entity.image.size = be.size;
+			U32 index[2] = { be.blob, be.original_blob };
+			Hatori_Pixels** pixels[2]
+					= { &e.entity.image.current, &e.entity.image.original };
+			for (int k = 0; k < 2; ++k) {
+				if (index[k] >= header.blob_count) {
+					continue;
+				}
+				if (shared[index[k]] != NULL) {
+					*pixels[k] = pixels_retain(shared[index[k]]);
+				} else {
+					Hatori_BoardBlob bb = blob_table[index[k]];
+					*pixels[k] = shared[index[k]] = pixels_from_blob(
+							(Hatori_Blob) { map.data + bb.offset, bb.size }, false);
+				}
+			}
+			if (e.entity.image.current == NULL) {
+				pixels_release(e.entity.image.original);
+				e.entity.image.original = NULL;
+				e.deleted = true;
+			}
+		} else if (e.type == ENTITY_TEXT) {
+			e.entity.text = make_text(be, (const char*)blob.data, blob.size);
+		} else {
+			e.type = ENTITY_TEXT;
+			e.deleted = true;
+			list_init(&e.entity.text.text, 1);
+		}
+		list_append(&entities, e);
+	}
+	free(shared);
+
+	offset_x = header.offset_x;
+	offset_y = header.offset_y;
+	scale = header.scale > 0 ? header.scale : 1;
+	board_journal_seq = header.journal_seq;
+	if (path != board_path) {
+		snprintf(board_path, sizeof(board_path), "%s", path);
+	}
+
+	TraceLog(LOG_INFO, "BOARD: [%s] Loaded %u lines and %u entities in %.2f ms",
+			path, header.line_count, header.entity_count, (GetTime() - start) * 1000);
+	return true;
+}
+
+Hatori_BoardEntity board_entity(Hatori_Entity e)
+{
+	Hatori_BoardEntity be = {
+		.type = e.type,
+		.deleted = e.deleted,
+		.z = e.z,
+		.blob = BOARD_NO_BLOB,
+		.original_blob = BOARD_NO_BLOB,
+	};
+	if (e.type == ENTITY_IMAGE) {
+		be.pos = e.entity.image.pos;
+		be.size = e.entity.image.size;
+	} else if (e.type == ENTITY_TEXT) {
+		be.pos = e.entity.text.pos;
+		be.size = e.entity.text.size;
+		be.font_size = e.entity.text.font_size;
+		be.spacing = e.entity.text.spacing;
+		be.color = e.entity.text.color;
+	}
+	return be;
+}
+
+Hatori_Text make_text(Hatori_BoardEntity be, const char* bytes, U32 size)
+{
+	Hatori_Text txt = { 0 };
+	int cap = size + 1 > 100 ? size + 1 : 100;
+	list_init(&txt.text, cap);
+	memset(txt.text.items, 0, cap);
+	if (size > 0) {
+		memcpy(txt.text.items, bytes, size);
+	}
+	txt.text.count = size;
+	txt.pos = be.pos;
+	txt.size = be.size;
+	txt.font_size = be.font_size;
+	txt.spacing = be.spacing;
+	txt.color = be.color;
+	return txt;
+}
+
+// Takes ownership of `img`. Returns the new entity index or -1.
+int add_image_entity(Image img, Vector2 pos, Vector2 size)
+{
+	return add_pixels_entity(pixels_from_image(img), pos, size);
+}
+
+// Takes the reference to `pixels`. Returns the new entity index or -1.
+int add_pixels_entity(Hatori_Pixels* pixels, Vector2 pos, Vector2 size)
+{
+	if (pixels == NULL) {
+		return -1;
+	}
+	Hatori_Entity e = { 0 };
 	e.z = z++;
 	e.type = ENTITY_IMAGE;
-	e.entity.image = himg;
+	e.entity.image.pos = pos;
+	e.entity.image.size = size;
+	e.entity.image.current = pixels;
+	e.entity.image.original = pixels_retain(pixels);
+	list_append(&entities, e);
+	return entities.count - 1;
+}
+
+// Takes ownership of `img`, which must be RGBA8, and adds it with its journal
+// record once a job has encoded it. Until the pixels are edited the QOI bytes
+// stay with them, so checkpoints and deleting the image don't encode again.
+void add_image_async(Image img, Vector2 pos, Vector2 size)
+{
+	if (img.data == NULL) {
+		return;
+	}
+	Hatori_ImageLoad* load = new_image_load(pos, size);
+	load->image = img;
+	jobs_spawn(&jobs, &image_loads, load_image_job, load);
+}
+
+// Like add_image_async() for the image file at `path`, shown at its size.
+void add_image_file_async(const char* path, Vector2 pos)
+{
+	Hatori_ImageLoad* load = new_image_load(pos, (Vector2) { 0 });
+	size_t n = strlen(path) + 1;
+	load->path = malloc(n);
+	assert(load->path != NULL && "Buy more RAM!!");
+	memcpy(load->path, path, n);
+	jobs_spawn(&jobs, &image_loads, load_image_job, load);
+}
+
+// Like add_image_file_async() for the `size` bytes of a file, which are
+// copied.
+void add_image_bytes_async(
+		const char* file_type, const U8* data, int size, Vector2 pos)
+{
+	if (data == NULL || size <= 0) {
+		return;
+	}
+	Hatori_ImageLoad* load = new_image_load(pos, (Vector2) { 0 });
+	snprintf(load->file_type, sizeof(load->file_type), "%s", file_type);
+	load->file_data = malloc(size);
+	assert(load->file_data != NULL && "Buy more RAM!!");
+	memcpy(load->file_data, data, size);
+	load->file_size = size;
+	jobs_spawn(&jobs, &image_loads, load_image_job, load);
+}
+
+Hatori_ImageLoad* new_image_load(Vector2 pos, Vector2 size)
+{
+	Hatori_ImageLoad* load = calloc(1, sizeof(*load));
+	assert(load != NULL && "Buy more RAM!!");
+	load->pos = pos;
+	load->size = size;
+	return load;
+}
+
+void load_image_job(void* arg)
+{
+	Hatori_ImageLoad* load = arg;
+	U64 start = profile_now();
+	if (load->path != NULL) {
+		load->image = LoadImage(load->path);
+		profile_record(&profiler, "LoadImage()", start, profile_now());
+	} else if (load->file_data != NULL) {
+		load->image = LoadImageFromMemory(
+				load->file_type, load->file_data, load->file_size);
+		profile_record(&profiler, "LoadImageFromMemory()", start, profile_now());
+	}
+	free(load->path);
+	free(load->file_data);
+	load->path = NULL;
+	load->file_data = NULL;
+	if (load->image.data != NULL) {
+		start = profile_now();
+		ImageFormat(&load->image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+		load->hash = hash_pixels(load->image);
+		load->blob = encode_image_blob(load->image);
+		profile_record(&profiler, "load_image_job()", start, profile_now());
+		if (load->size.x == 0 && load->size.y == 0) {
+			load->size = (Vector2) { load->image.width, load->image.height };
+		}
+	}
+	jobs_complete(&jobs, loaded_image, load);
+}
+
+void loaded_image(void* arg)
+{
+	Hatori_ImageLoad* load = arg;
+	Hatori_Pixels* p = pixels_from_hashed_image(load->image, load->hash);
+	// An unedited buffer with the same pixels may already have its bytes.
+	if (p != NULL && p->blob.data == NULL && load->blob.data != NULL) {
+		p->blob = load->blob;
+		p->owns_blob = true;
+	} else {
+		RL_FREE((void*)load->blob.data);
+	}
+	record_image_add(add_pixels_entity(p, load->pos, load->size));
+	free(load);
+	request_redraw();
+}
+
+int add_text_entity(Hatori_Text txt, int z)
+{
+	Hatori_Entity e = { 0 };
+	e.z = z;
+	e.type = ENTITY_TEXT;
+	e.entity.text = txt;
+	measure_text(&e.entity.text);
+	list_append(&entities, e);
+	return entities.count - 1;
+}
+
+// Returns the index of the copy, -1 when there are no pixels to copy.
+int copy_image_entity(U64 src, Hatori_BoardEntity be)
+{
+	Hatori_Image img = entities.items[src].entity.image;
+	if (img.current == NULL) {
+		return -1;
+	}
+	// The copy starts out pristine, so it resets to what it was copied from.
+	img.pos = be.pos;
+	img.size = be.size;
+	img.current = pixels_retain(img.current);
+	img.original = pixels_retain(img.current);
+	Hatori_Entity e = { 0 };
+	e.z = be.z;
+	e.type = ENTITY_IMAGE;
+	e.entity.image = img;
 	list_append(&entities, e);
+	if (be.z >= z) {
+		z = be.z + 1;
+	}
+	return entities.count - 1;
+}
+
+void delete_entity(U64 i)
+{
+	entities.items[i].deleted = true;
+	if (entities.items[i].type == ENTITY_IMAGE) {
+		Hatori_Image* img = &entities.items[i].entity.image;
+		pixels_release(img->current);
+		pixels_release(img->original);
+		img->current = NULL;
+		img->original = NULL;
+	}
+}
+
+void swap_entities(U64 i, Hatori_OpSwap swap)
+{
+	Hatori_Entity tmp = entities.items[swap.other];
+	entities.items[swap.other] = entities.items[i];
+	entities.items[i] = tmp;
+	entities.items[i].z = swap.z;
+	entities.items[swap.other].z = swap.other_z;
+}
+
+bool edit_image(Hatori_Image* img, Hatori_ImageEdit edit)
+{
+	if (edit.type == EDIT_RESET) {
+		if (img->original == NULL || img->current == img->original) {
+			return false;
+		}
+		pixels_release(img->current);
+		img->current = pixels_retain(img->original);
+		invalidate_board(
+				(Rectangle) { img->pos.x, img->pos.y, img->size.x, img->size.y }, 2);
+		return true;
+	}
+	if (edit.type == EDIT_FLOOD && img->current != NULL
+			&& (edit.pos.x < 0 || edit.pos.x >= img->current->width
+					|| edit.pos.y < 0 || edit.pos.y >= img->current->height)) {
+		return false;
+	}
+	Image* pixels = edit_pixels(&img->current);
+	if (pixels == NULL || !apply_image_edit(pixels, edit)) {
+		return false;
+	}
+	pixels_changed(img->current, image_edit_area(*pixels, edit));
+	return true;
+}
+
+// Runs the kernel of a pixel edit, reset aside, on any thread.
+bool apply_image_edit(Image* pixels, Hatori_ImageEdit edit)
+{
+	switch (edit.type) {
+	case EDIT_HFLIP:
+		flip_image_horizontal(pixels);
+		break;
+	case EDIT_VFLIP:
+		ImageFlipVertical(pixels);
+		break;
+	case EDIT_ERODE:
+		PROFILE_CALL(erode_image(pixels));
+		break;
+	case EDIT_FLOOD:
+		PROFILE_CALL(flood_remove(pixels, edit.pos, edit.amount));
+		break;
+	case EDIT_ERASE:
+		ImageDrawCircle(pixels, edit.pos.x, edit.pos.y, edit.amount, BLANK);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+void edit_selected_image(Hatori_ImageEdit edit)
+{
+	do_op(OP_IMAGE_EDIT, selected_entity, &edit, sizeof(edit));
+}
+
+void record_op(OpType op, U32 key, const void* payload, U32 size)
+{
+	// Continuous edits only need their latest state.
+	bool coalesce
+			= op == OP_ENTITY_POS || op == OP_ENTITY_SIZE || op == OP_TEXT_SET;
+	journal_append(&journal, op, key, payload, size, coalesce);
+	request_redraw();
+}
+
+void record_entity_op(
+		OpType op, U32 key, Hatori_BoardEntity be, const void* bytes, U32 size)
+{
+	static List(U8) scratch = { 0 };
+	// Every entity op that goes through here appends a new entity.
+	push_undo_op(&undo_step, OP_ENTITY_DELETE, entities.count - 1, NULL, 0);
+	invalidate_entity(entities.count - 1);
+	if (!journal.open) {
+		return;
+	}
+	list_clear(&scratch);
+	list_append_many(&scratch, (const U8*)&be, sizeof(be));
+	if (size > 0) {
+		list_append_many(&scratch, (const U8*)bytes, size);
+	}
+	record_op(op, key, scratch.items, scratch.count);
+}
+
+void record_image_add(int i)
+{
+	if (i < 0) {
+		return;
+	}
+	Hatori_Blob blob = { 0 };
+	bool owned = false;
+	if (journal.open) {
+		blob = pixels_blob(entities.items[i].entity.image.current, &owned);
+	}
+	record_entity_op(OP_IMAGE_ADD, 0, board_entity(entities.items[i]),
+			blob.data, blob.size);
+	if (owned) {
+		RL_FREE((void*)blob.data);
+	}
+}
+
+void apply_op(U32 op, U32 key, const U8* payload, U32 size)
+{
+	invalidate_op(op, key, payload, size);
+	apply_op_state(op, key, payload, size);
+	invalidate_op(op, key, payload, size);
+}
+
+void apply_op_state(U32 op, U32 key, const U8* payload, U32 size)
+{
+	bool is_entity = key < entities.count && !entities.items[key].deleted;
+	Hatori_BoardEntity be = { 0 };
+	if (size >= sizeof(be)) {
+		memcpy(&be, payload, sizeof(be));
+	}
+	switch (op) {
+	case OP_LINE_ADD:
+		if (key != lines.count) {
+			TraceLog(LOG_WARNING, "JOURNAL: Lines added at %u, there are %zu", key,
+					lines.count);
+			break;
+		}
+		for (U32 i = 0; i + sizeof(Hatori_BoardLine) <= size;
+				i += sizeof(Hatori_BoardLine)) {
+			Hatori_BoardLine bl;
+			memcpy(&bl, payload + i, sizeof(bl));
+			list_append(&lines,
+					((Hatori_Line) { bl.x0, bl.y0, bl.x1, bl.y1, bl.thickness,
+							bl.deleted != 0 }));
+		}
+		break;
+	case OP_LINE_DELETE:
+	case OP_LINE_RESTORE:
+		if (key < lines.count) {
+			lines.items[key].deleted = op == OP_LINE_DELETE;
+			lines_changed(key);
+		}
+		break;
+	case OP_LINES_CLEAR:
+		if (key == 0) {
+			list_clear(&lines);
+			clear_strokes();
+		} else if (key < lines.count) {
+			lines.count = key; // update_strokes() drops what they were part of
+		}
+		break;
+	case OP_ENTITY_POS: {
+		Vector2 pos;
+		if (!is_entity || size != sizeof(pos)) {
+			break;
+		}
+		memcpy(&pos, payload, sizeof(pos));
+		if (entities.items[key].type == ENTITY_IMAGE) {
+			entities.items[key].entity.image.pos = pos;
+		} else {
+			entities.items[key].entity.text.pos = pos;
+		}
+	} break;
+	case OP_ENTITY_SIZE: {
+		Hatori_OpSize op_size;
+		if (!is_entity || size != sizeof(op_size)) {
+			break;
+		}
+		memcpy(&op_size, payload, sizeof(op_size));
+		if (entities.items[key].type == ENTITY_IMAGE) {
+			entities.items[key].entity.image.size = op_size.size;
+		} else {
+			entities.items[key].entity.text.font_size = op_size.font_size;
+			measure_text(&entities.items[key].entity.text);
+		}
+	} break;
+	case OP_ENTITY_DELETE:
+		if (is_entity) {
+			delete_entity(key);
+		}
+		break;
+	case OP_ENTITY_SWAP: {
+		Hatori_OpSwap swap;
+		if (key >= entities.count || size != sizeof(swap)) {
+			break;
+		}
+		memcpy(&swap, payload, sizeof(swap));
+		if (swap.other < entities.count) {
+			swap_entities(key, swap);
+		}
+	} break;
+	case OP_TEXT_ADD:
+		if (size < sizeof(be)) {
+			break;
+		}
+		add_text_entity(make_text(be, (const char*)payload + sizeof(be),
+								size - sizeof(be)),
+				be.z);
+		if (be.z >= z) {
+			z = be.z + 1;
+		}
+		break;
+	case OP_TEXT_SET: {
+		if (!is_entity || entities.items[key].type != ENTITY_TEXT) {
+			break;
+		}
+		Hatori_Text* txt = &entities.items[key].entity.text;
+		Hatori_Text set = make_text(board_entity(entities.items[key]),
+				(const char*)payload, size);
+		free(txt->text.items);
+		txt->text = set.text;
+		measure_text(txt);
+	} break;
+	case OP_IMAGE_ADD: {
+		if (size < sizeof(be)) {
+			break;
+		}
+		Image img = decode_blob_image(
+				(Hatori_Blob) { payload + sizeof(be), size - sizeof(be) });
+		int i = img.data != NULL ? add_image_entity(img, be.pos, be.size) : -1;
+		if (i < 0) {
+			// Keep the indices of later records valid.
+			list_append(&entities,
+					((Hatori_Entity) { .type = ENTITY_IMAGE, .deleted = true }));
+			break;
+		}
+		entities.items[i].z = be.z;
+		if (be.z >= z) {
+			z = be.z + 1;
+		}
+	} break;
+	case OP_IMAGE_COPY:
+		if (size != sizeof(be) || !is_entity
+				|| entities.items[key].type != ENTITY_IMAGE
+				|| copy_image_entity(key, be) < 0) {
+			// Keep the indices of later records valid.
+			list_append(&entities,
+					((Hatori_Entity) { .type = ENTITY_IMAGE, .deleted = true }));
+		}
+		break;
+	case OP_IMAGE_EDIT: {
+		Hatori_ImageEdit edit;
+		if (!is_entity || entities.items[key].type != ENTITY_IMAGE
+				|| size != sizeof(edit)) {
+			break;
+		}
+		memcpy(&edit, payload, sizeof(edit));
+		edit_image(&entities.items[key].entity.image, edit);
+	} break;
+	case OP_ENTITY_RESTORE:
+		if (key >= entities.count || !entities.items[key].deleted) {
+			break;
+		}
+		if (entities.items[key].type == ENTITY_IMAGE) {
+			if (!restore_image_entity(key, payload, size)) {
+				break;
+			}
+		}
+		entities.items[key].deleted = false;
+		break;
+	case OP_IMAGE_TILES:
+		if (is_entity && entities.items[key].type == ENTITY_IMAGE) {
+			apply_image_tiles(&entities.items[key].entity.image, payload, size);
+		}
+		break;
+	default:
+		TraceLog(LOG_WARNING, "JOURNAL: Unknown op %u", op);
+		break;
+	}
+}
+
+// Loads the board at `path` if there is one and replays its journal on top,
+// then keeps journaling every edit until the next board is opened.
+bool open_board(const char* path)
+{
+	double start = GetTime();
+	// Images still being added go to the board they were dropped on.
+	job_wait(&jobs, &image_loads);
+	jobs_drain(&jobs);
+	request_redraw();
+	clear_board_cache();
+	char journal_path[520] = { 0 };
+	snprintf(journal_path, sizeof(journal_path), "%s.journal", path);
+
+	if (FileExists(path)) {
+		if (!load_board(path)) {
+			return false;
+		}
+	} else {
+		clear_board();
+		board_journal_seq = 0;
+		if (path != board_path) {
+			snprintf(board_path, sizeof(board_path), "%s", path);
+		}
+	}
+	journal_close(&journal);
+	clear_undo();
+
+	U64 seq = 0;
+	U64 valid = journal_replay(journal_path, board_journal_seq, apply_op, &seq);
+	if (seq > board_journal_seq) {
+		TraceLog(LOG_INFO, "JOURNAL: [%s] Replayed %llu ops in %.2f ms",
+				journal_path, (unsigned long long)(seq - board_journal_seq),
+				(GetTime() - start) * 1000);
+	}
+	if (!journal_open(&journal, journal_path, valid, seq)) {
+#if !defined(PLATFORM_WEB)
+		TraceLog(LOG_WARNING, "JOURNAL: [%s] Failed to open journal", journal_path);
+#endif
+	}
+	return true;
+}
+
+// Folds the journal into the board file right away with `force`, otherwise
+// when a frame has time once it grows past JOURNAL_CHECKPOINT_SIZE or can't
+// be written, or on the next frame at twice that size.
+void checkpoint_board(bool force)
+{
+	if (force) {
+		cancel_checkpoint();
+		journal_sync(&journal);
+		if (save_board(board_path)) {
+			journal_reset(&journal);
+		}
+		return;
+	}
+	// Without a journal edits are only kept by saving, which keeps failing
+	// too on a full disk, so that isn't retried every frame.
+	bool failed = journal_failed(&journal);
+	if (journal.size >= JOURNAL_CHECKPOINT_SIZE || failed || checkpoint.active) {
+		Idle_Priority priority = failed ? IDLE_NORMAL : IDLE_LOW;
+		if (journal.size >= 2 * JOURNAL_CHECKPOINT_SIZE) {
+			priority = IDLE_URGENT;
+		}
+		idle_post(&idle, "checkpoint_board_step()", checkpoint_board_step, NULL,
+				priority, 4);
+	}
+}
+
+// Idle task, one slice of a checkpoint: the snapshot, a piece of the file or
+// what follows the jobs encoding the pixels and syncing the file. While it
+// waits for those it is done until checkpoint_board() posts it next frame.
+bool checkpoint_board_step(void* arg)
+{
+	Hatori_BoardSave* s = &checkpoint;
+	if (!s->active) {
+		// A save in between may have folded the journal already.
+		if (journal.size < JOURNAL_CHECKPOINT_SIZE && !journal_failed(&journal)) {
+			return true;
+		}
+		if (!board_save_begin(s, board_path)) {
+			board_save_end(s);
+			return true;
+		}
+		s->stage = SAVE_ENCODING;
+		return false;
+	}
+	switch (s->stage) {
+	case SAVE_ENCODING:
+		if (!board_save_encoded(s, false)) {
+			return true;
+		}
+		s->stage = SAVE_WRITING;
+		return false;
+	case SAVE_WRITING:
+		if (!board_save_write(s, BOARD_WRITE_CHUNK)) {
+			return false;
+		}
+		s->stage = SAVE_SYNCING;
+		jobs_spawn(&jobs, &s->syncing, sync_board_job, s);
+		return true;
+	case SAVE_SYNCING:
+		if (atomic_load(&s->syncing.pending) > 0) {
+			return true;
+		}
+		U64 mark = s->journal_mark;
+		if (board_save_end(s) && !journal_reset_after(&journal, mark)) {
+			TraceLog(LOG_WARNING, "JOURNAL: Lost edits made while saving");
+		}
+		return true;
+	}
+	return true;
+}
+
+// Drops a checkpoint that is being written, before the board it took a
+// snapshot of goes away or is saved at once.
+void cancel_checkpoint(void)
+{
+	if (!checkpoint.active) {
+		return;
+	}
+	job_wait(&jobs, &checkpoint.syncing);
+	if (checkpoint.file != NULL) {
+		fclose(checkpoint.file);
+		checkpoint.file = NULL;
+	}
+	remove(checkpoint.tmp_path);
+	board_save_drop(&checkpoint);
+	idle_cancel(&idle, checkpoint_board_step, NULL);
+}
+
+bool restore_image_entity(U64 i, const U8* payload, U32 size)
+{
+	U32 current_size = 0;
+	if (size < sizeof(current_size)) {
+		return false;
+	}
+	memcpy(&current_size, payload, sizeof(current_size));
+	payload += sizeof(current_size);
+	size -= sizeof(current_size);
+	if (current_size > size) {
+		return false;
+	}
+	Hatori_Image* img = &entities.items[i].entity.image;
+	img->current = pixels_from_image(
+			decode_blob_image((Hatori_Blob) { payload, current_size }));
+	if (img->current == NULL) {
+		return false;
+	}
+	img->original = size > current_size
+			? pixels_from_image(decode_blob_image(
+					(Hatori_Blob) { payload + current_size, size - current_size }))
+			: NULL;
+	if (img->original == NULL) {
+		img->original = pixels_retain(img->current);
+	}
+	return true;
+}
+
+void do_op(OpType op, U32 key, const void* payload, U32 size)
+{
+	if (op != OP_IMAGE_EDIT) {
+		capture_undo_op(&undo_step, op, key, payload, size);
+		apply_op(op, key, payload, size);
+		record_op(op, key, payload, size);
+		return;
+	}
+
+	// Pixel edits keep the tiles they change, so grab the ones the edit may
+	// touch and throw away the ones that turn out unchanged afterwards.
+	static List(U32) tiles = { 0 };
+	static List(U8) before = { 0 };
+	static List(U8) after = { 0 };
+	Hatori_ImageEdit edit;
+	if (key >= entities.count || entities.items[key].type != ENTITY_IMAGE
+			|| size != sizeof(edit)
+			|| !load_image_pixels(&entities.items[key].entity.image)) {
+		return;
+	}
+	memcpy(&edit, payload, sizeof(edit));
+	Hatori_Image* img = &entities.items[key].entity.image;
+	Image pixels = img->current->image;
+	Rectangle area = GetCollisionRec(image_edit_area(pixels, edit),
+			(Rectangle) { 0, 0, pixels.width, pixels.height });
+	U32 cols = (pixels.width + UNDO_TILE_SIZE - 1) / UNDO_TILE_SIZE;
+	list_clear(&tiles);
+	list_clear(&before);
+	if (area.width > 0 && area.height > 0) {
+		int x0 = area.x / UNDO_TILE_SIZE;
+		int y0 = area.y / UNDO_TILE_SIZE;
+		int x1 = (area.x + area.width - 1) / UNDO_TILE_SIZE;
+		int y1 = (area.y + area.height - 1) / UNDO_TILE_SIZE;
+		for (int y = y0; y <= y1; ++y) {
+			for (int x = x0; x <= x1; ++x) {
+				U32 tile = y * cols + x;
+				if (map_has(&undo_step.tiles, (U64)key << 32 | tile)) {
+					continue;
+				}
+				Rectangle r = image_tile_rect(pixels, tile);
+				size_t bytes = (size_t)r.width * r.height * 4;
+				list_append(&tiles, tile);
+				list_reserve(&before, before.count + bytes);
+				copy_image_tile(pixels, tile, before.items + before.count);
+				before.count += bytes;
+			}
+		}
+	}
+
+	if (!edit_image(img, edit)) {
+		return;
+	}
+	record_op(op, key, payload, size);
+
+	// Editing may have given the image its own copy of the pixels, or for a
+	// reset, its original ones.
+	if (!load_image_pixels(img)) {
+		return;
+	}
+	pixels = img->current->image;
+	size_t count = 0;
+	size_t read = 0;
+	size_t write = 0;
+	for (size_t i = 0; i < tiles.count; ++i) {
+		Rectangle r = image_tile_rect(pixels, tiles.items[i]);
+		size_t bytes = (size_t)r.width * r.height * 4;
+		list_reserve(&after, bytes);
+		copy_image_tile(pixels, tiles.items[i], after.items);
+		if (memcmp(before.items + read, after.items, bytes) != 0) {
+			memmove(before.items + write, before.items + read, bytes);
+			tiles.items[count++] = tiles.items[i];
+			map_put(&undo_step.tiles, (U64)key << 32 | tiles.items[i], true);
+			write += bytes;
+		}
+		read += bytes;
+	}
+	if (count > 0) {
+		push_image_tiles(
+				&undo_step, key, pixels, tiles.items, count, before.items);
+	}
+}
+
+void push_undo_op(Hatori_UndoStep* step, OpType op, U32 key,
+		const void* payload, U32 size)
+{
+	Hatori_UndoOp u = { op, key, step->data.count, size };
+	list_append(&step->ops, u);
+	if (size > 0) {
+		list_append_many(&step->data, (const U8*)payload, size);
+	}
+}
+
+// Pushes the op that reverts `op` in the current board state onto `step`.
+void capture_undo_op(Hatori_UndoStep* step, OpType op, U32 key,
+		const void* payload, U32 size)
+{
+	static List(U8) scratch = { 0 };
+	bool is_entity = key < entities.count && !entities.items[key].deleted;
+	list_clear(&scratch);
+
+	switch (op) {
+	case OP_LINE_ADD:
+		// Taken off the end again rather than marked deleted, so the line count
+		// is back to what it was and an add undone after it lands where it was.
+		if (key == lines.count && size >= sizeof(Hatori_BoardLine)) {
+			push_undo_op(step, OP_LINES_CLEAR, key, NULL, 0);
+		}
+		break;
+	case OP_LINE_DELETE:
+	case OP_LINE_RESTORE:
+		if (key < lines.count && lines.items[key].deleted != (op == OP_LINE_DELETE)) {
+			push_undo_op(step,
+					op == OP_LINE_DELETE ? OP_LINE_RESTORE : OP_LINE_DELETE, key, NULL,
+					0);
+		}
+		break;
+	case OP_LINES_CLEAR:
+		for (size_t i = key; i < lines.count; ++i) {
+			Hatori_Line l = lines.items[i];
+			Hatori_BoardLine bl
+					= { l.x0, l.y0, l.x1, l.y1, (U32)l.thickness, l.deleted };
+			list_append_many(&scratch, (const U8*)&bl, sizeof(bl));
+		}
+		if (scratch.count > 0) {
+			push_undo_op(step, OP_LINE_ADD, key, scratch.items, scratch.count);
+		}
+		break;
+	case OP_ENTITY_POS:
+	case OP_ENTITY_SIZE:
+	case OP_TEXT_SET: {
+		if (!is_entity) {
+			break;
+		}
+		// Only the state from before the first one matters.
+		for (size_t i = 0; i < step->ops.count; ++i) {
+			if (step->ops.items[i].op == op && step->ops.items[i].key == key) {
+				return;
+			}
+		}
+		Hatori_Entity e = entities.items[key];
+		if (op == OP_ENTITY_POS) {
+			Vector2 pos = e.type == ENTITY_IMAGE ? e.entity.image.pos
+																					 : e.entity.text.pos;
+			push_undo_op(step, op, key, &pos, sizeof(pos));
+		} else if (op == OP_ENTITY_SIZE) {
+			Hatori_OpSize op_size = { e.entity.image.size, 0 };
+			if (e.type == ENTITY_TEXT) {
+				op_size = (Hatori_OpSize) { { 0 }, e.entity.text.font_size };
+			}
+			push_undo_op(step, op, key, &op_size, sizeof(op_size));
+		} else if (e.type == ENTITY_TEXT) {
+			push_undo_op(step, op, key, e.entity.text.text.items,
+					e.entity.text.text.count);
+		}
+	} break;
+	case OP_ENTITY_DELETE: {
+		if (!is_entity) {
+			break;
+		}
+		if (entities.items[key].type == ENTITY_TEXT) {
+			push_undo_op(step, OP_ENTITY_RESTORE, key, NULL, 0);
+			break;
+		}
+		// Deleting an image drops its pixels, so the restore op carries them.
+		Hatori_Image* img = &entities.items[key].entity.image;
+		bool owned[2] = { false, false };
+		Hatori_Blob current = pixels_blob(img->current, &owned[0]);
+		Hatori_Blob original = { 0 };
+		if (img->original != img->current) {
+			original = pixels_blob(img->original, &owned[1]);
+		}
+		if (current.data != NULL) {
+			list_append_many(&scratch, (const U8*)&current.size, sizeof(U32));
+			list_append_many(&scratch, current.data, current.size);
+			if (original.size > 0) {
+				list_append_many(&scratch, original.data, original.size);
+			}
+			push_undo_op(step, OP_ENTITY_RESTORE, key, scratch.items, scratch.count);
+		}
+		if (owned[0]) {
+			RL_FREE((void*)current.data);
+		}
+		if (owned[1]) {
+			RL_FREE((void*)original.data);
+		}
+	} break;
+	case OP_ENTITY_RESTORE:
+		if (key < entities.count && entities.items[key].deleted) {
+			push_undo_op(step, OP_ENTITY_DELETE, key, NULL, 0);
+		}
+		break;
+	case OP_ENTITY_SWAP: {
+		Hatori_OpSwap swap;
+		if (key >= entities.count || size != sizeof(swap)) {
+			break;
+		}
+		memcpy(&swap, payload, sizeof(swap));
+		if (swap.other >= entities.count) {
+			break;
+		}
+		Hatori_OpSwap back = {
+			.other = swap.other,
+			.z = entities.items[key].z,
+			.other_z = entities.items[swap.other].z,
+		};
+		push_undo_op(step, op, key, &back, sizeof(back));
+	} break;
+	case OP_TEXT_ADD:
+	case OP_IMAGE_ADD:
+	case OP_IMAGE_COPY:
+		push_undo_op(step, OP_ENTITY_DELETE, entities.count, NULL, 0);
+		break;
+	case OP_IMAGE_TILES: {
+		Hatori_OpTiles header;
+		if (!is_entity || entities.items[key].type != ENTITY_IMAGE
+				|| size < sizeof(header)
+				|| !load_image_pixels(&entities.items[key].entity.image)) {
+			break;
+		}
+		memcpy(&header, payload, sizeof(header));
+		Image img = entities.items[key].entity.image.current->image;
+		U32 cols = (img.width + UNDO_TILE_SIZE - 1) / UNDO_TILE_SIZE;
+		U32 offset = sizeof(header);
+		for (U32 i = 0; i < header.count && offset + sizeof(Hatori_OpTile) <= size;
+				++i) {
+			Hatori_OpTile tile;
+			memcpy(&tile, (const U8*)payload + offset, sizeof(tile));
+			U32 index = tile.y * cols + tile.x;
+			list_append_many(&scratch, (const U8*)&index, sizeof(index));
+			offset += sizeof(tile) + tile.size;
+		}
+		push_image_tiles(step, key, img, (const U32*)scratch.items,
+				scratch.count / sizeof(U32), NULL);
+	} break;
+	default:
+		break;
+	}
+}
+
+Rectangle image_tile_rect(Image img, U32 tile)
+{
+	U32 cols = (img.width + UNDO_TILE_SIZE - 1) / UNDO_TILE_SIZE;
+	int x = tile % cols * UNDO_TILE_SIZE;
+	int y = tile / cols * UNDO_TILE_SIZE;
+	int width = img.width - x < UNDO_TILE_SIZE ? img.width - x : UNDO_TILE_SIZE;
+	int height
+			= img.height - y < UNDO_TILE_SIZE ? img.height - y : UNDO_TILE_SIZE;
+	return (Rectangle) { x, y, width, height };
+}
+
+// Part of the image `edit` can change, in image pixels.
+Rectangle image_edit_area(Image img, Hatori_ImageEdit edit)
+{
+	if (edit.type == EDIT_ERASE) {
+		return (Rectangle) { edit.pos.x - edit.amount - 1,
+			edit.pos.y - edit.amount - 1, edit.amount * 2 + 3,
+			edit.amount * 2 + 3 };
+	}
+	return (Rectangle) { 0, 0, img.width, img.height };
+}
+
+void copy_image_tile(Image img, U32 tile, U8* dst)
+{
+	Rectangle r = image_tile_rect(img, tile);
+	size_t row = (size_t)r.width * 4;
+	for (int y = 0; y < r.height; ++y) {
+		memcpy(dst + y * row,
+				(U8*)img.data + (((size_t)r.y + y) * img.width + (size_t)r.x) * 4, row);
+	}
+}
+
+// Pushes an OP_IMAGE_TILES op for `tiles` of `img`. `pixels` holds their
+// packed contents in the same order, or NULL to take them from `img`.
+void push_image_tiles(Hatori_UndoStep* step, U32 key, Image img,
+		const U32* tiles, U32 count, const U8* pixels)
+{
+	static List(U8) payload = { 0 };
+	static List(U8) tile_pixels = { 0 };
+	Hatori_OpTiles header = { count, img.width, img.height };
+	U32 cols = (img.width + UNDO_TILE_SIZE - 1) / UNDO_TILE_SIZE;
+	list_clear(&payload);
+	list_append_many(&payload, (const U8*)&header, sizeof(header));
+	for (U32 i = 0; i < count; ++i) {
+		Rectangle r = image_tile_rect(img, tiles[i]);
+		size_t bytes = (size_t)r.width * r.height * 4;
+		const U8* data = pixels;
+		if (pixels == NULL) {
+			list_reserve(&tile_pixels, bytes);
+			copy_image_tile(img, tiles[i], tile_pixels.items);
+			data = tile_pixels.items;
+		} else {
+			pixels += bytes;
+		}
+		qoi_desc desc = { r.width, r.height, 4, QOI_SRGB };
+		int qoi_size = 0;
+		U8* qoi = qoi_encode(data, &desc, &qoi_size);
+		if (qoi == NULL) {
+			continue;
+		}
+		Hatori_OpTile tile = { tiles[i] % cols, tiles[i] / cols, qoi_size };
+		list_append_many(&payload, (const U8*)&tile, sizeof(tile));
+		list_append_many(&payload, qoi, (size_t)qoi_size);
+		RL_FREE(qoi);
+	}
+	push_undo_op(step, OP_IMAGE_TILES, key, payload.items, payload.count);
+}
+
+void apply_image_tiles(Hatori_Image* img, const U8* payload, U32 size)
+{
+	Hatori_OpTiles header;
+	Image* pixels = NULL;
+	if (size < sizeof(header) || img->current == NULL) {
+		return;
+	}
+	memcpy(&header, payload, sizeof(header));
+	if (header.width != (U32)img->current->width
+			|| header.height != (U32)img->current->height
+			|| (pixels = edit_pixels(&img->current)) == NULL) {
+		return;
+	}
+	U32 cols = (header.width + UNDO_TILE_SIZE - 1) / UNDO_TILE_SIZE;
+	U32 rows = (header.height + UNDO_TILE_SIZE - 1) / UNDO_TILE_SIZE;
+	U32 offset = sizeof(header);
+	Rectangle changed = { 0 };
+	for (U32 i = 0; i < header.count; ++i) {
+		Hatori_OpTile tile;
+		if (offset + sizeof(tile) > size) {
+			break;
+		}
+		memcpy(&tile, payload + offset, sizeof(tile));
+		offset += sizeof(tile);
+		if (tile.size > size - offset) {
+			break;
+		}
+		qoi_desc desc = { 0 };
+		U8* data = tile.x < cols && tile.y < rows
+				? qoi_decode(payload + offset, tile.size, &desc, 4)
+				: NULL;
+		offset += tile.size;
+		if (data == NULL) {
+			continue;
+		}
+		Rectangle r = image_tile_rect(*pixels, tile.y * cols + tile.x);
+		if (desc.width == (U32)r.width && desc.height == (U32)r.height) {
+			size_t row = (size_t)r.width * 4;
+			for (int y = 0; y < r.height; ++y) {
+				memcpy((U8*)pixels->data
+								+ (((size_t)r.y + y) * pixels->width + (size_t)r.x) * 4,
+						data + y * row, row);
+			}
+			changed = rect_union(changed, r);
+		}
+		RL_FREE(data);
+	}
+	pixels_changed(img->current, changed);
+}
+
+Hatori_UndoStep run_undo_step(Hatori_UndoStep* step)
+{
+	Hatori_UndoStep inverse = { 0 };
+	for (size_t i = step->ops.count; i-- > 0;) {
+		Hatori_UndoOp u = step->ops.items[i];
+		const U8* payload = step->data.items + u.offset;
+		capture_undo_op(&inverse, u.op, u.key, payload, u.size);
+		apply_op(u.op, u.key, payload, u.size);
+		record_op(u.op, u.key, payload, u.size);
+	}
+	map_free(&inverse.tiles);
+	return inverse;
+}
+
+void free_undo_step(Hatori_UndoStep* step)
+{
+	free(step->ops.items);
+	free(step->data.items);
+	map_free(&step->tiles);
+	*step = (Hatori_UndoStep) { 0 };
+}
+
+U64 undo_step_bytes(Hatori_UndoStep* step)
+{
+	return step->ops.capacity * sizeof(*step->ops.items)
+			+ step->data.capacity * sizeof(*step->data.items)
+			+ map_bytes(&step->tiles);
+}
+
+// Closes the step of the action in progress and pushes it onto the history.
+void end_undo_step(void)
+{
+	if (undo_step.ops.count == 0) {
+		return;
+	}
+	Hatori_UndoStep step = undo_step;
+	undo_step = (Hatori_UndoStep) { 0 };
+	map_free(&step.tiles);
+
+	for (size_t i = 0; i < redo_stack.count; ++i) {
+		undo_bytes -= undo_step_bytes(&redo_stack.items[i]);
+		free_undo_step(&redo_stack.items[i]);
+	}
+	list_clear(&redo_stack);
+
+	// Typing into the same text undoes as one step.
+	if (undo_stack.count > 0 && step.ops.count == 1
+			&& step.ops.items[0].op == OP_TEXT_SET) {
+		Hatori_UndoStep* top = &undo_stack.items[undo_stack.count - 1];
+		if (top->ops.count == 1 && top->ops.items[0].op == OP_TEXT_SET
+				&& top->ops.items[0].key == step.ops.items[0].key) {
+			free_undo_step(&step);
+			return;
+		}
+	}
+
+	list_shrink(&step.ops);
+	list_shrink(&step.data);
+	list_append(&undo_stack, step);
+	undo_bytes += undo_step_bytes(&step);
+	compress_originals();
+
+	size_t drop = 0;
+	while (undo_bytes > undo_budget && drop + 1 < undo_stack.count) {
+		undo_bytes -= undo_step_bytes(&undo_stack.items[drop]);
+		free_undo_step(&undo_stack.items[drop]);
+		drop++;
+	}
+	if (drop > 0) {
+		memmove(undo_stack.items, undo_stack.items + drop,
+				(undo_stack.count - drop) * sizeof(*undo_stack.items));
+		undo_stack.count -= drop;
+	}
+}
+
+// Runs the newest step of `from` and pushes the step that reverts it onto
+// `to`. Used for both undo and redo.
+void move_undo_step(Hatori_UndoStack* from, Hatori_UndoStack* to)
+{
+	end_undo_step();
+	if (from->count == 0) {
+		return;
+	}
+	Hatori_UndoStep step = from->items[--from->count];
+	Hatori_UndoStep inverse = run_undo_step(&step);
+	undo_bytes -= undo_step_bytes(&step);
+	free_undo_step(&step);
+	list_append(to, inverse);
+	undo_bytes += undo_step_bytes(&inverse);
+
+	if (selected_entity >= (int)entities.count
+			|| (selected_entity != -1 && entities.items[selected_entity].deleted)) {
+		selected_entity = -1;
+	}
+	resizer.selected = -1;
+	compress_originals();
+}
+
+void clear_undo(void)
+{
+	free_undo_step(&undo_step);
+	for (size_t i = 0; i < undo_stack.count; ++i) {
+		free_undo_step(&undo_stack.items[i]);
+	}
+	for (size_t i = 0; i < redo_stack.count; ++i) {
+		free_undo_step(&redo_stack.items[i]);
+	}
+	list_clear(&undo_stack);
+	list_clear(&redo_stack);
+	undo_bytes = 0;
 }
@@ -0,0 +1,184 @@
+#ifndef IDLE
+#define IDLE
+// Housekeeping that runs in the time a frame has left.
+//
+// Work that has to stay on the main thread, because it touches GL or state
+// the frame uses, but that no frame is waiting for is posted as a task. Its
+// step does one slice of the work and returns true once the task is done.
+// idle_run() runs slices, most urgent first, for as long as the slack it is
+// given lasts and skips those whose last slice took longer than what is left,
+// so big slices wait for a frame with more room. A task that waited past the
+// deadline of its priority gets one slice per frame whatever it costs, so
+// nothing starves while the frames stay busy.
+//
+// Slice times are remembered per task name, a task posted again starts from
+// what it took last time instead of the estimate it is posted with.
+#include <stdbool.h>
+
+#include "ds.h"
+#include "profiler.h"
+
+#define IDLE_NAMES 32
+
+typedef enum Idle_Priority {
+	IDLE_LOW,
+	IDLE_NORMAL,
+	IDLE_HIGH,
+	IDLE_URGENT,
+} Idle_Priority;
+
+// Frames a task of each priority waits for room before it runs anyway.
+static const U64 idle_deadlines[] = { 600, 120, 15, 0 };
+
+typedef bool (*Idle_Step)(void* arg);
+
+typedef struct Idle_Task {
+	const char* name; // a string literal, also the scope in the profiler
+	Idle_Step step;
+	void* arg;
+	Idle_Priority priority;
+	U64 deadline; // frame
+	U64 ran; // frame of the last slice
+} Idle_Task;
+
+typedef struct Idle_Cost {
+	const char* name;
+	double ms; // of a slice, leaning towards the slowest
+} Idle_Cost;
+
+typedef struct Idle {
+	List(Idle_Task) tasks;
+	Idle_Cost costs[IDLE_NAMES];
+	int cost_count;
+	U64 frame; // idle_run() calls
+	// Stats
+	double slack_ms; // given to the last idle_run()
+	double used_ms; // of it
+	U64 slices;
+	U64 late; // slices run past their deadline without room
+	U64 done;
+} Idle;
+
+static inline Idle_Cost* idle_cost(Idle* idle, const char* name)
+{
+	for (int i = 0; i < idle->cost_count; ++i) {
+		if (idle->costs[i].name == name) {
+			return &idle->costs[i];
+		}
+	}
+	if (idle->cost_count == IDLE_NAMES) {
+		return NULL;
+	}
+	Idle_Cost* c = &idle->costs[idle->cost_count++];
+	*c = (Idle_Cost) { .name = name, .ms = -1 };
+	return c;
+}
+
+static inline Idle_Task* idle_find(Idle* idle, Idle_Step step, void* arg)
+{
+	for (size_t i = 0; i < idle->tasks.count; ++i) {
+		Idle_Task* t = &idle->tasks.items[i];
+		if (t->step == step && t->arg == arg) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+// Queues `step(arg)` unless it already is, then only raises its priority.
+// `estimate_ms` is how long a slice is guessed to take until one has run.
+static inline void idle_post(Idle* idle, const char* name, Idle_Step step,
+		void* arg, Idle_Priority priority, double estimate_ms)
+{
+	U64 deadline = idle->frame + idle_deadlines[priority];
+	Idle_Task* t = idle_find(idle, step, arg);
+	if (t != NULL) {
+		if (priority > t->priority) {
+			t->priority = priority;
+		}
+		if (deadline < t->deadline) {
+			t->deadline = deadline;
+		}
+		return;
+	}
+	Idle_Cost* c = idle_cost(idle, name);
+	if (c != NULL && c->ms < 0) {
+		c->ms = estimate_ms;
+	}
+	list_append(&idle->tasks,
+			((Idle_Task) { name, step, arg, priority, deadline, UINT64_MAX }));
+}
+
+// Drops the queued `step(arg)`, if any.
+static inline void idle_cancel(Idle* idle, Idle_Step step, void* arg)
+{
+	Idle_Task* t = idle_find(idle, step, arg);
+	if (t != NULL) {
+		*t = idle->tasks.items[--idle->tasks.count];
+	}
+}
+
+static inline bool idle_pending(Idle* idle)
+{
+	return idle->tasks.count > 0;
+}
+
+// Runs slices for up to `slack_ms`. When `quiet`, nobody is waiting for the
+// frame and the most urgent task gets a slice even if it doesn't fit.
+static inline void idle_run(
+		Idle* idle, Profiler* profiler, double slack_ms, bool quiet)
+{
+	U64 start = profile_now();
+	U64 until = start + (U64)(slack_ms > 0 ? slack_ms * 1e6 : 0);
+	U64 frame = ++idle->frame;
+	bool first = true;
+	for (;;) {
+		U64 now = profile_now();
+		Idle_Task* best = NULL;
+		Idle_Priority best_priority = IDLE_LOW;
+		bool best_fits = false;
+		for (size_t i = 0; i < idle->tasks.count; ++i) {
+			Idle_Task* t = &idle->tasks.items[i];
+			Idle_Cost* c = idle_cost(idle, t->name);
+			double ms = c != NULL ? c->ms : 0;
+			bool fits = now + (U64)(ms * 1e6) <= until || (quiet && first);
+			bool late = frame >= t->deadline && t->ran != frame;
+			if (!fits && !late) {
+				continue;
+			}
+			Idle_Priority p = late ? IDLE_URGENT : t->priority;
+			if (best == NULL || p > best_priority
+					|| (p == best_priority && t->deadline < best->deadline)) {
+				best = t;
+				best_priority = p;
+				best_fits = fits;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		// The step may post or cancel tasks, which moves them around.
+		Idle_Task task = *best;
+		best->ran = frame;
+		U64 slice_start = profile_now();
+		bool done = task.step(task.arg);
+		U64 slice_end = profile_now();
+		profile_record(profiler, task.name, slice_start, slice_end);
+		Idle_Cost* c = idle_cost(idle, task.name);
+		if (c != NULL) {
+			double ms = (slice_end - slice_start) / 1e6;
+			c->ms = ms > c->ms ? ms : c->ms * 0.75 + ms * 0.25;
+		}
+		idle->slices++;
+		idle->late += !best_fits;
+		if (done) {
+			idle_cancel(idle, task.step, task.arg);
+			idle->done++;
+		}
+		first = false;
+	}
+	idle->slack_ms = slack_ms;
+	idle->used_ms = (profile_now() - start) / 1e6;
+}
+
+#endif // !IDLE
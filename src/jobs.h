@@ -0,0 +1,495 @@
+#ifndef JOBS
+#define JOBS
+// Work-stealing job system.
+//
+// Every worker thread and the main thread own a deque of jobs. A thread pushes
+// and pops at the bottom of its own deque (newest first, while the data is
+// still in cache) and, when that is empty, steals from the top of a random
+// other one (oldest first, the biggest pieces of a split). The deques are the
+// lock-free ones of Chase and Lev, with the memory orders of Le et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models".
+//
+// Jobs may only be spawned from the main thread and from jobs. A Job_Group
+// counts the jobs spawned into it, job_wait() helps with jobs of that group
+// until they are done. It never picks up unrelated jobs, which would keep the
+// waiter busy past the end of the group and pile their data up on its stack.
+// Once none of the group are left to take, it sleeps until the ones running
+// elsewhere finish instead of spinning, so with more threads than cores the
+// waiters don't take the cores from the threads they wait for.
+// Work that has to happen on the main thread after a job, anything touching
+// raylib or GL, is queued with jobs_complete() and run by jobs_drain() once
+// per frame.
+//
+// Without threads (the web build, or zero workers) jobs run where they are
+// spawned, completions still wait for jobs_drain().
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ds.h"
+
+#if !defined(PLATFORM_WEB)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#define JOB_DEQUE_SIZE 1024 // a power of two
+#define JOB_MAX_WORKERS 16
+#define JOB_MAX_SPLITS 64 // most jobs one jobs_parallel_for() makes
+#define JOB_WAIT_TRIES 16 // failed attempts before job_wait() sleeps
+
+typedef void (*Job_Fn)(void* arg);
+typedef void (*Job_Range_Fn)(void* arg, size_t from, size_t to);
+
+typedef struct Job_Group {
+	_Atomic int pending;
+} Job_Group;
+
+// Fields are atomic since a thief may read a slot the owner is reusing,
+// it then fails to take the job and drops what it read.
+typedef struct Job_Slot {
+	_Atomic(Job_Fn) fn;
+	_Atomic(void*) arg;
+	_Atomic(Job_Group*) group;
+} Job_Slot;
+
+typedef struct Job_Deque {
+	_Atomic int64_t top; // next to steal
+	_Atomic int64_t bottom; // next to push
+	Job_Slot slots[JOB_DEQUE_SIZE];
+} Job_Deque;
+
+typedef struct Job_Completion {
+	Job_Fn fn;
+	void* arg;
+} Job_Completion;
+
+typedef struct Jobs {
+	int workers; // threads besides the main one
+	Job_Deque deques[JOB_MAX_WORKERS + 1]; // 0 is the main thread's
+	_Atomic int queued; // jobs in the deques
+	_Atomic int active; // jobs spawned and not finished yet
+	_Atomic int sleeping;
+	_Atomic int waiting; // threads asleep in job_wait()
+	_Atomic bool running;
+	List(Job_Completion) completions;
+	_Atomic int completion_count;
+	// Stats, since jobs_init().
+	_Atomic U64 run;
+	_Atomic U64 stolen;
+	_Atomic U64 run_inline; // deque full, or spawned from another thread
+	_Atomic U64 completed;
+	_Atomic int max_queued;
+#if !defined(PLATFORM_WEB)
+	pthread_t threads[JOB_MAX_WORKERS];
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done; // a group finished
+#endif
+} Jobs;
+
+typedef struct Jobs_Stats {
+	int workers;
+	int queued;
+	int max_queued;
+	int active;
+	U64 run;
+	U64 stolen;
+	U64 run_inline;
+	U64 completed;
+} Jobs_Stats;
+
+static _Thread_local int job_thread = -1; // index of the thread's deque
+static _Thread_local U32 job_random;
+
+static inline bool job_push(
+		Job_Deque* d, Job_Fn fn, void* arg, Job_Group* group)
+{
+	int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+	if (b - t >= JOB_DEQUE_SIZE) {
+		return false;
+	}
+	Job_Slot* s = &d->slots[b & (JOB_DEQUE_SIZE - 1)];
+	atomic_store_explicit(&s->fn, fn, memory_order_relaxed);
+	atomic_store_explicit(&s->arg, arg, memory_order_relaxed);
+	atomic_store_explicit(&s->group, group, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	return true;
+}
+
+static inline void job_read(
+		Job_Slot* s, Job_Fn* fn, void** arg, Job_Group** group)
+{
+	*fn = atomic_load_explicit(&s->fn, memory_order_relaxed);
+	*arg = atomic_load_explicit(&s->arg, memory_order_relaxed);
+	*group = atomic_load_explicit(&s->group, memory_order_relaxed);
+}
+
+static inline bool job_pop(
+		Job_Deque* d, Job_Fn* fn, void** arg, Job_Group** group)
+{
+	int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+	bool ok = t <= b;
+	if (ok) {
+		job_read(&d->slots[b & (JOB_DEQUE_SIZE - 1)], fn, arg, group);
+		if (t == b) {
+			// The last one, thieves may be after it too.
+			ok = atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+					memory_order_seq_cst, memory_order_relaxed);
+			atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+	return ok;
+}
+
+// Whether the job job_pop() would take next belongs to `group`. Only the
+// owner of `d` may call it.
+static inline bool job_next_in(Job_Deque* d, Job_Group* group)
+{
+	int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+	return t <= b
+			&& atomic_load_explicit(
+						 &d->slots[b & (JOB_DEQUE_SIZE - 1)].group, memory_order_relaxed)
+			== group;
+}
+
+// Takes the oldest job of `d`, only if it belongs to `only` unless that is
+// NULL.
+static inline bool job_steal(Job_Deque* d, Job_Group* only, Job_Fn* fn,
+		void** arg, Job_Group** group)
+{
+	int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	if (t >= b) {
+		return false;
+	}
+	job_read(&d->slots[t & (JOB_DEQUE_SIZE - 1)], fn, arg, group);
+	if (only != NULL && *group != only) {
+		return false;
+	}
+	return atomic_compare_exchange_strong_explicit(
+			&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static inline void job_finish(Jobs* jobs, Job_Group* group)
+{
+	// Sequentially consistent with the `waiting` count, so either job_wait()
+	// sees the group done or this sees the waiter.
+	if (group != NULL && atomic_fetch_sub(&group->pending, 1) == 1) {
+#if !defined(PLATFORM_WEB)
+		if (atomic_load(&jobs->waiting) > 0) {
+			pthread_mutex_lock(&jobs->lock);
+			pthread_cond_broadcast(&jobs->done);
+			pthread_mutex_unlock(&jobs->lock);
+		}
+#endif
+	}
+	atomic_fetch_sub_explicit(&jobs->active, 1, memory_order_release);
+}
+
+// Runs one job from the thread's own deque or, failing that, a stolen one.
+// With `only`, just a job of that group.
+static inline bool job_run_one(Jobs* jobs, Job_Group* only)
+{
+	Job_Fn fn;
+	void* arg;
+	Job_Group* group;
+	int self = job_thread;
+	Job_Deque* own = &jobs->deques[self];
+	bool found = (only == NULL || job_next_in(own, only))
+			&& job_pop(own, &fn, &arg, &group);
+	int threads = jobs->workers + 1;
+	for (int i = 0; !found && i < threads * 2; ++i) {
+		job_random = job_random * 1664525 + 1013904223;
+		int victim = (job_random >> 16) % threads;
+		if (victim != self
+				&& job_steal(&jobs->deques[victim], only, &fn, &arg, &group)) {
+			found = true;
+			atomic_fetch_add_explicit(&jobs->stolen, 1, memory_order_relaxed);
+		}
+	}
+	if (!found) {
+		return false;
+	}
+	atomic_fetch_sub(&jobs->queued, 1);
+	fn(arg);
+	atomic_fetch_add_explicit(&jobs->run, 1, memory_order_relaxed);
+	job_finish(jobs, group);
+	return true;
+}
+
+#if !defined(PLATFORM_WEB)
+typedef struct Job_Worker {
+	Jobs* jobs;
+	int index;
+} Job_Worker;
+
+static inline void* job_worker(void* arg)
+{
+	Job_Worker w = *(Job_Worker*)arg;
+	free(arg);
+	Jobs* jobs = w.jobs;
+	job_thread = w.index;
+	job_random = w.index * 2654435761u;
+	while (atomic_load(&jobs->running)) {
+		if (job_run_one(jobs, NULL)) {
+			continue;
+		}
+		pthread_mutex_lock(&jobs->lock);
+		atomic_fetch_add(&jobs->sleeping, 1);
+		while (atomic_load(&jobs->queued) == 0 && atomic_load(&jobs->running)) {
+			pthread_cond_wait(&jobs->wake, &jobs->lock);
+		}
+		atomic_fetch_sub(&jobs->sleeping, 1);
+		pthread_mutex_unlock(&jobs->lock);
+	}
+	return NULL;
+}
+#endif
+
+// Starts `workers` threads, fewer when JOB_MAX_WORKERS is lower. Call from
+// the main thread.
+static inline void jobs_init(Jobs* jobs, int workers)
+{
+	memset(jobs, 0, sizeof(*jobs));
+	job_thread = 0;
+	job_random = 1;
+#if defined(PLATFORM_WEB)
+	workers = 0;
+#else
+	workers = workers < 0 ? 0 : workers;
+	workers = workers > JOB_MAX_WORKERS ? JOB_MAX_WORKERS : workers;
+	atomic_store(&jobs->running, true);
+	pthread_mutex_init(&jobs->lock, NULL);
+	pthread_cond_init(&jobs->wake, NULL);
+	pthread_cond_init(&jobs->done, NULL);
+	// Workers read the count to pick victims, so it's set before they start.
+	jobs->workers = workers;
+	for (int i = 0; i < workers; ++i) {
+		Job_Worker* w = malloc(sizeof(*w));
+		assert(w != NULL && "Buy more RAM!!");
+		*w = (Job_Worker) { jobs, i + 1 };
+		if (pthread_create(&jobs->threads[i], NULL, job_worker, w) != 0) {
+			// Run everything inline rather than with fewer workers than counted.
+			free(w);
+			pthread_mutex_lock(&jobs->lock);
+			atomic_store(&jobs->running, false);
+			pthread_cond_broadcast(&jobs->wake);
+			pthread_mutex_unlock(&jobs->lock);
+			for (int j = 0; j < i; ++j) {
+				pthread_join(jobs->threads[j], NULL);
+			}
+			jobs->workers = 0;
+			break;
+		}
+	}
+#endif
+}
+
+// One thread per core, the main thread being one of them.
+static inline int jobs_default_workers(void)
+{
+#if defined(PLATFORM_WEB)
+	return 0;
+#else
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 1 ? cores - 1 : 0;
+#endif
+}
+
+// Runs `fn(arg)` on some thread. `group` may be NULL.
+static inline void jobs_spawn(
+		Jobs* jobs, Job_Group* group, Job_Fn fn, void* arg)
+{
+	if (group != NULL) {
+		atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&jobs->active, 1, memory_order_relaxed);
+	if (jobs->workers == 0 || job_thread < 0
+			|| !job_push(&jobs->deques[job_thread], fn, arg, group)) {
+		fn(arg);
+		atomic_fetch_add_explicit(&jobs->run_inline, 1, memory_order_relaxed);
+		job_finish(jobs, group);
+		return;
+	}
+	int queued = atomic_fetch_add(&jobs->queued, 1) + 1;
+	int max = atomic_load_explicit(&jobs->max_queued, memory_order_relaxed);
+	while (queued > max
+			&& !atomic_compare_exchange_weak_explicit(&jobs->max_queued, &max,
+					queued, memory_order_relaxed, memory_order_relaxed)) {
+	}
+#if !defined(PLATFORM_WEB)
+	if (atomic_load(&jobs->sleeping) > 0) {
+		pthread_mutex_lock(&jobs->lock);
+		pthread_cond_signal(&jobs->wake);
+		pthread_mutex_unlock(&jobs->lock);
+	}
+#endif
+}
+
+// Runs jobs of `group` until every one of them is done. The waiter spawned
+// the group's jobs onto its own deque, so when it can't find one the rest
+// are running on other threads and it can sleep until they are done.
+static inline void job_wait(Jobs* jobs, Job_Group* group)
+{
+	int tries = 0;
+	while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+		if (job_thread >= 0 && job_run_one(jobs, group)) {
+			tries = 0;
+			continue;
+		}
+#if !defined(PLATFORM_WEB)
+		if (++tries < JOB_WAIT_TRIES) {
+			sched_yield();
+			continue;
+		}
+		pthread_mutex_lock(&jobs->lock);
+		atomic_fetch_add(&jobs->waiting, 1);
+		while (atomic_load(&group->pending) > 0) {
+			pthread_cond_wait(&jobs->done, &jobs->lock);
+		}
+		atomic_fetch_sub(&jobs->waiting, 1);
+		pthread_mutex_unlock(&jobs->lock);
+#endif
+	}
+}
+
+typedef struct Job_Range {
+	Job_Range_Fn fn;
+	void* arg;
+	size_t from;
+	size_t to;
+} Job_Range;
+
+static inline void job_run_range(void* arg)
+{
+	Job_Range* r = arg;
+	r->fn(r->arg, r->from, r->to);
+}
+
+// Calls `fn(arg, from, to)` over [0, count) split into ranges of at least
+// `grain` items, in parallel, and returns once all of them are done.
+static inline void jobs_parallel_for(
+		Jobs* jobs, size_t count, size_t grain, Job_Range_Fn fn, void* arg)
+{
+	grain = grain > 0 ? grain : 1;
+	size_t splits = (count + grain - 1) / grain;
+	size_t most = jobs->workers * 4 + 1;
+	splits = splits < most ? splits : most;
+	splits = splits < JOB_MAX_SPLITS ? splits : JOB_MAX_SPLITS;
+	if (splits <= 1 || job_thread < 0) {
+		fn(arg, 0, count);
+		return;
+	}
+	Job_Range ranges[JOB_MAX_SPLITS];
+	Job_Group group = { 0 };
+	for (size_t i = 0; i < splits; ++i) {
+		ranges[i] = (Job_Range) { fn, arg, count * i / splits,
+			count * (i + 1) / splits };
+	}
+	for (size_t i = 1; i < splits; ++i) {
+		jobs_spawn(jobs, &group, job_run_range, &ranges[i]);
+	}
+	job_run_range(&ranges[0]);
+	job_wait(jobs, &group);
+}
+
+// Queues `fn(arg)` to run on the main thread in the next jobs_drain(). Any
+// thread may call it.
+static inline void jobs_complete(Jobs* jobs, Job_Fn fn, void* arg)
+{
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&jobs->lock);
+#endif
+	list_append(&jobs->completions, ((Job_Completion) { fn, arg }));
+	atomic_fetch_add(&jobs->completion_count, 1);
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_unlock(&jobs->lock);
+#endif
+}
+
+// Runs the completions queued so far, on the main thread.
+static inline void jobs_drain(Jobs* jobs)
+{
+	static List(Job_Completion) batch = { 0 };
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&jobs->lock);
+#endif
+	list_clear(&batch);
+	list_append_many(&batch, jobs->completions.items, jobs->completions.count);
+	list_clear(&jobs->completions);
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_unlock(&jobs->lock);
+#endif
+	for (size_t i = 0; i < batch.count; ++i) {
+		batch.items[i].fn(batch.items[i].arg);
+		atomic_fetch_sub(&jobs->completion_count, 1);
+		atomic_fetch_add_explicit(&jobs->completed, 1, memory_order_relaxed);
+	}
+}
+
+// True while jobs are running or completions are waiting for jobs_drain().
+static inline bool jobs_busy(Jobs* jobs)
+{
+	return atomic_load(&jobs->active) > 0
+			|| atomic_load(&jobs->completion_count) > 0;
+}
+
+// Helps with the jobs until none are left, then drains the completions.
+static inline void jobs_finish(Jobs* jobs)
+{
+	while (jobs_busy(jobs)) {
+		if (!job_run_one(jobs, NULL)) {
+#if !defined(PLATFORM_WEB)
+			sched_yield();
+#endif
+		}
+		jobs_drain(jobs);
+	}
+}
+
+static inline Jobs_Stats jobs_stats(Jobs* jobs)
+{
+	return (Jobs_Stats) {
+		.workers = jobs->workers,
+		.queued = atomic_load(&jobs->queued),
+		.max_queued = atomic_load(&jobs->max_queued),
+		.active = atomic_load(&jobs->active),
+		.run = atomic_load(&jobs->run),
+		.stolen = atomic_load(&jobs->stolen),
+		.run_inline = atomic_load(&jobs->run_inline),
+		.completed = atomic_load(&jobs->completed),
+	};
+}
+
+// Finishes every job and completion, then stops the workers.
+static inline void jobs_shutdown(Jobs* jobs)
+{
+	jobs_finish(jobs);
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&jobs->lock);
+	atomic_store(&jobs->running, false);
+	pthread_cond_broadcast(&jobs->wake);
+	pthread_mutex_unlock(&jobs->lock);
+	for (int i = 0; i < jobs->workers; ++i) {
+		pthread_join(jobs->threads[i], NULL);
+	}
+	pthread_mutex_destroy(&jobs->lock);
+	pthread_cond_destroy(&jobs->wake);
+	pthread_cond_destroy(&jobs->done);
+#endif
+	free(jobs->completions.items);
+	jobs->workers = 0;
+}
+
+#endif // !JOBS
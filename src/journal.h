@@ -0,0 +1,457 @@
+#ifndef JOURNAL
+#define JOURNAL
+// Append-only operation log.
+//
+// Records are appended to an in-memory buffer by the main thread and written
+// out and fsync'd by a background thread every JOURNAL_FLUSH_MS. A record is
+// only replayed when its checksum matches, so a crash in the middle of a write
+// loses the torn record and everything after it, never more than the last
+// flush interval.
+//
+// When a write fails the file is cut back to the last complete record and
+// later records are dropped, since replaying past a gap would apply them to
+// the wrong state. journal_failed() tells the app, which then has to save
+// the whole board; journal_reset() starts over once it has. A save that takes
+// a while keeps what was appended meanwhile, see journal_mark().
+//
+// File layout: Journal_FileHeader followed by records, each a Journal_Record
+// header and `size` bytes of payload. The checksum covers everything after the
+// `crc` field.
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ds.h"
+
+#if !defined(PLATFORM_WEB)
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define JOURNAL_MAGIC "HTRJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_FLUSH_MS 100
+#define JOURNAL_MAX_RECORD (1u << 30) // payload bytes, larger ones are corrupt
+
+typedef struct Journal_FileHeader {
+	char magic[4];
+	U32 version;
+} Journal_FileHeader;
+
+typedef struct Journal_Record {
+	U32 size;
+	U32 crc;
+	U64 seq;
+	U32 op;
+	U32 key;
+} Journal_Record;
+
+typedef List(U8) Journal_Bytes;
+
+typedef void (*Journal_Apply)(U32 op, U32 key, const U8* payload, U32 size);
+
+typedef struct Journal {
+	int fd;
+	bool open;
+	U64 seq; // sequence number of the last appended record
+	U64 size; // bytes in the file plus bytes still pending
+	// Records not yet handed to the writer. The last one can be rewritten in
+	// place while it is still here, see journal_append().
+	Journal_Bytes pending;
+	size_t last_record;
+	U32 last_op;
+	U32 last_key;
+	bool can_coalesce;
+#if !defined(PLATFORM_WEB)
+	Journal_Bytes writing;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running;
+	bool flush_now;
+	bool failed; // see journal_failed()
+	U64 written; // bytes of complete records in the file
+#endif
+} Journal;
+
+static U32 journal_crc_table[256];
+
+static inline U32 journal_crc32(U32 crc, const U8* data, size_t size)
+{
+	if (journal_crc_table[1] == 0) {
+		for (U32 i = 0; i < 256; ++i) {
+			U32 c = i;
+			for (int k = 0; k < 8; ++k) {
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			journal_crc_table[i] = c;
+		}
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc = journal_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+#if !defined(PLATFORM_WEB)
+static inline bool journal_write_all(int fd, const U8* data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static inline void* journal_writer(void* arg)
+{
+	Journal* j = arg;
+	pthread_mutex_lock(&j->lock);
+	while (j->running || j->pending.count > 0) {
+		if (j->pending.count == 0 || (!j->flush_now && j->running)) {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += JOURNAL_FLUSH_MS * 1000000L;
+			until.tv_sec += until.tv_nsec / 1000000000L;
+			until.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait(&j->wake, &j->lock, &until);
+		}
+		if (j->pending.count == 0) {
+			j->flush_now = false;
+			pthread_cond_broadcast(&j->wake);
+			continue;
+		}
+		Journal_Bytes tmp = j->writing;
+		j->writing = j->pending;
+		j->pending = tmp;
+		list_clear(&j->pending);
+		j->can_coalesce = false;
+		bool failed = j->failed;
+		U64 written = j->written;
+		pthread_mutex_unlock(&j->lock);
+
+		bool ok = !failed
+				&& journal_write_all(j->fd, j->writing.items, j->writing.count)
+				&& fdatasync(j->fd) == 0;
+		if (!failed && !ok) {
+			fprintf(stderr,
+					"JOURNAL: Failed to write %zu bytes, dropping records until the "
+					"next save\n",
+					j->writing.count);
+			// Records written after a torn one would never be replayed.
+			if (ftruncate(j->fd, written) == 0) {
+				lseek(j->fd, written, SEEK_SET);
+			}
+		}
+		U64 count = j->writing.count;
+		list_clear(&j->writing);
+
+		pthread_mutex_lock(&j->lock);
+		if (ok) {
+			j->written += count;
+		} else {
+			j->failed = true;
+		}
+		if (j->pending.count == 0) {
+			j->flush_now = false;
+			pthread_cond_broadcast(&j->wake);
+		}
+	}
+	pthread_mutex_unlock(&j->lock);
+	return NULL;
+}
+#endif
+
+// Replays every intact record with a sequence number above `after_seq` and
+// returns the number of valid bytes in the file. `last_seq` receives the
+// highest sequence number seen.
+static inline U64 journal_replay(
+		const char* path, U64 after_seq, Journal_Apply apply, U64* last_seq)
+{
+	*last_seq = after_seq;
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		return 0;
+	}
+	Journal_FileHeader header = { 0 };
+	if (fread(&header, sizeof(header), 1, f) != 1
+			|| memcmp(header.magic, JOURNAL_MAGIC, 4) != 0
+			|| header.version != JOURNAL_VERSION) {
+		fclose(f);
+		return 0;
+	}
+	U64 file_size = 0;
+	if (fseek(f, 0, SEEK_END) == 0 && ftell(f) > 0) {
+		file_size = ftell(f);
+	}
+	fseek(f, sizeof(header), SEEK_SET);
+	U64 valid = sizeof(header);
+	List(U8) payload = { 0 };
+	Journal_Record rec;
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		// A torn or corrupt size ends the journal like a bad checksum does.
+		if (valid + sizeof(rec) > file_size
+				|| rec.size > file_size - valid - sizeof(rec)
+				|| rec.size > JOURNAL_MAX_RECORD) {
+			break;
+		}
+		if (rec.size > payload.capacity) {
+			free(payload.items);
+			list_init(&payload, rec.size);
+		}
+		if (rec.size > 0 && fread(payload.items, rec.size, 1, f) != 1) {
+			break;
+		}
+		U32 crc = journal_crc32(0, (const U8*)&rec.seq,
+				sizeof(rec) - offsetof(Journal_Record, seq));
+		crc = journal_crc32(crc, payload.items, rec.size);
+		if (crc != rec.crc) {
+			break;
+		}
+		if (rec.seq > after_seq) {
+			apply(rec.op, rec.key, payload.items, rec.size);
+		}
+		if (rec.seq > *last_seq) {
+			*last_seq = rec.seq;
+		}
+		valid += sizeof(rec) + rec.size;
+	}
+	free(payload.items);
+	fclose(f);
+	return valid;
+}
+
+// Opens `path` for appending after `valid_size` bytes, dropping any torn tail
+// left by a crash. A `valid_size` of 0 starts a new journal. There is no
+// durable storage on the web, so the journal stays closed there.
+static inline bool journal_open(
+		Journal* j, const char* path, U64 valid_size, U64 seq)
+{
+	memset(j, 0, sizeof(*j));
+#if defined(PLATFORM_WEB)
+	(void)path;
+	(void)valid_size;
+	(void)seq;
+	return false;
+#else
+	j->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (j->fd < 0) {
+		return false;
+	}
+	if (valid_size < sizeof(Journal_FileHeader)) {
+		Journal_FileHeader header = { .magic = JOURNAL_MAGIC,
+			.version = JOURNAL_VERSION };
+		if (ftruncate(j->fd, 0) != 0
+				|| !journal_write_all(j->fd, (const U8*)&header, sizeof(header))) {
+			close(j->fd);
+			return false;
+		}
+		valid_size = sizeof(header);
+	} else if (ftruncate(j->fd, valid_size) != 0) {
+		close(j->fd);
+		return false;
+	}
+	lseek(j->fd, valid_size, SEEK_SET);
+	j->written = valid_size;
+	j->seq = seq;
+	j->size = valid_size;
+	j->open = true;
+	j->running = true;
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->wake, NULL);
+	pthread_create(&j->thread, NULL, journal_writer, j);
+	return true;
+#endif
+}
+
+// Appends a record. With `coalesce` set, a record with the same op and key
+// that has not reached the writer yet is replaced instead, so continuous
+// edits like dragging collapse into one record per flush.
+static inline void journal_append(Journal* j, U32 op, U32 key,
+		const void* payload, U32 size, bool coalesce)
+{
+	if (!j->open) {
+		return;
+	}
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&j->lock);
+#endif
+	if (coalesce && j->can_coalesce && j->last_op == op && j->last_key == key) {
+		j->size -= j->pending.count - j->last_record;
+		j->pending.count = j->last_record;
+	} else {
+		j->seq++;
+	}
+	Journal_Record rec = {
+		.size = size,
+		.seq = j->seq,
+		.op = op,
+		.key = key,
+	};
+	rec.crc = journal_crc32(0, (const U8*)&rec.seq,
+			sizeof(rec) - offsetof(Journal_Record, seq));
+	rec.crc = journal_crc32(rec.crc, payload, size);
+
+	j->last_record = j->pending.count;
+	j->last_op = op;
+	j->last_key = key;
+	j->can_coalesce = coalesce;
+	list_append_many(&j->pending, (const U8*)&rec, sizeof(rec));
+	if (size > 0) {
+		list_append_many(&j->pending, (const U8*)payload, size);
+	}
+	j->size += sizeof(rec) + size;
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_unlock(&j->lock);
+#endif
+}
+
+// Blocks until everything appended so far is on disk, false when it isn't
+// because a write failed.
+static inline bool journal_sync(Journal* j)
+{
+	if (!j->open) {
+		return false;
+	}
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&j->lock);
+	j->flush_now = true;
+	pthread_cond_broadcast(&j->wake);
+	while (j->flush_now) {
+		pthread_cond_wait(&j->wake, &j->lock);
+	}
+	bool ok = !j->failed;
+	pthread_mutex_unlock(&j->lock);
+	return ok;
+#else
+	return false;
+#endif
+}
+
+// True once a write failed. Records since then are lost, so only saving the
+// board and calling journal_reset() makes the edits durable again.
+static inline bool journal_failed(Journal* j)
+{
+	if (!j->open) {
+		return false;
+	}
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&j->lock);
+	bool failed = j->failed;
+	pthread_mutex_unlock(&j->lock);
+	return failed;
+#else
+	return false;
+#endif
+}
+
+// The size of the journal so far. Records appended later are never merged
+// into the ones before, so journal_reset_after() can keep just those.
+static inline U64 journal_mark(Journal* j)
+{
+#if !defined(PLATFORM_WEB)
+	if (j->open) {
+		pthread_mutex_lock(&j->lock);
+	}
+#endif
+	j->can_coalesce = false;
+	U64 size = j->size;
+#if !defined(PLATFORM_WEB)
+	if (j->open) {
+		pthread_mutex_unlock(&j->lock);
+	}
+#endif
+	return size;
+}
+
+// Drops the records up to `mark` from journal_mark(), used once a checkpoint
+// holds all of them. Sequence numbers keep counting so that a stale journal is
+// never replayed twice. False when records after `mark` were lost to a failed
+// write, the board then has to be saved again.
+static inline bool journal_reset_after(Journal* j, U64 mark)
+{
+	if (!j->open) {
+		return true;
+	}
+	journal_sync(j);
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&j->lock);
+	if (j->failed && mark < j->size) {
+		pthread_mutex_unlock(&j->lock);
+		return false;
+	}
+	list_clear(&j->pending);
+	j->can_coalesce = false;
+	U64 keep = mark < j->written ? j->written - mark : 0;
+	U8* tail = keep > 0 ? malloc(keep) : NULL;
+	assert((keep == 0 || tail != NULL) && "Buy more RAM!!");
+	Journal_FileHeader header = { .magic = JOURNAL_MAGIC,
+		.version = JOURNAL_VERSION };
+	j->failed = (keep > 0 && pread(j->fd, tail, keep, mark) != (ssize_t)keep)
+			|| ftruncate(j->fd, 0) != 0 || lseek(j->fd, 0, SEEK_SET) != 0
+			|| !journal_write_all(j->fd, (const U8*)&header, sizeof(header))
+			|| !journal_write_all(j->fd, tail, keep) || fdatasync(j->fd) != 0;
+	free(tail);
+	if (j->failed) {
+		fprintf(stderr, "JOURNAL: Failed to start over\n");
+	}
+	j->written = sizeof(header) + keep;
+	j->size = j->written;
+	bool ok = !j->failed;
+	pthread_mutex_unlock(&j->lock);
+	return ok;
+#else
+	return true;
+#endif
+}
+
+static inline void journal_reset(Journal* j)
+{
+	journal_reset_after(j, j->size);
+}
+
+// Bytes held by the record buffers, for memory accounting.
+static inline U64 journal_buffer_bytes(Journal* j)
+{
+	if (!j->open) {
+		return j->pending.capacity;
+	}
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&j->lock);
+	U64 bytes = j->pending.capacity + j->writing.capacity;
+	pthread_mutex_unlock(&j->lock);
+	return bytes;
+#else
+	return j->pending.capacity;
+#endif
+}
+
+static inline void journal_close(Journal* j)
+{
+	if (!j->open) {
+		return;
+	}
+#if !defined(PLATFORM_WEB)
+	pthread_mutex_lock(&j->lock);
+	j->running = false;
+	pthread_cond_broadcast(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+	pthread_join(j->thread, NULL);
+	pthread_mutex_destroy(&j->lock);
+	pthread_cond_destroy(&j->wake);
+	close(j->fd);
+	free(j->writing.items);
+#endif
+	free(j->pending.items);
+	memset(j, 0, sizeof(*j));
+}
+
+#endif // !JOURNAL
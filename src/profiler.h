@@ -0,0 +1,192 @@
+#ifndef PROFILER
+#define PROFILER
+// Scoped timers for finding out where frames go.
+//
+// A timed scope is recorded as one event in a ring of the last
+// PROFILE_EVENTS. Any thread can record: a writer claims a slot with an
+// atomic add and publishes it by storing the slot's sequence number last, so
+// readers skip slots that are being written or were already overwritten.
+// Names are string literals and only their pointers are kept.
+//
+// profile_end_frame() closes a frame on the main thread: it keeps the frame
+// time for a graph and a smoothed time per scope name for the overlay.
+// profile_write_trace() dumps the ring in Chrome's trace event format, for
+// chrome://tracing or ui.perfetto.dev.
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ds.h"
+
+#define PROFILE_EVENTS 65536 // a power of two
+#define PROFILE_FRAMES 240
+#define PROFILE_SCOPES 64
+
+typedef struct Profile_Event {
+	_Atomic U64 seq; // index of the event plus one once it is written
+	const char* name;
+	U64 start; // ns
+	U64 end;
+	U32 thread;
+} Profile_Event;
+
+typedef struct Profile_Scope {
+	const char* name;
+	double ms; // per frame, smoothed
+	double max_ms; // in the last PROFILE_FRAMES frames
+	U64 max_frame;
+} Profile_Scope;
+
+typedef struct Profile_Frame {
+	float ms;
+	float present_ms; // part of the frame spent presenting
+} Profile_Frame;
+
+typedef struct Profiler {
+	Profile_Event events[PROFILE_EVENTS];
+	_Atomic U64 head; // events ever recorded
+	U64 frame_first; // first event of the frame being recorded
+	U64 frames;
+	Ring(Profile_Frame, PROFILE_FRAMES) history;
+	Profile_Scope scopes[PROFILE_SCOPES];
+	int scope_count;
+} Profiler;
+
+static _Atomic U32 profile_threads;
+static _Thread_local U32 profile_thread;
+
+static inline U64 profile_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (U64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline U32 profile_thread_id(void)
+{
+	if (profile_thread == 0) {
+		profile_thread = atomic_fetch_add(&profile_threads, 1) + 1;
+	}
+	return profile_thread;
+}
+
+static inline void profile_record(
+		Profiler* p, const char* name, U64 start, U64 end)
+{
+	U64 i = atomic_fetch_add_explicit(&p->head, 1, memory_order_relaxed);
+	Profile_Event* e = &p->events[i & (PROFILE_EVENTS - 1)];
+	atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	e->name = name;
+	e->start = start;
+	e->end = end;
+	e->thread = profile_thread_id();
+	atomic_store_explicit(&e->seq, i + 1, memory_order_release);
+}
+
+// Copies event `i` out of the ring, false when it isn't there (any more).
+static inline bool profile_event(Profiler* p, U64 i, Profile_Event* out)
+{
+	Profile_Event* e = &p->events[i & (PROFILE_EVENTS - 1)];
+	if (atomic_load_explicit(&e->seq, memory_order_acquire) != i + 1) {
+		return false;
+	}
+	out->name = e->name;
+	out->start = e->start;
+	out->end = e->end;
+	out->thread = e->thread;
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&e->seq, memory_order_relaxed) == i + 1;
+}
+
+static inline Profile_Scope* profile_scope(Profiler* p, const char* name)
+{
+	for (int i = 0; i < p->scope_count; ++i) {
+		if (p->scopes[i].name == name) {
+			return &p->scopes[i];
+		}
+	}
+	if (p->scope_count == PROFILE_SCOPES) {
+		return NULL;
+	}
+	Profile_Scope* s = &p->scopes[p->scope_count++];
+	*s = (Profile_Scope) { .name = name };
+	return s;
+}
+
+// Ends the calling thread's frame that started at `start`; `present` is how
+// long of it went to presenting and waiting for the next one.
+static inline void profile_end_frame(Profiler* p, U64 start, U64 present)
+{
+	U64 now = profile_now();
+	U32 thread = profile_thread_id();
+	ring_push(&p->history,
+			((Profile_Frame) { (now - start) / 1e6, present / 1e6 }));
+
+	double ms[PROFILE_SCOPES] = { 0 };
+	U64 head = atomic_load_explicit(&p->head, memory_order_acquire);
+	U64 first = p->frame_first;
+	if (head - first > PROFILE_EVENTS) {
+		first = head - PROFILE_EVENTS;
+	}
+	for (U64 i = first; i < head; ++i) {
+		Profile_Event e;
+		if (profile_event(p, i, &e) && e.thread == thread) {
+			Profile_Scope* s = profile_scope(p, e.name);
+			if (s != NULL) {
+				ms[s - p->scopes] += (e.end - e.start) / 1e6;
+			}
+		}
+	}
+	for (int i = 0; i < p->scope_count; ++i) {
+		Profile_Scope* s = &p->scopes[i];
+		s->ms += (ms[i] - s->ms) * 0.1;
+		if (ms[i] >= s->max_ms || p->frames - s->max_frame >= PROFILE_FRAMES) {
+			s->max_ms = ms[i];
+			s->max_frame = p->frames;
+		}
+	}
+	p->frame_first = head;
+	p->frames++;
+}
+
+static inline void profile_write_name(FILE* file, const char* name)
+{
+	for (; *name != '\0'; ++name) {
+		if (*name == '"' || *name == '\\') {
+			fputc('\\', file);
+		}
+		fputc(*name, file);
+	}
+}
+
+// Writes the events still in the ring as complete ("X") events.
+static inline bool profile_write_trace(Profiler* p, const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	U64 head = atomic_load_explicit(&p->head, memory_order_acquire);
+	U64 first = head > PROFILE_EVENTS ? head - PROFILE_EVENTS : 0;
+	bool comma = false;
+	for (U64 i = first; i < head; ++i) {
+		Profile_Event e;
+		if (!profile_event(p, i, &e)) {
+			continue;
+		}
+		fprintf(file, "%s{\"name\": \"", comma ? ",\n" : "");
+		profile_write_name(file, e.name);
+		fprintf(file,
+				"\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+				"\"dur\": %.3f}",
+				e.thread, e.start / 1e3, (e.end - e.start) / 1e3);
+		comma = true;
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
+
+#endif // !PROFILER
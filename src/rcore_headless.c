@@ -0,0 +1,321 @@
+// Headless raylib platform: rcore.c with an offscreen EGL pbuffer in place of
+// a window, so hatori runs on machines without a display.
+//
+// Built in place of raylib's rcore.c by `./make raylib-headless`. Window
+// functions do nothing, and input comes from the headless_* functions below
+// instead of a window system.
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// rcore.c declares SetupFramebuffer() for the platforms that scale a window
+// to a display, which a pbuffer never is.
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "external/raylib/src/rcore.c"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+typedef struct {
+	EGLDisplay device;
+	EGLSurface surface;
+	EGLContext context;
+	EGLConfig config;
+	FilePathList dropped;
+} PlatformData;
+
+static PlatformData platform = { 0 };
+
+int InitPlatform(void);
+void ClosePlatform(void);
+void headless_resize(int width, int height);
+
+bool WindowShouldClose(void)
+{
+	if (CORE.Window.ready) {
+		return CORE.Window.shouldClose;
+	}
+	return true;
+}
+
+void ToggleFullscreen(void) { }
+void ToggleBorderlessWindowed(void) { }
+void MaximizeWindow(void) { }
+void MinimizeWindow(void) { }
+void RestoreWindow(void) { }
+void SetWindowState(unsigned int flags) { CORE.Window.flags |= flags; }
+void ClearWindowState(unsigned int flags) { CORE.Window.flags &= ~flags; }
+void SetWindowIcon(Image image) { }
+void SetWindowIcons(Image* images, int count) { }
+void SetWindowTitle(const char* title) { CORE.Window.title = title; }
+void SetWindowPosition(int x, int y) { }
+void SetWindowMonitor(int monitor) { }
+void SetWindowMinSize(int width, int height) { }
+void SetWindowMaxSize(int width, int height) { }
+void SetWindowOpacity(float opacity) { }
+void SetWindowFocused(void) { }
+void* GetWindowHandle(void) { return NULL; }
+int GetMonitorCount(void) { return 1; }
+int GetCurrentMonitor(void) { return 0; }
+Vector2 GetMonitorPosition(int monitor) { return (Vector2) { 0 }; }
+int GetMonitorWidth(int monitor) { return CORE.Window.screen.width; }
+int GetMonitorHeight(int monitor) { return CORE.Window.screen.height; }
+int GetMonitorPhysicalWidth(int monitor) { return 0; }
+int GetMonitorPhysicalHeight(int monitor) { return 0; }
+int GetMonitorRefreshRate(int monitor) { return 60; }
+const char* GetMonitorName(int monitor) { return "headless"; }
+Vector2 GetWindowPosition(void) { return (Vector2) { 0 }; }
+Vector2 GetWindowScaleDPI(void) { return (Vector2) { 1, 1 }; }
+void SetClipboardText(const char* text) { }
+const char* GetClipboardText(void) { return NULL; }
+void ShowCursor(void) { CORE.Input.Mouse.cursorHidden = false; }
+void HideCursor(void) { CORE.Input.Mouse.cursorHidden = true; }
+void EnableCursor(void) { CORE.Input.Mouse.cursorHidden = false; }
+void DisableCursor(void) { CORE.Input.Mouse.cursorHidden = true; }
+int SetGamepadMappings(const char* mappings) { return 0; }
+void SetMouseCursor(int cursor) { CORE.Input.Mouse.cursor = cursor; }
+const char* GetKeyName(int key) { return ""; }
+void OpenURL(const char* url) { }
+
+void SetWindowSize(int width, int height) { headless_resize(width, height); }
+
+void SwapScreenBuffer(void) { eglSwapBuffers(platform.device, platform.surface); }
+
+double GetTime(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	unsigned long long int ns
+			= (unsigned long long int)ts.tv_sec * 1000000000LLU + ts.tv_nsec;
+	return (double)(ns - CORE.Time.base) * 1e-9;
+}
+
+void SetMousePosition(int x, int y)
+{
+	CORE.Input.Mouse.currentPosition = (Vector2) { (float)x, (float)y };
+	CORE.Input.Mouse.previousPosition = CORE.Input.Mouse.currentPosition;
+}
+
+void PollInputEvents(void)
+{
+	CORE.Input.Keyboard.keyPressedQueueCount = 0;
+	CORE.Input.Keyboard.charPressedQueueCount = 0;
+	for (int i = 0; i < MAX_KEYBOARD_KEYS; i++) {
+		CORE.Input.Keyboard.previousKeyState[i]
+				= CORE.Input.Keyboard.currentKeyState[i];
+		CORE.Input.Keyboard.keyRepeatInFrame[i] = 0;
+	}
+	for (int i = 0; i < MAX_MOUSE_BUTTONS; i++) {
+		CORE.Input.Mouse.previousButtonState[i]
+				= CORE.Input.Mouse.currentButtonState[i];
+	}
+	CORE.Input.Mouse.previousWheelMove = CORE.Input.Mouse.currentWheelMove;
+	CORE.Input.Mouse.currentWheelMove = (Vector2) { 0.0f, 0.0f };
+	CORE.Input.Mouse.previousPosition = CORE.Input.Mouse.currentPosition;
+	CORE.Window.resizedLastFrame = false;
+}
+
+// Synthetic input, applied to the frame that follows the next EndDrawing().
+void headless_mouse_move(float x, float y)
+{
+	CORE.Input.Mouse.currentPosition = (Vector2) { x, y };
+}
+
+void headless_mouse_button(int button, bool down)
+{
+	if (button >= 0 && button < MAX_MOUSE_BUTTONS) {
+		CORE.Input.Mouse.currentButtonState[button] = down;
+	}
+}
+
+void headless_mouse_wheel(float move)
+{
+	CORE.Input.Mouse.currentWheelMove.y += move;
+}
+
+void headless_key(int key, bool down)
+{
+	if (key <= 0 || key >= MAX_KEYBOARD_KEYS) {
+		return;
+	}
+	CORE.Input.Keyboard.currentKeyState[key] = down;
+	if (down && CORE.Input.Keyboard.keyPressedQueueCount < MAX_KEY_PRESSED_QUEUE) {
+		CORE.Input.Keyboard
+				.keyPressedQueue[CORE.Input.Keyboard.keyPressedQueueCount++]
+				= key;
+	}
+}
+
+void headless_key_repeat(int key)
+{
+	if (key > 0 && key < MAX_KEYBOARD_KEYS) {
+		CORE.Input.Keyboard.keyRepeatInFrame[key] = 1;
+	}
+}
+
+void headless_char(int codepoint)
+{
+	if (CORE.Input.Keyboard.charPressedQueueCount < MAX_CHAR_PRESSED_QUEUE) {
+		CORE.Input.Keyboard
+				.charPressedQueue[CORE.Input.Keyboard.charPressedQueueCount++]
+				= codepoint;
+	}
+}
+
+// A pbuffer has a fixed size, so it is replaced by one of the new size. The
+// old one is kept, and so is the size, when that fails.
+void headless_resize(int width, int height)
+{
+	if (width <= 0 || height <= 0) {
+		TRACELOG(LOG_WARNING, "DISPLAY: Can't resize to %i x %i", width, height);
+		return;
+	}
+	if (CORE.Window.ready) {
+		const EGLint surface_attribs[] = {
+			EGL_WIDTH, width,
+			EGL_HEIGHT, height,
+			EGL_NONE,
+		};
+		EGLSurface surface = eglCreatePbufferSurface(
+				platform.device, platform.config, surface_attribs);
+		if (surface == EGL_NO_SURFACE
+				|| !eglMakeCurrent(
+						platform.device, surface, surface, platform.context)) {
+			TRACELOG(LOG_WARNING, "DISPLAY: Failed to resize offscreen surface");
+			if (surface != EGL_NO_SURFACE) {
+				eglDestroySurface(platform.device, surface);
+			}
+			return;
+		}
+		eglDestroySurface(platform.device, platform.surface);
+		platform.surface = surface;
+		SetupViewport(width, height);
+	}
+	CORE.Window.screen.width = width;
+	CORE.Window.screen.height = height;
+	CORE.Window.display.width = width;
+	CORE.Window.display.height = height;
+	CORE.Window.currentFbo.width = width;
+	CORE.Window.currentFbo.height = height;
+	CORE.Window.resizedLastFrame = true;
+}
+
+// Paths are copied; raylib frees them in UnloadDroppedFiles().
+void headless_drop_files(const char** paths, int count)
+{
+	if (CORE.Window.dropFileCount > 0) {
+		for (unsigned int i = 0; i < CORE.Window.dropFileCount; i++) {
+			RL_FREE(CORE.Window.dropFilepaths[i]);
+		}
+		RL_FREE(CORE.Window.dropFilepaths);
+	}
+	CORE.Window.dropFileCount = count;
+	CORE.Window.dropFilepaths = (char**)RL_CALLOC(count, sizeof(char*));
+	for (int i = 0; i < count; i++) {
+		CORE.Window.dropFilepaths[i]
+				= (char*)RL_CALLOC(MAX_FILEPATH_LENGTH, sizeof(char));
+		strncpy(CORE.Window.dropFilepaths[i], paths[i], MAX_FILEPATH_LENGTH - 1);
+	}
+}
+
+int InitPlatform(void)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display
+			= (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+					"eglGetPlatformDisplayEXT");
+	platform.device = EGL_NO_DISPLAY;
+	if (get_platform_display != NULL) {
+		platform.device = get_platform_display(
+				EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (platform.device == EGL_NO_DISPLAY) {
+		platform.device = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (platform.device == EGL_NO_DISPLAY
+			|| eglInitialize(platform.device, NULL, NULL) == EGL_FALSE) {
+		TRACELOG(LOG_WARNING, "DISPLAY: Failed to initialize EGL device");
+		return -1;
+	}
+
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 16,
+		EGL_NONE,
+	};
+	EGLint config_count = 0;
+	if (!eglChooseConfig(platform.device, config_attribs, &platform.config, 1,
+					&config_count)
+			|| config_count == 0) {
+		TRACELOG(LOG_WARNING, "DISPLAY: No offscreen EGL config available");
+		return -1;
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE,
+	};
+	platform.context = eglCreateContext(
+			platform.device, platform.config, EGL_NO_CONTEXT, context_attribs);
+	if (platform.context == EGL_NO_CONTEXT) {
+		TRACELOG(LOG_WARNING, "DISPLAY: Failed to create EGL context");
+		return -1;
+	}
+
+	const EGLint surface_attribs[] = {
+		EGL_WIDTH, CORE.Window.screen.width,
+		EGL_HEIGHT, CORE.Window.screen.height,
+		EGL_NONE,
+	};
+	platform.surface = eglCreatePbufferSurface(
+			platform.device, platform.config, surface_attribs);
+	if (platform.surface == EGL_NO_SURFACE
+			|| !eglMakeCurrent(platform.device, platform.surface, platform.surface,
+					platform.context)) {
+		TRACELOG(LOG_WARNING, "DISPLAY: Failed to create offscreen surface");
+		return -1;
+	}
+
+	CORE.Window.ready = true;
+	CORE.Window.display.width = CORE.Window.screen.width;
+	CORE.Window.display.height = CORE.Window.screen.height;
+	CORE.Window.render.width = CORE.Window.screen.width;
+	CORE.Window.render.height = CORE.Window.screen.height;
+	CORE.Window.currentFbo.width = CORE.Window.render.width;
+	CORE.Window.currentFbo.height = CORE.Window.render.height;
+
+	rlLoadExtensions(eglGetProcAddress);
+	InitTimer();
+	CORE.Storage.basePath = GetWorkingDirectory();
+
+	TRACELOG(LOG_INFO, "PLATFORM: HEADLESS: Initialized successfully");
+	TRACELOG(LOG_INFO, "    > Render size:  %i x %i", CORE.Window.render.width,
+			CORE.Window.render.height);
+	return 0;
+}
+
+void ClosePlatform(void)
+{
+	if (platform.device == EGL_NO_DISPLAY) {
+		return;
+	}
+	eglMakeCurrent(
+			platform.device, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (platform.surface != EGL_NO_SURFACE) {
+		eglDestroySurface(platform.device, platform.surface);
+	}
+	if (platform.context != EGL_NO_CONTEXT) {
+		eglDestroyContext(platform.device, platform.context);
+	}
+	eglTerminate(platform.device);
+}
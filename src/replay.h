@@ -0,0 +1,308 @@
+#ifndef REPLAY
+#define REPLAY
+// Per-frame input log.
+//
+// The state raylib reports for each frame (mouse, held buttons and keys,
+// wheel, screen size) is written together with the events the app took from
+// it (typed characters, dropped files), so feeding the frames back in order
+// reproduces a session exactly.
+//
+// File layout: Replay_FileHeader followed by one record per frame. A record
+// starts with a byte of REPLAY_* flags telling which of the following parts
+// are present, in this order:
+//   REPLAY_MOUSE    f32 x, f32 y
+//   REPLAY_BUTTONS  u8 bit per mouse button held
+//   REPLAY_WHEEL    f32 move
+//   REPLAY_SIZE     u16 width, u16 height
+//   REPLAY_KEYS     u8 count, count u16 keys that went down or up
+//   REPLAY_REPEATS  u8 count, count u16 keys repeating this frame
+//   REPLAY_CHARS    u8 count, count u32 codepoints
+//   REPLAY_DROP     u8 count, count times u16 length and the path bytes
+// Everything but characters and drops is only written when it changed.
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ds.h"
+
+#define REPLAY_MAGIC "HTRI"
+#define REPLAY_VERSION 1
+#define REPLAY_MAX_KEYS 512
+#define REPLAY_MAX_BUTTONS 8
+#define REPLAY_MAX_EVENTS 255
+
+enum {
+	REPLAY_MOUSE = 1 << 0,
+	REPLAY_BUTTONS = 1 << 1,
+	REPLAY_WHEEL = 1 << 2,
+	REPLAY_SIZE = 1 << 3,
+	REPLAY_KEYS = 1 << 4,
+	REPLAY_REPEATS = 1 << 5,
+	REPLAY_CHARS = 1 << 6,
+	REPLAY_DROP = 1 << 7,
+};
+
+typedef struct Replay_FileHeader {
+	char magic[4];
+	U32 version;
+} Replay_FileHeader;
+
+typedef List(char) Replay_Paths;
+
+typedef struct Replay_Frame {
+	float mouse_x;
+	float mouse_y;
+	float wheel;
+	U8 buttons;
+	U16 width;
+	U16 height;
+	U64 keys[BITSET_WORDS(REPLAY_MAX_KEYS)]; // bit per held key
+	U16 repeats[REPLAY_MAX_EVENTS];
+	int repeat_count;
+	U32 chars[REPLAY_MAX_EVENTS];
+	int char_count;
+	Replay_Paths drops; // NUL terminated paths, one after the other
+	int drop_count;
+} Replay_Frame;
+
+typedef struct Replay {
+	FILE* file;
+	bool writing;
+	U64 frames;
+	Replay_Frame last; // the previous frame, records only hold changes
+} Replay;
+
+static inline bool replay_key_down(const Replay_Frame* f, int key)
+{
+	return key >= 0 && key < REPLAY_MAX_KEYS && bitset_get(f->keys, key);
+}
+
+static inline void replay_set_key(Replay_Frame* f, int key, bool down)
+{
+	if (key >= 0 && key < REPLAY_MAX_KEYS) {
+		bitset_set(f->keys, key, down);
+	}
+}
+
+// Clears the events of a frame, its state carries over to the next one.
+static inline void replay_clear_events(Replay_Frame* f)
+{
+	f->wheel = 0;
+	f->repeat_count = 0;
+	f->char_count = 0;
+	f->drop_count = 0;
+	list_clear(&f->drops);
+}
+
+static inline void replay_add_char(Replay_Frame* f, U32 codepoint)
+{
+	if (f->char_count < REPLAY_MAX_EVENTS) {
+		f->chars[f->char_count++] = codepoint;
+	}
+}
+
+static inline void replay_add_drop(Replay_Frame* f, const char* path)
+{
+	if (f->drop_count < REPLAY_MAX_EVENTS) {
+		list_append_many(&f->drops, path, strlen(path) + 1);
+		f->drop_count++;
+	}
+}
+
+static inline bool replay_open(Replay* r, const char* path, bool writing)
+{
+	memset(r, 0, sizeof(*r));
+	r->file = fopen(path, writing ? "wb" : "rb");
+	if (r->file == NULL) {
+		return false;
+	}
+	r->writing = writing;
+	Replay_FileHeader header = { .magic = REPLAY_MAGIC,
+		.version = REPLAY_VERSION };
+	if (writing) {
+		if (fwrite(&header, sizeof(header), 1, r->file) == 1) {
+			return true;
+		}
+	} else if (fread(&header, sizeof(header), 1, r->file) == 1
+			&& memcmp(header.magic, REPLAY_MAGIC, 4) == 0
+			&& header.version == REPLAY_VERSION) {
+		return true;
+	}
+	fclose(r->file);
+	r->file = NULL;
+	return false;
+}
+
+static inline void replay_write(Replay* r, const Replay_Frame* f)
+{
+	if (r->file == NULL || !r->writing) {
+		return;
+	}
+	const Replay_Frame* last = &r->last;
+	U16 toggled[REPLAY_MAX_KEYS];
+	int toggled_count = 0;
+	for (int key = 0; key < REPLAY_MAX_KEYS; ++key) {
+		if (replay_key_down(f, key) != replay_key_down(last, key)
+				&& toggled_count < REPLAY_MAX_EVENTS) {
+			toggled[toggled_count++] = key;
+		}
+	}
+	U8 flags = 0;
+	if (r->frames == 0 || f->mouse_x != last->mouse_x
+			|| f->mouse_y != last->mouse_y) {
+		flags |= REPLAY_MOUSE;
+	}
+	if (f->buttons != last->buttons) {
+		flags |= REPLAY_BUTTONS;
+	}
+	if (f->wheel != 0) {
+		flags |= REPLAY_WHEEL;
+	}
+	if (r->frames == 0 || f->width != last->width
+			|| f->height != last->height) {
+		flags |= REPLAY_SIZE;
+	}
+	flags |= toggled_count > 0 ? REPLAY_KEYS : 0;
+	flags |= f->repeat_count > 0 ? REPLAY_REPEATS : 0;
+	flags |= f->char_count > 0 ? REPLAY_CHARS : 0;
+	flags |= f->drop_count > 0 ? REPLAY_DROP : 0;
+
+	fwrite(&flags, 1, 1, r->file);
+	if (flags & REPLAY_MOUSE) {
+		fwrite(&f->mouse_x, sizeof(float), 1, r->file);
+		fwrite(&f->mouse_y, sizeof(float), 1, r->file);
+	}
+	if (flags & REPLAY_BUTTONS) {
+		fwrite(&f->buttons, 1, 1, r->file);
+	}
+	if (flags & REPLAY_WHEEL) {
+		fwrite(&f->wheel, sizeof(float), 1, r->file);
+	}
+	if (flags & REPLAY_SIZE) {
+		fwrite(&f->width, sizeof(U16), 1, r->file);
+		fwrite(&f->height, sizeof(U16), 1, r->file);
+	}
+	if (flags & REPLAY_KEYS) {
+		U8 count = toggled_count;
+		fwrite(&count, 1, 1, r->file);
+		fwrite(toggled, sizeof(U16), count, r->file);
+	}
+	if (flags & REPLAY_REPEATS) {
+		U8 count = f->repeat_count;
+		fwrite(&count, 1, 1, r->file);
+		fwrite(f->repeats, sizeof(U16), count, r->file);
+	}
+	if (flags & REPLAY_CHARS) {
+		U8 count = f->char_count;
+		fwrite(&count, 1, 1, r->file);
+		fwrite(f->chars, sizeof(U32), count, r->file);
+	}
+	if (flags & REPLAY_DROP) {
+		U8 count = f->drop_count;
+		fwrite(&count, 1, 1, r->file);
+		const char* path = f->drops.items;
+		for (int i = 0; i < f->drop_count; ++i) {
+			U16 len = strlen(path);
+			fwrite(&len, sizeof(len), 1, r->file);
+			fwrite(path, 1, len, r->file);
+			path += strlen(path) + 1;
+		}
+	}
+	memcpy(r->last.keys, f->keys, sizeof(f->keys));
+	r->last.mouse_x = f->mouse_x;
+	r->last.mouse_y = f->mouse_y;
+	r->last.buttons = f->buttons;
+	r->last.width = f->width;
+	r->last.height = f->height;
+	r->frames++;
+}
+
+static inline bool replay_read_u16s(Replay* r, U16* out, int* count)
+{
+	U8 n = 0;
+	if (fread(&n, 1, 1, r->file) != 1
+			|| (n > 0 && fread(out, sizeof(U16), n, r->file) != n)) {
+		return false;
+	}
+	*count = n;
+	return true;
+}
+
+// Reads the next frame into `f`, which has to hold the frame before it.
+// Returns false at the end of the log or at a torn record.
+static inline bool replay_read(Replay* r, Replay_Frame* f)
+{
+	if (r->file == NULL || r->writing) {
+		return false;
+	}
+	replay_clear_events(f);
+	U8 flags = 0;
+	if (fread(&flags, 1, 1, r->file) != 1) {
+		return false;
+	}
+	bool ok = true;
+	if (flags & REPLAY_MOUSE) {
+		ok = ok && fread(&f->mouse_x, sizeof(float), 1, r->file) == 1
+				&& fread(&f->mouse_y, sizeof(float), 1, r->file) == 1;
+	}
+	if (flags & REPLAY_BUTTONS) {
+		ok = ok && fread(&f->buttons, 1, 1, r->file) == 1;
+	}
+	if (flags & REPLAY_WHEEL) {
+		ok = ok && fread(&f->wheel, sizeof(float), 1, r->file) == 1;
+	}
+	if (flags & REPLAY_SIZE) {
+		ok = ok && fread(&f->width, sizeof(U16), 1, r->file) == 1
+				&& fread(&f->height, sizeof(U16), 1, r->file) == 1;
+	}
+	if (ok && (flags & REPLAY_KEYS)) {
+		U16 toggled[REPLAY_MAX_EVENTS];
+		int count = 0;
+		ok = replay_read_u16s(r, toggled, &count);
+		for (int i = 0; ok && i < count; ++i) {
+			replay_set_key(f, toggled[i], !replay_key_down(f, toggled[i]));
+		}
+	}
+	if (ok && (flags & REPLAY_REPEATS)) {
+		ok = replay_read_u16s(r, f->repeats, &f->repeat_count);
+	}
+	if (ok && (flags & REPLAY_CHARS)) {
+		U8 n = 0;
+		ok = fread(&n, 1, 1, r->file) == 1
+				&& (n == 0 || fread(f->chars, sizeof(U32), n, r->file) == n);
+		f->char_count = ok ? n : 0;
+	}
+	if (ok && (flags & REPLAY_DROP)) {
+		U8 n = 0;
+		ok = fread(&n, 1, 1, r->file) == 1;
+		for (int i = 0; ok && i < n; ++i) {
+			U16 len = 0;
+			ok = fread(&len, sizeof(len), 1, r->file) == 1;
+			list_reserve(&f->drops, f->drops.count + len + 1);
+			ok = ok
+					&& (len == 0
+							|| fread(f->drops.items + f->drops.count, 1, len, r->file)
+									== len);
+			if (ok) {
+				f->drops.count += len;
+				list_append(&f->drops, '\0');
+				f->drop_count++;
+			}
+		}
+	}
+	if (ok) {
+		r->frames++;
+	}
+	return ok;
+}
+
+static inline void replay_close(Replay* r)
+{
+	if (r->file != NULL) {
+		fclose(r->file);
+	}
+	free(r->last.drops.items);
+	memset(r, 0, sizeof(*r));
+}
+
+#endif // !REPLAY
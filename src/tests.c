@@ -0,0 +1,526 @@
+// Regression tests for the board ops, undo and the journal.
+//
+// Built against the headless raylib like the benchmarks (see
+// `./make build-tests`) and run from the repository root. Every test starts
+// from an empty board whose journal lives in a temporary directory, and the
+// program exits non-zero when a check fails.
+#define HATORI_NO_MAIN
+#define JOURNAL_CHECKPOINT_SIZE (256 * 1024)
+#include "hatori3.c"
+
+#define TEST_WIDTH 640
+#define TEST_HEIGHT 480
+
+int checks;
+int failures;
+
+#define CHECK(cond)                                                          \
+	do {                                                                       \
+		checks++;                                                                \
+		if (!(cond)) {                                                           \
+			failures++;                                                            \
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,  \
+					__func__, #cond);                                                  \
+		}                                                                        \
+	} while (0)
+
+char test_dir[256];
+
+const char* test_path(const char* name)
+{
+	static char path[512];
+	snprintf(path, sizeof(path), "%s/%s", test_dir, name);
+	return path;
+}
+
+// Opens a new, empty board `name` with its journal.
+void test_board(const char* name)
+{
+	const char* path = test_path(name);
+	char journal_path[520];
+	snprintf(journal_path, sizeof(journal_path), "%s.journal", path);
+	remove(path);
+	remove(journal_path);
+	open_board(path);
+}
+
+// Reopens the board from its journal, as after a crash.
+void test_reopen(void)
+{
+	journal_sync(&journal);
+	open_board(board_path);
+}
+
+void draw_line(float x0, float y0, float x1, float y1)
+{
+	Hatori_BoardLine l = { x0, y0, x1, y1, 4 };
+	do_op(OP_LINE_ADD, lines.count, &l, sizeof(l));
+}
+
+// The live lines, one float per coordinate, so states can be compared.
+int live_lines(float* out, int max)
+{
+	int n = 0;
+	for (size_t i = 0; i < lines.count && n + 4 <= max; ++i) {
+		Hatori_Line l = lines.items[i];
+		if (!l.deleted) {
+			out[n++] = l.x0;
+			out[n++] = l.y0;
+			out[n++] = l.x1;
+			out[n++] = l.y1;
+		}
+	}
+	return n;
+}
+
+bool same_lines(const float* a, int n, const float* b, int m)
+{
+	return n == m && memcmp(a, b, n * sizeof(*a)) == 0;
+}
+
+void undo(void) { move_undo_step(&undo_stack, &redo_stack); }
+
+void redo(void) { move_undo_step(&redo_stack, &undo_stack); }
+
+// Adds `img`, which stays the caller's, as an image the way a drop does.
+int add_test_image(Image img, float x, float y)
+{
+	Vector2 size = { img.width, img.height };
+	add_image_async(ImageCopy(img), (Vector2) { x, y }, size);
+	jobs_finish(&jobs);
+	end_undo_step();
+	return entities.count - 1;
+}
+
+bool same_pixels(int i, Image expected)
+{
+	Hatori_Pixels* p = entities.items[i].entity.image.current;
+	if (p == NULL || !pixels_load(p) || p->width != expected.width
+			|| p->height != expected.height) {
+		return false;
+	}
+	return memcmp(p->image.data, expected.data,
+							 GetPixelDataSize(p->width, p->height, expected.format))
+			== 0;
+}
+
+Image current_pixels(int i)
+{
+	Hatori_Pixels* p = entities.items[i].entity.image.current;
+	return pixels_load(p) ? ImageCopy(p->image) : (Image) { 0 };
+}
+
+// What a board holds, to compare it after a save or a reopen. Pixels are
+// compared by content and sharing by the first entity with the same buffer.
+typedef struct Test_Entity {
+	Hatori_BoardEntity be;
+	U64 pixels[2];
+	int shares[2];
+	char text[64];
+} Test_Entity;
+
+typedef struct Test_Board {
+	float lines[64];
+	int line_count;
+	int deleted_lines;
+	int entity_count;
+	Test_Entity entities[16];
+} Test_Board;
+
+int shared_with(Hatori_Pixels* p)
+{
+	for (size_t i = 0; p != NULL && i < entities.count; ++i) {
+		Hatori_Image img = entities.items[i].entity.image;
+		if (entities.items[i].type == ENTITY_IMAGE
+				&& (img.current == p || img.original == p)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+Test_Board board_state(void)
+{
+	Test_Board b = { 0 };
+	b.line_count = live_lines(b.lines, 64);
+	for (size_t i = 0; i < lines.count; ++i) {
+		b.deleted_lines += lines.items[i].deleted;
+	}
+	b.entity_count = entities.count;
+	for (size_t i = 0; i < entities.count && i < 16; ++i) {
+		Hatori_Entity e = entities.items[i];
+		Test_Entity* t = &b.entities[i];
+		t->be = board_entity(e);
+		t->be.blob = t->be.original_blob = 0;
+		t->be.deleted = e.deleted;
+		// Tombstones keep their place and nothing else.
+		if (e.type == ENTITY_TEXT && !e.deleted) {
+			snprintf(t->text, sizeof(t->text), "%.*s", (int)e.entity.text.text.count,
+					e.entity.text.text.items);
+		}
+		if (e.type != ENTITY_IMAGE) {
+			continue;
+		}
+		Hatori_Pixels* p[2] = { e.entity.image.current, e.entity.image.original };
+		for (int k = 0; k < 2; ++k) {
+			t->shares[k] = shared_with(p[k]);
+			t->pixels[k] = p[k] != NULL && pixels_load(p[k])
+					? hash_pixels(p[k]->image)
+					: 0;
+		}
+	}
+	return b;
+}
+
+bool same_board(Test_Board a, Test_Board b)
+{
+	return same_lines(a.lines, a.line_count, b.lines, b.line_count)
+			&& a.deleted_lines == b.deleted_lines
+			&& a.entity_count == b.entity_count
+			&& memcmp(a.entities, b.entities, sizeof(a.entities)) == 0;
+}
+
+// Shows the same lines after reopening as before.
+void check_journal(void)
+{
+	float before[64], after[64];
+	int n = live_lines(before, 64);
+	test_reopen();
+	int m = live_lines(after, 64);
+	CHECK(same_lines(before, n, after, m));
+}
+
+void test_clear_undo_redo(void)
+{
+	float drawn[64], now[64];
+	test_board("clear.hatori");
+	draw_line(0, 0, 10, 10);
+	draw_line(10, 10, 20, 0);
+	end_undo_step();
+	int n = live_lines(drawn, 64);
+
+	clear_screen();
+	end_undo_step();
+	CHECK(live_lines(now, 64) == 0);
+	undo();
+	CHECK(same_lines(drawn, n, now, live_lines(now, 64)));
+	redo();
+	CHECK(live_lines(now, 64) == 0);
+	undo();
+	CHECK(same_lines(drawn, n, now, live_lines(now, 64)));
+
+	// Lines drawn after the clear take the indices the cleared ones had.
+	clear_screen();
+	end_undo_step();
+	draw_line(50, 50, 60, 60);
+	end_undo_step();
+	undo();
+	CHECK(live_lines(now, 64) == 0);
+	undo();
+	CHECK(same_lines(drawn, n, now, live_lines(now, 64)));
+	undo();
+	CHECK(live_lines(now, 64) == 0);
+	redo();
+	CHECK(same_lines(drawn, n, now, live_lines(now, 64)));
+	redo();
+	CHECK(live_lines(now, 64) == 0);
+	redo();
+	CHECK(live_lines(now, 64) == 4 && now[0] == 50);
+	check_journal();
+}
+
+// A crash can leave any bytes after the last complete record.
+void test_torn_journal(void)
+{
+	float drawn[64], now[64];
+	test_board("torn.hatori");
+	draw_line(0, 0, 10, 10);
+	draw_line(10, 10, 20, 0);
+	end_undo_step();
+	int n = live_lines(drawn, 64);
+	journal_close(&journal);
+
+	char journal_path[520];
+	snprintf(journal_path, sizeof(journal_path), "%s.journal", board_path);
+	FILE* f = fopen(journal_path, "ab");
+	CHECK(f != NULL);
+	if (f == NULL) {
+		return;
+	}
+	Journal_Record torn = { .size = 0xFFFFFFF0u, .seq = journal.seq + 100 };
+	fwrite(&torn, sizeof(torn), 1, f);
+	fwrite("garbage", 7, 1, f);
+	fclose(f);
+	open_board(board_path);
+	CHECK(same_lines(drawn, n, now, live_lines(now, 64)));
+
+	// The torn tail is cut off, so what is appended next replays too.
+	draw_line(20, 0, 30, 10);
+	end_undo_step();
+	CHECK(live_lines(now, 64) == 12);
+	check_journal();
+}
+
+// A stroke being drawn is extended without simplifying it every segment,
+// and ends up the same as when it is built at once.
+void test_stroke_append(void)
+{
+	test_board("strokes.hatori");
+	update_strokes();
+	for (int i = 0; i < 200; ++i) {
+		float x = i * 3.0f, y = (i % 7) * (i % 3);
+		draw_line(x, y, x + 3, ((i + 1) % 7) * ((i + 1) % 3));
+		update_strokes();
+	}
+	CHECK(strokes.count == 1 && strokes.items[0].count == 200);
+	CHECK(strokes.items[0].points == NULL);
+	Hatori_Stroke drawn = strokes.items[0];
+	simplify_last_stroke();
+	update_strokes();
+	CHECK(strokes.count == 1 && strokes.items[0].points != NULL);
+	Hatori_Stroke simplified = strokes.items[0];
+	clear_strokes();
+	update_strokes();
+	Hatori_Stroke built = strokes.items[0];
+	CHECK(memcmp(&drawn.bounds, &built.bounds, sizeof(built.bounds)) == 0);
+	CHECK(memcmp(simplified.lod_points, built.lod_points,
+						sizeof(built.lod_points))
+			== 0);
+}
+
+// Edits keep only the tiles they touch for undo, including the partial ones
+// along the right and bottom edges.
+void test_image_edit_undo(void)
+{
+	test_board("edits.hatori");
+	Image original = GenImageChecked(200, 150, 16, 16, RED, BLUE);
+	ImageFormat(&original, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	selected_entity = add_test_image(original, 10, 10);
+	CHECK(same_pixels(selected_entity, original));
+	// The bytes encoded for the journal stay until the first edit.
+	Hatori_Pixels* p = entities.items[selected_entity].entity.image.current;
+	CHECK(p->owns_blob && p->blob.data != NULL);
+
+	Image states[4] = { original };
+	Hatori_ImageEdit edits[3] = {
+		{ EDIT_HFLIP },
+		{ EDIT_ERASE, { 190, 140 }, 8 },
+		{ EDIT_FLOOD, { 3, 3 }, 10 },
+	};
+	for (int e = 0; e < 3; ++e) {
+		edit_selected_image(edits[e]);
+		if (e == 1) {
+			CHECK(undo_step_bytes(&undo_step) < 200 * 150 * 4);
+		}
+		end_undo_step();
+		states[e + 1] = current_pixels(selected_entity);
+		CHECK(states[e + 1].data != NULL);
+		CHECK(!same_pixels(selected_entity, states[e]));
+	}
+	for (int e = 3; e > 0; --e) {
+		undo();
+		CHECK(same_pixels(selected_entity, states[e - 1]));
+	}
+	for (int e = 1; e <= 3; ++e) {
+		redo();
+		CHECK(same_pixels(selected_entity, states[e]));
+	}
+	int i = selected_entity;
+	test_reopen();
+	CHECK(entities.count == 1 && same_pixels(i, states[3]));
+	for (int e = 0; e < 4; ++e) {
+		UnloadImage(states[e]);
+	}
+}
+
+// Dropped and pasted files are decoded by a job, and the same picture twice
+// is stored once.
+void test_image_files(void)
+{
+	test_board("files.hatori");
+	Image img = GenImageChecked(90, 60, 8, 8, GREEN, BLACK);
+	ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	char path[512];
+	snprintf(path, sizeof(path), "%s", test_path("drop.png"));
+	CHECK(ExportImage(img, path));
+	int size = 0;
+	U8* png = LoadFileData(path, &size);
+	add_image_file_async(path, (Vector2) { 10, 10 });
+	add_image_bytes_async(".png", png, size, (Vector2) { 200, 10 });
+	add_image_file_async(test_path("missing.png"), (Vector2) { 0 });
+	UnloadFileData(png);
+	jobs_finish(&jobs);
+	end_undo_step();
+	CHECK(entities.count == 2);
+	if (entities.count == 2) {
+		Hatori_Image a = entities.items[0].entity.image;
+		Hatori_Image b = entities.items[1].entity.image;
+		CHECK(same_pixels(0, img) && a.current == b.current);
+		CHECK(a.size.x == 90 && a.size.y == 60 && b.pos.x == 200);
+	}
+	test_reopen();
+	CHECK(entities.count == 2 && same_pixels(1, img));
+	UnloadImage(img);
+}
+
+// Saving and loading keep every kind of entity, tombstones and images that
+// share pixels, and so does folding the journal into the board file.
+void test_save_load(void)
+{
+	test_board("round.hatori");
+	draw_line(0, 0, 10, 10);
+	draw_line(10, 10, 20, 0);
+	draw_line(20, 0, 30, 10);
+	do_op(OP_LINE_DELETE, 1, NULL, 0);
+	end_undo_step();
+
+	Hatori_BoardEntity be = { .type = ENTITY_TEXT, .z = z++, .pos = { 5, 6 },
+		.font_size = 30, .spacing = 2, .color = DARKGRAY };
+	add_text_entity(make_text(be, "hello", 5), be.z);
+	record_entity_op(OP_TEXT_ADD, 0, be, "hello", 5);
+	be.z = z++;
+	add_text_entity(make_text(be, "gone", 4), be.z);
+	record_entity_op(OP_TEXT_ADD, 0, be, "gone", 4);
+	end_undo_step();
+	do_op(OP_ENTITY_DELETE, 1, NULL, 0);
+	end_undo_step();
+
+	Image img = GenImageGradientLinear(100, 70, 45, ORANGE, SKYBLUE);
+	ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	selected_entity = add_test_image(img, 40, 40);
+	UnloadImage(img);
+	be = board_entity(entities.items[selected_entity]);
+	be.pos.x += 120;
+	be.z = z++;
+	CHECK(copy_image_entity(selected_entity, be) == 3);
+	record_entity_op(OP_IMAGE_COPY, selected_entity, be, NULL, 0);
+	end_undo_step();
+	// The edited image keeps the copy's pixels as its original.
+	edit_selected_image((Hatori_ImageEdit) { EDIT_VFLIP });
+	end_undo_step();
+
+	Test_Board saved = board_state();
+	CHECK(saved.line_count == 8 && saved.deleted_lines == 1);
+	CHECK(saved.entity_count == 4 && saved.entities[1].be.deleted);
+	CHECK(saved.entities[2].shares[0] == 2 && saved.entities[2].shares[1] == 2);
+	CHECK(saved.entities[3].shares[0] == 2 && saved.entities[3].shares[1] == 2);
+
+	checkpoint_board(true);
+	CHECK(journal.size == sizeof(Journal_FileHeader));
+	test_reopen();
+	CHECK(same_board(saved, board_state()));
+	CHECK(entities.items[3].entity.image.current
+			== entities.items[2].entity.image.original);
+
+	// What is journaled after the checkpoint replays on top of the file.
+	draw_line(30, 10, 40, 0);
+	do_op(OP_ENTITY_DELETE, 3, NULL, 0);
+	end_undo_step();
+	saved = board_state();
+	test_reopen();
+	CHECK(same_board(saved, board_state()));
+
+	char copy[512];
+	snprintf(copy, sizeof(copy), "%s", test_path("round-copy.hatori"));
+	CHECK(save_board(copy));
+	clear_board();
+	CHECK(load_board(copy));
+	CHECK(same_board(saved, board_state()));
+}
+
+// A checkpoint writes the board as it was when it started, a slice at a
+// time, and keeps what is journaled meanwhile.
+void test_checkpoint_slices(void)
+{
+	test_board("slices.hatori");
+	Image noise = GenImageColor(1024, 1024, BLANK);
+	U32* px = noise.data;
+	for (int i = 0; i < 1024 * 1024; ++i) {
+		px[i] = (U32)i * 2654435761u;
+	}
+	selected_entity = add_test_image(noise, 0, 0);
+	UnloadImage(noise);
+	draw_line(0, 0, 10, 10);
+	// The flipped pixels have no QOI bytes yet, a job encodes them.
+	edit_selected_image((Hatori_ImageEdit) { EDIT_HFLIP });
+	end_undo_step();
+	CHECK(journal.size >= JOURNAL_CHECKPOINT_SIZE);
+	Test_Board saved = board_state();
+
+	CHECK(!checkpoint_board_step(NULL) && checkpoint.active);
+	draw_line(10, 10, 20, 0);
+	edit_selected_image((Hatori_ImageEdit) { EDIT_VFLIP });
+	end_undo_step();
+	Test_Board edited = board_state();
+	int slices = 1;
+	for (; checkpoint.active && slices < 100; ++slices) {
+		if (checkpoint_board_step(NULL)) {
+			jobs_finish(&jobs);
+		}
+	}
+	CHECK(!checkpoint.active && slices > 3);
+	CHECK(journal.size > sizeof(Journal_FileHeader)
+			&& journal.size < JOURNAL_CHECKPOINT_SIZE);
+
+	CHECK(load_board(board_path));
+	CHECK(same_board(saved, board_state()));
+	test_reopen();
+	CHECK(same_board(edited, board_state()));
+}
+
+// Blob headers come from the board file and may be anything.
+void test_corrupt_blob(void)
+{
+	U8 header[22] = { 'q', 'o', 'i', 'f', 0, 0, 0, 2, 0, 0, 0, 3, 4, 0 };
+	Hatori_Pixels* p = pixels_from_blob((Hatori_Blob) { header, 22 }, false);
+	CHECK(p != NULL && p->width == 2 && p->height == 3);
+	if (p != NULL) {
+		pixels_release(p);
+	}
+	CHECK(pixels_from_blob((Hatori_Blob) { header, 21 }, false) == NULL);
+	header[0] = 'Q';
+	CHECK(pixels_from_blob((Hatori_Blob) { header, 22 }, false) == NULL);
+	header[0] = 'q';
+	header[7] = 0;
+	CHECK(pixels_from_blob((Hatori_Blob) { header, 22 }, false) == NULL);
+	memset(header + 4, 0xFF, 8);
+	CHECK(pixels_from_blob((Hatori_Blob) { header, 22 }, false) == NULL);
+	memcpy(header + 4, (U8[]) { 0, 1, 0, 0, 0, 1, 0, 0 }, 8);
+	CHECK(pixels_from_blob((Hatori_Blob) { header, 22 }, false) == NULL);
+}
+
+int main(int argc, char** argv)
+{
+	snprintf(test_dir, sizeof(test_dir), "%s/hatori-tests-XXXXXX",
+			getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp");
+	if (mkdtemp(test_dir) == NULL) {
+		fprintf(stderr, "%s: can't create %s\n", argv[0], test_dir);
+		return 1;
+	}
+	SetTraceLogLevel(LOG_WARNING);
+	init_hatori(TEST_WIDTH, TEST_HEIGHT);
+	if (!IsWindowReady()) {
+		return 1;
+	}
+
+	test_clear_undo_redo();
+	test_torn_journal();
+	test_stroke_append();
+	test_image_edit_undo();
+	test_image_files();
+	test_save_load();
+	test_checkpoint_slices();
+	test_corrupt_blob();
+
+	journal_close(&journal);
+	clear_board();
+	CloseWindow();
+	FilePathList files = LoadDirectoryFiles(test_dir);
+	for (unsigned int i = 0; i < files.count; ++i) {
+		remove(files.paths[i]);
+	}
+	UnloadDirectoryFiles(files);
+	remove(test_dir);
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures > 0 ? 1 : 0;
+}